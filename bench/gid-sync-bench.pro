@@ -0,0 +1,39 @@
+# Benchmark of the refresh state machine on synthetic repos with local bare
+# remotes. Linux only. Build and run from a build directory:
+#   qmake ../bench/gid-sync-bench.pro && make && ./gid-sync-bench --help
+
+QT       -= gui
+QT       += network # For QHostInfo
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+TARGET = gid-sync-bench
+
+INCLUDEPATH += ../src
+
+SOURCES += \
+    main.cpp \
+    syncbench.cpp \
+    ../src/gidfile.cpp \
+    ../src/git.cpp \
+    ../src/gitbackend.cpp \
+    ../src/hostlimiter.cpp \
+    ../src/refreshscheduler.cpp \
+    ../src/repocache.cpp \
+    ../src/settings.cpp \
+    ../src/syncengine.cpp \
+    ../src/tracer.cpp
+
+HEADERS += \
+    syncbench.h \
+    ../src/gidfile.h \
+    ../src/git.h \
+    ../src/gitbackend.h \
+    ../src/hostlimiter.h \
+    ../src/refreshscheduler.h \
+    ../src/repocache.h \
+    ../src/settings.h \
+    ../src/syncengine.h \
+    ../src/tracer.h \
+    ../src/version.h
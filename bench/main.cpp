@@ -0,0 +1,176 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "syncbench.h"
+#include "version.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QProcess>
+#include <QTemporaryDir>
+
+#include <iostream>
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("gid-sync-bench");
+    QCoreApplication::setApplicationVersion(APP_VERSION);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Benchmark of Gid-Sync refreshes on "
+                                     "synthetic repos with local remotes.");
+    parser.addHelpOption();
+
+    SyncBench::Config config;
+    QCommandLineOption dirOption("dir",
+        "Create the repos in <dir> (kept) instead of a temporary directory.",
+        "dir");
+    QCommandLineOption reposOption("repos", "Number of repos.", "n",
+                                   QString::number(config.repos));
+    QCommandLineOption filesOption("files", "Files per repo.", "n",
+                                   QString::number(config.files));
+    QCommandLineOption depthOption("depth", "Directory levels.", "n",
+                                   QString::number(config.depth));
+    QCommandLineOption fileSizeOption("file-size", "File size in bytes.", "n",
+                                      QString::number(config.fileSize));
+    QCommandLineOption historyOption("history", "Commits per repo.", "n",
+                                     QString::number(config.history));
+    QCommandLineOption manyReposOption("many-repos",
+        "Number of repos for the refresh-all scenario.", "n",
+        QString::number(config.manyRepos));
+    QCommandLineOption jobsOption("jobs", "Parallel refreshes.", "n",
+                                  QString::number(config.jobs));
+    QCommandLineOption seedOption("seed", "Random seed for file contents.", "n",
+                                  QString::number(config.seed));
+    QCommandLineOption scenarioOption("scenario",
+        "Run only this scenario (may be repeated): "
+        + SyncBench::allScenarios().join(", ") + ".", "name");
+    QCommandLineOption outOption("out",
+        "Write the JSON result to <file> instead of stdout.", "file");
+    QCommandLineOption recordOption("record",
+        "Record the Git commands of the scenario to <file>. Best used with a "
+        "single scenario.", "file");
+    QCommandLineOption replayOption("replay",
+        "Instead of the scenarios, refresh repos with Git commands answered "
+        "from the recording in <file>.", "file");
+    QCommandLineOption replayReposOption("replay-repos",
+        "Number of repos for the replay.", "n",
+        QString::number(config.replayRepos));
+    QCommandLineOption latencyScaleOption("latency-scale",
+        "Factor for the recorded Git command durations in the replay, 0 for "
+        "no waiting.", "x", QString::number(config.latencyScale));
+    parser.addOptions({dirOption, reposOption, filesOption, depthOption,
+                       fileSizeOption, historyOption, manyReposOption,
+                       jobsOption, seedOption, scenarioOption, outOption,
+                       recordOption, replayOption, replayReposOption,
+                       latencyScaleOption});
+    parser.process(a);
+
+    if (parser.isSet(recordOption) && parser.isSet(replayOption)) {
+        std::cerr << "Use either --record or --replay." << std::endl;
+        return 1;
+    }
+
+    config.repos = parser.value(reposOption).toInt();
+    config.files = qMax(4, parser.value(filesOption).toInt());
+    config.depth = qMax(0, parser.value(depthOption).toInt());
+    config.fileSize = qMax(1, parser.value(fileSizeOption).toInt());
+    config.history = qMax(1, parser.value(historyOption).toInt());
+    config.manyRepos = parser.value(manyReposOption).toInt();
+    config.jobs = qMax(1, parser.value(jobsOption).toInt());
+    config.seed = parser.value(seedOption).toUInt();
+    config.scenarios = parser.values(scenarioOption);
+    foreach (QString scenario, config.scenarios) {
+        if (!SyncBench::allScenarios().contains(scenario)) {
+            std::cerr << "Unknown scenario: " << scenario.toStdString()
+                      << std::endl;
+            return 2;
+        }
+    }
+    config.recordFile = parser.value(recordOption);
+    config.replayFile = parser.value(replayOption);
+    config.replayRepos = qMax(1, parser.value(replayReposOption).toInt());
+    config.latencyScale = qMax(0.0, parser.value(latencyScaleOption).toDouble());
+
+    QTemporaryDir tempDir;
+    if (parser.isSet(dirOption)) {
+        config.dir = QDir(parser.value(dirOption)).absolutePath();
+    } else if (tempDir.isValid()) {
+        config.dir = tempDir.path();
+    } else {
+        std::cerr << "Failed to create temporary directory." << std::endl;
+        return 1;
+    }
+
+    SyncBench bench(config);
+    if (!bench.setup()) {
+        std::cerr << "Setup failed: " << bench.errorString().toStdString()
+                  << std::endl;
+        return 1;
+    }
+
+    QJsonArray results;
+    int failed = 0;
+    foreach (SyncBench::Result r, bench.run()) {
+        results.append(r.toJson());
+        failed += r.failed;
+    }
+    if (!bench.saveRecording()) {
+        std::cerr << bench.errorString().toStdString() << std::endl;
+        return 1;
+    }
+
+    QProcess gitVersion;
+    gitVersion.start("git", {"--version"});
+    gitVersion.waitForFinished();
+
+    QJsonObject j;
+    j.insert("benchmark", "gid-sync");
+    j.insert("version", APP_VERSION);
+    j.insert("git", QString(gitVersion.readAllStandardOutput()).trimmed());
+    j.insert("config", config.toJson());
+    j.insert("setupMsecs", bench.setupMsecs());
+    j.insert("results", results);
+    QByteArray json = QJsonDocument(j).toJson();
+
+    if (parser.isSet(outOption)) {
+        QFile f(parser.value(outOption));
+        if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+            std::cerr << "Failed to write " << f.fileName().toStdString()
+                      << std::endl;
+            return 1;
+        }
+        f.write(json);
+    } else {
+        std::cout << json.toStdString();
+    }
+
+    if (failed > 0) {
+        std::cerr << "Refreshes failed: " << failed << ". Last error: "
+                  << bench.errorString().toStdString() << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,416 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "syncbench.h"
+
+#include "git.h"
+#include "syncengine.h"
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+
+#include <sys/resource.h>
+
+namespace {
+
+double msecs(const timeval& t)
+{
+    return t.tv_sec * 1000.0 + t.tv_usec / 1000.0;
+}
+
+QString quoted(QString path)
+{
+    return QString("\"%1\"").arg(path);
+}
+
+} // namespace
+
+QJsonObject SyncBench::Config::toJson() const
+{
+    QJsonObject j;
+    j.insert("repos", repos);
+    j.insert("files", files);
+    j.insert("depth", depth);
+    j.insert("fileSize", fileSize);
+    j.insert("history", history);
+    j.insert("manyRepos", manyRepos);
+    j.insert("jobs", jobs);
+    j.insert("seed", qint64(seed));
+    if (!replayFile.isEmpty()) {
+        j.insert("replayFile", replayFile);
+        j.insert("replayRepos", replayRepos);
+        j.insert("latencyScale", latencyScale);
+    }
+    return j;
+}
+
+QJsonObject SyncBench::Result::toJson() const
+{
+    QJsonObject j;
+    j.insert("scenario", scenario);
+    j.insert("repos", repos);
+    j.insert("failed", failed);
+    j.insert("wallMsecs", wallMsecs);
+    j.insert("gitCommands", gitCommands);
+    j.insert("gitProcesses", gitProcesses);
+    j.insert("cpuUserMsecs", cpuUserMsecs);
+    j.insert("cpuSystemMsecs", cpuSystemMsecs);
+    j.insert("childCpuUserMsecs", childCpuUserMsecs);
+    j.insert("childCpuSystemMsecs", childCpuSystemMsecs);
+    j.insert("maxRssKiB", maxRssKiB);
+    j.insert("maxChildRssKiB", maxChildRssKiB);
+    return j;
+}
+
+SyncBench::SyncBench(Config config)
+    : mConfig(config)
+    , mRandom(config.seed)
+{
+    if (!mConfig.replayFile.isEmpty()) {
+        mConfig.scenarios = QStringList({"replay"});
+    } else if (mConfig.scenarios.isEmpty()) {
+        mConfig.scenarios = allScenarios();
+    }
+}
+
+QStringList SyncBench::allScenarios()
+{
+    return {"idle", "edit", "remote-ahead", "diverged", "refresh-all"};
+}
+
+bool SyncBench::setup()
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    if (!QDir().mkpath(mConfig.dir)) {
+        mError = "Failed to create " + mConfig.dir;
+        return false;
+    }
+
+    if (!mConfig.recordFile.isEmpty() || !mConfig.replayFile.isEmpty()) {
+        mRecording.reset(new GitRecording());
+    }
+    if (!mConfig.replayFile.isEmpty()) {
+        GidFile::Result r = mRecording->load(mConfig.replayFile);
+        if (!r.success) {
+            mError = QString("Failed to load %1: %2")
+                         .arg(mConfig.replayFile, r.errorString);
+            return false;
+        }
+        if (mRecording->paths().isEmpty()) {
+            mError = "No Git commands in " + mConfig.replayFile;
+            return false;
+        }
+        // Git reads nothing from the repos, see GitBackend. They only need a
+        // directory to run in.
+        QString path = mConfig.dir + "/replay";
+        if (!QDir().mkpath(path)) {
+            mError = "Failed to create " + path;
+            return false;
+        }
+        for (int i = 0; i < mConfig.replayRepos; i++) {
+            BenchRepo repo;
+            repo.settings.reset(new Settings::Repo());
+            repo.settings->name = QString("replay%1").arg(i);
+            repo.settings->path = path;
+            mReplayRepos.append(repo);
+        }
+        mSetupMsecs = timer.elapsed();
+        return true;
+    }
+
+    QStringList scenarios = mConfig.scenarios;
+    bool needRepos = false;
+    foreach (QString s, scenarios) {
+        if (s != "refresh-all") { needRepos = true; }
+    }
+    if (needRepos) {
+        for (int i = 0; i < mConfig.repos; i++) {
+            BenchRepo repo;
+            if (!createRepo(QString("repo%1").arg(i), mConfig.files,
+                            mConfig.history, &repo)) {
+                return false;
+            }
+            mRepos.append(repo);
+        }
+    }
+    if (scenarios.contains("refresh-all")) {
+        for (int i = 0; i < mConfig.manyRepos; i++) {
+            BenchRepo repo;
+            if (!createRepo(QString("small%1").arg(i), 10, 1, &repo)) {
+                return false;
+            }
+            mManyRepos.append(repo);
+        }
+    }
+
+    mSetupMsecs = timer.elapsed();
+    return true;
+}
+
+qint64 SyncBench::setupMsecs()
+{
+    return mSetupMsecs;
+}
+
+QList<SyncBench::Result> SyncBench::run()
+{
+    QList<Result> ret;
+    foreach (QString scenario, mConfig.scenarios) {
+        if (scenario == "idle") {
+            ret.append(runScenario(scenario, mRepos, [](BenchRepo&)
+            {
+                return true;
+            }));
+        } else if (scenario == "edit") {
+            ret.append(runScenario(scenario, mRepos, [=](BenchRepo& repo)
+            {
+                return writeFile(repo.settings->path, 0, mConfig.depth);
+            }));
+        } else if (scenario == "remote-ahead") {
+            ret.append(runScenario(scenario, mRepos, [=](BenchRepo& repo)
+            {
+                return pushFromOther(repo, 1);
+            }));
+        } else if (scenario == "diverged") {
+            ret.append(runScenario(scenario, mRepos, [=](BenchRepo& repo)
+            {
+                // Different files, so the rebase has no conflicts
+                return pushFromOther(repo, 2)
+                       && writeFile(repo.settings->path, 3, mConfig.depth);
+            }));
+        } else if (scenario == "refresh-all") {
+            ret.append(runScenario(scenario, mManyRepos, [](BenchRepo&)
+            {
+                return true;
+            }));
+        } else if (scenario == "replay") {
+            ret.append(runScenario(scenario, mReplayRepos, [](BenchRepo&)
+            {
+                return true;
+            }));
+        } else {
+            mError = "Unknown scenario: " + scenario;
+        }
+    }
+    return ret;
+}
+
+bool SyncBench::saveRecording()
+{
+    if (mConfig.recordFile.isEmpty() || !mRecording) { return true; }
+
+    GidFile::Result r = mRecording->save(mConfig.recordFile);
+    if (!r.success) {
+        mError = QString("Failed to write %1: %2")
+                     .arg(mConfig.recordFile, r.errorString);
+    }
+    return r.success;
+}
+
+QString SyncBench::errorString()
+{
+    return mError;
+}
+
+bool SyncBench::createRepo(QString name, int files, int history, BenchRepo* repo)
+{
+    QString dir = mConfig.dir;
+    repo->remote = QString("%1/%2.git").arg(dir, name);
+    repo->other = QString("%1/%2-other").arg(dir, name);
+    QString path = QString("%1/%2").arg(dir, name);
+    QString url = "file://" + repo->remote;
+
+    // The other client creates the history and pushes it to the remote
+    if (!git(dir, "init -q --bare " + quoted(repo->remote))) { return false; }
+    if (!git(repo->remote, "symbolic-ref HEAD refs/heads/main")) { return false; }
+    if (!git(dir, "init -q " + quoted(repo->other))) { return false; }
+    if (!git(repo->other, "symbolic-ref HEAD refs/heads/main")) { return false; }
+    if (!git(repo->other, "config user.name bench")) { return false; }
+    if (!git(repo->other, "config user.email bench@localhost")) { return false; }
+
+    for (int i = 0; i < files; i++) {
+        if (!writeFile(repo->other, i, mConfig.depth)) { return false; }
+    }
+    if (!git(repo->other, "add -A")) { return false; }
+    if (!git(repo->other, "commit -q -m Initial")) { return false; }
+    for (int c = 1; c < history; c++) {
+        // A few files change in each commit
+        for (int i = 0; i < qMin(files, 5); i++) {
+            int index = mRandom.bounded(files);
+            if (!writeFile(repo->other, index, mConfig.depth)) { return false; }
+        }
+        if (!git(repo->other, "commit -q -a -m History")) { return false; }
+    }
+    if (!git(repo->other, "remote add origin " + quoted(url))) { return false; }
+    if (!git(repo->other, "push -q -u origin main")) { return false; }
+
+    // The repo that is synced
+    if (!git(dir, QString("clone -q %1 %2").arg(quoted(url), quoted(path)))) {
+        return false;
+    }
+    if (!git(path, "config user.name bench")) { return false; }
+    if (!git(path, "config user.email bench@localhost")) { return false; }
+
+    repo->settings.reset(new Settings::Repo());
+    repo->settings->name = name;
+    repo->settings->path = path;
+    return true;
+}
+
+bool SyncBench::git(QString path, QString arguments)
+{
+    Git::Output out = Git(path).runGit(arguments);
+    if (out.hasError) {
+        mError = out.toString();
+        return false;
+    }
+    return true;
+}
+
+bool SyncBench::writeFile(QString workTree, int index, int depth)
+{
+    QString filename = workTree + "/" + relativeFilePath(index, depth);
+    QDir().mkpath(QFileInfo(filename).path());
+
+    QFile f(filename);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        mError = "Failed to write " + filename;
+        return false;
+    }
+
+    // Text, so diffs and deltas behave like in typical synced folders
+    QByteArray header = QString("Generation %1\n").arg(mGeneration++).toUtf8();
+    QByteArray data = header;
+    int words = 0;
+    while (data.size() < mConfig.fileSize) {
+        data.append(QByteArray::number(mRandom.generate64(), 36));
+        data.append((++words % 8 == 0) ? '\n' : ' ');
+    }
+    data.truncate(qMax(mConfig.fileSize, header.size()));
+    f.write(data);
+    return true;
+}
+
+QString SyncBench::relativeFilePath(int index, int depth)
+{
+    // Spread files over directories with a fanout of 4 per level
+    QStringList parts;
+    int n = index;
+    for (int level = 0; level < depth; level++) {
+        parts.append(QString("d%1").arg(n % 4));
+        n /= 4;
+    }
+    parts.append(QString("file%1.txt").arg(index));
+    return parts.join("/");
+}
+
+bool SyncBench::pushFromOther(BenchRepo& repo, int fileIndex)
+{
+    // Catch up with what the synced repo pushed in earlier scenarios
+    if (!git(repo.other, "fetch -q origin")) { return false; }
+    if (!git(repo.other, "reset -q --hard origin/main")) { return false; }
+    if (!writeFile(repo.other, fileIndex, mConfig.depth)) { return false; }
+    if (!git(repo.other, "commit -q -a -m Other")) { return false; }
+    return git(repo.other, "push -q origin main");
+}
+
+SyncBench::Result SyncBench::runScenario(QString name, QList<BenchRepo> repos,
+                                         std::function<bool(BenchRepo&)> prepare)
+{
+    Result result;
+    result.scenario = name;
+    result.repos = repos.count();
+
+    for (int i = 0; i < repos.count(); i++) {
+        if (!prepare(repos[i])) {
+            result.failed = repos.count();
+            return result;
+        }
+    }
+
+    SyncEngine engine;
+    engine.setMaxParallel(mConfig.jobs);
+    engine.setOurName("bench");
+    engine.setHostLimits(0, 0, 0);
+    if (!mConfig.replayFile.isEmpty()) {
+        GitRecordingPtr recording = mRecording;
+        double scale = mConfig.latencyScale;
+        engine.setGitBackendFactory([=]()
+        {
+            return GitBackendPtr(new ReplayGitBackend(recording, scale));
+        });
+    } else if (!mConfig.recordFile.isEmpty()) {
+        GitRecordingPtr recording = mRecording;
+        engine.setGitBackendFactory([=]()
+        {
+            return GitBackendPtr(new RecordingGitBackend(recording));
+        });
+    }
+
+    bool replay = !mConfig.replayFile.isEmpty();
+    QMutex mutex;
+    engine.setEventCallback([&](SyncEngine::Event event)
+    {
+        if (event.type != SyncEngine::Event::Finished) { return; }
+        QMutexLocker locker(&mutex);
+        result.gitCommands += event.commands.count();
+        if (!replay) {
+            result.gitProcesses += event.commands.count();
+        }
+        if (!event.ok) {
+            result.failed++;
+            mError = event.repo->name + ": " + event.text;
+        }
+    });
+
+    rusage selfBefore, childrenBefore;
+    getrusage(RUSAGE_SELF, &selfBefore);
+    getrusage(RUSAGE_CHILDREN, &childrenBefore);
+    QElapsedTimer timer;
+    timer.start();
+
+    foreach (BenchRepo repo, repos) {
+        engine.refresh(repo.settings);
+    }
+    engine.waitForDone();
+
+    result.wallMsecs = timer.elapsed();
+    rusage selfAfter, childrenAfter;
+    getrusage(RUSAGE_SELF, &selfAfter);
+    getrusage(RUSAGE_CHILDREN, &childrenAfter);
+
+    result.cpuUserMsecs = msecs(selfAfter.ru_utime) - msecs(selfBefore.ru_utime);
+    result.cpuSystemMsecs = msecs(selfAfter.ru_stime) - msecs(selfBefore.ru_stime);
+    result.childCpuUserMsecs = msecs(childrenAfter.ru_utime)
+                               - msecs(childrenBefore.ru_utime);
+    result.childCpuSystemMsecs = msecs(childrenAfter.ru_stime)
+                                 - msecs(childrenBefore.ru_stime);
+    // Peaks since the start of the benchmark, in KiB on Linux
+    result.maxRssKiB = selfAfter.ru_maxrss;
+    result.maxChildRssKiB = childrenAfter.ru_maxrss;
+
+    return result;
+}
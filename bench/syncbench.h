@@ -0,0 +1,154 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* SyncBench
+ *
+ * Benchmark of the refresh state machine and the Git commands it runs, on
+ * synthetic repos with local bare remotes (file:// URLs), so it runs the same
+ * on any Linux box without network access.
+ *
+ * Each repo is a clone of a bare remote, with a second clone ("other") that
+ * plays another client pushing changes. The repos are refreshed through
+ * SyncEngine in scenarios:
+ *
+ *   idle          Nothing changed
+ *   edit          One file edited in each repo (commit and push)
+ *   remote-ahead  Another client pushed a commit (fetch and fast-forward)
+ *   diverged      Both sides changed different files (rebase and push)
+ *   refresh-all   Idle refresh of a large number of small repos
+ *
+ * Preparing a scenario is not measured. For each scenario the wall time, the
+ * number of Git commands and processes, the CPU time of this process and its
+ * children and the peak RSS are reported.
+ *
+ * The Git commands of the scenarios can be recorded to a file (see
+ * GitRecording). Replaying a recording refreshes many repos with the recorded
+ * Git output and durations instead of Git processes, so the engine itself is
+ * measured deterministically:
+ *
+ *   replay        Refresh of replayRepos repos answered from the recording
+ *
+ * The recorded repos are replayed in turn, each with its own sequence of Git
+ * output and refs, so the engine makes the same decisions as when recording.
+ */
+
+#ifndef SYNCBENCH_H
+#define SYNCBENCH_H
+
+#include "gitbackend.h"
+#include "settings.h"
+
+#include <QJsonObject>
+#include <QList>
+#include <QRandomGenerator>
+#include <QStringList>
+
+#include <functional>
+
+class SyncBench
+{
+public:
+    struct Config
+    {
+        QString dir;
+        // Repos of the idle, edit, remote-ahead and diverged scenarios
+        int repos = 10;
+        int files = 100;
+        // Directory levels the files are spread over
+        int depth = 3;
+        int fileSize = 1024;
+        // Number of commits in each repo
+        int history = 10;
+        // Repos of the refresh-all scenario. These have few files.
+        int manyRepos = 1000;
+        int jobs = 4;
+        quint32 seed = 1;
+        QStringList scenarios;
+        // Record the Git commands of the scenarios to this file
+        QString recordFile;
+        // Instead of the scenarios, replay this recording
+        QString replayFile;
+        int replayRepos = 1000;
+        // Factor for the recorded command durations, zero for no waiting
+        double latencyScale = 1.0;
+        QJsonObject toJson() const;
+    };
+
+    struct Result
+    {
+        QString scenario;
+        int repos = 0;
+        int failed = 0;
+        qint64 wallMsecs = 0;
+        // Git commands of the refreshes. Replayed commands don't start
+        // processes, so gitProcesses is 0 in a replay.
+        int gitCommands = 0;
+        int gitProcesses = 0;
+        double cpuUserMsecs = 0;
+        double cpuSystemMsecs = 0;
+        double childCpuUserMsecs = 0;
+        double childCpuSystemMsecs = 0;
+        qint64 maxRssKiB = 0;
+        qint64 maxChildRssKiB = 0;
+        QJsonObject toJson() const;
+    };
+
+    explicit SyncBench(Config config);
+
+    static QStringList allScenarios();
+
+    // Create the repos needed by the scenarios. Returns false on error.
+    bool setup();
+    qint64 setupMsecs();
+    QList<Result> run();
+    // Write the recorded Git commands to the record file, if any
+    bool saveRecording();
+    QString errorString();
+
+private:
+    struct BenchRepo
+    {
+        Settings::RepoPtr settings;
+        QString remote;
+        QString other;
+    };
+
+    Config mConfig;
+    QRandomGenerator mRandom;
+    QString mError;
+    qint64 mSetupMsecs = 0;
+    QList<BenchRepo> mRepos;
+    QList<BenchRepo> mManyRepos;
+    QList<BenchRepo> mReplayRepos;
+    GitRecordingPtr mRecording;
+    // Increases with every write so files always change
+    int mGeneration = 0;
+
+    bool createRepo(QString name, int files, int history, BenchRepo* repo);
+    bool git(QString path, QString arguments);
+    bool writeFile(QString workTree, int index, int depth);
+    static QString relativeFilePath(int index, int depth);
+    bool pushFromOther(BenchRepo& repo, int fileIndex);
+
+    Result runScenario(QString name, QList<BenchRepo> repos,
+                       std::function<bool(BenchRepo&)> prepare);
+};
+
+#endif // SYNCBENCH_H
@@ -1,5 +1,5 @@
 QT       += core gui
-QT       += network # For QHostInfo
+QT       += network # For QHostInfo, QLocalServer, QTcpServer
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -13,18 +13,54 @@ include(appicon/appicon.pri)
 
 SOURCES += \
     src/ThreadWorker.cpp \
+    src/controlserver.cpp \
+    src/fsmonitor.cpp \
     src/gidfile.cpp \
     src/git.cpp \
+    src/gitbackend.cpp \
+    src/hostlimiter.cpp \
+    src/latencyhistogram.cpp \
     src/main.cpp \
     src/mainwindow.cpp \
-    src/settings.cpp
+    src/metricsserver.cpp \
+    src/refreshplanner.cpp \
+    src/refreshscheduler.cpp \
+    src/repocache.cpp \
+    src/repocontroller.cpp \
+    src/repowatcher.cpp \
+    src/settings.cpp \
+    src/sshmux.cpp \
+    src/synccommand.cpp \
+    src/syncdaemon.cpp \
+    src/syncengine.cpp \
+    src/syncmetrics.cpp \
+    src/timerwheel.cpp \
+    src/tracer.cpp
 
 HEADERS += \
     src/ThreadWorker.h \
+    src/controlserver.h \
+    src/fsmonitor.h \
     src/gidfile.h \
     src/git.h \
+    src/gitbackend.h \
+    src/hostlimiter.h \
+    src/latencyhistogram.h \
     src/mainwindow.h \
+    src/metricsserver.h \
+    src/refreshplanner.h \
+    src/refreshscheduler.h \
+    src/repocache.h \
+    src/repocontroller.h \
+    src/repowatcher.h \
     src/settings.h \
+    src/sshmux.h \
+    src/synccommand.h \
+    src/syncdaemon.h \
+    src/syncengine.h \
+    src/syncmetrics.h \
+    src/timerwheel.h \
+    src/tracer.h \
     src/version.h
 
 FORMS += \
@@ -0,0 +1,151 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "controlserver.h"
+
+#include <QJsonDocument>
+#include <QProcessEnvironment>
+
+ControlServer::ControlServer(QObject *parent)
+    : QObject{parent}
+{
+    connect(&mServer, &QLocalServer::newConnection,
+            this, &ControlServer::onNewConnection);
+}
+
+void ControlServer::setRequestHandler(RequestHandler handler)
+{
+    mHandler = handler;
+}
+
+bool ControlServer::listen()
+{
+    // Only the current user may connect
+    mServer.setSocketOptions(QLocalServer::UserAccessOption);
+    if (mServer.listen(serverName())) { return true; }
+
+    // The socket may be left over from an instance that crashed. Only remove
+    // it if nobody is serving it.
+    QLocalSocket probe;
+    probe.connectToServer(serverName());
+    if (probe.waitForConnected(500)) {
+        emit message("Control socket is served by another instance.");
+        return false;
+    }
+    QLocalServer::removeServer(serverName());
+    if (mServer.listen(serverName())) { return true; }
+
+    emit message("Failed to start control socket: " + mServer.errorString());
+    return false;
+}
+
+bool ControlServer::isListening()
+{
+    return mServer.isListening();
+}
+
+QString ControlServer::serverName()
+{
+    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+    QString user = env.value("USER", env.value("USERNAME"));
+    return QString("gid-sync-control-%1").arg(user);
+}
+
+void ControlServer::publish(QJsonObject event)
+{
+    foreach (QLocalSocket* socket, mSubscribers) {
+        if (socket->bytesToWrite() > maxPendingBytes) {
+            emit message("Dropping control connection that does not read events.");
+            mSubscribers.removeAll(socket);
+            socket->abort();
+            continue;
+        }
+        write(socket, event);
+    }
+}
+
+QJsonObject ControlServer::errorReply(QString error)
+{
+    QJsonObject ret;
+    ret.insert("ok", false);
+    ret.insert("error", error);
+    return ret;
+}
+
+void ControlServer::onNewConnection()
+{
+    while (QLocalSocket* socket = mServer.nextPendingConnection()) {
+        connect(socket, &QLocalSocket::disconnected, this, [=]()
+        {
+            mSubscribers.removeAll(socket);
+            socket->deleteLater();
+        });
+        connect(socket, &QLocalSocket::readyRead, this, [=]()
+        {
+            onReadyRead(socket);
+        });
+    }
+}
+
+void ControlServer::onReadyRead(QLocalSocket* socket)
+{
+    while (socket->canReadLine()) {
+        QByteArray line = socket->readLine();
+        QJsonParseError parseError;
+        QJsonDocument doc = QJsonDocument::fromJson(line, &parseError);
+        if (parseError.error != QJsonParseError::NoError || !doc.isObject()) {
+            write(socket, errorReply("Invalid JSON: " + parseError.errorString()));
+            continue;
+        }
+        QJsonObject request = doc.object();
+        QJsonObject r = reply(socket, request);
+        if (request.contains("id")) {
+            r.insert("id", request.value("id"));
+        }
+        write(socket, r);
+    }
+
+    if (socket->bytesAvailable() > maxLineLength) {
+        emit message("Dropping control connection sending too long lines.");
+        socket->abort();
+    }
+}
+
+QJsonObject ControlServer::reply(QLocalSocket* socket, QJsonObject request)
+{
+    if (request.value("cmd").toString() == "subscribe") {
+        if (!mSubscribers.contains(socket)) {
+            mSubscribers.append(socket);
+        }
+        QJsonObject ret;
+        ret.insert("ok", true);
+        return ret;
+    }
+
+    if (!mHandler) {
+        return errorReply("Not available");
+    }
+    return mHandler(request);
+}
+
+void ControlServer::write(QLocalSocket* socket, QJsonObject json)
+{
+    socket->write(QJsonDocument(json).toJson(QJsonDocument::Compact) + "\n");
+}
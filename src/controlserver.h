@@ -0,0 +1,95 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* ControlServer
+ *
+ * Local socket for other tools (editor plugins, shell prompts, scripts) to
+ * query the state of repos and to control them, without running Git
+ * themselves.
+ *
+ * The protocol is line based: each request is a JSON object on a line, and
+ * is answered with a JSON object on a line, in order. A request may have an
+ * "id", which is copied to the reply. Replies have "ok", and "error" if not
+ * ok. Requests:
+ *
+ *   {"cmd": "list"}                     -> {"ok": true, "repos": [...]}
+ *   {"cmd": "status", "repo": r}        -> {"ok": true, "repo": {...}}
+ *   {"cmd": "refresh", "repo": r}       Refresh one repo, or all without repo
+ *   {"cmd": "pause", "repo": r}         Pause auto-refresh
+ *   {"cmd": "resume", "repo": r}        Resume auto-refresh
+ *   {"cmd": "subscribe"}                Receive events on this connection
+ *
+ * A repo is given by name or path. Events are JSON lines too, e.g.
+ * {"event": "status", "repo": {...}} when the status of a repo changes.
+ *
+ * All requests except subscribe are answered by the request handler, from
+ * the state kept in memory.
+ */
+
+#ifndef CONTROLSERVER_H
+#define CONTROLSERVER_H
+
+#include <QJsonObject>
+#include <QList>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QObject>
+
+#include <functional>
+
+class ControlServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ControlServer(QObject *parent = nullptr);
+
+    // Returns the reply to a request. Called in the thread of this object.
+    typedef std::function<QJsonObject(QJsonObject)> RequestHandler;
+    void setRequestHandler(RequestHandler handler);
+
+    bool listen();
+    bool isListening();
+    static QString serverName();
+
+    // Send an event to all subscribed connections
+    void publish(QJsonObject event);
+
+    static QJsonObject errorReply(QString error);
+
+signals:
+    void message(QString msg);
+
+private:
+    QLocalServer mServer;
+    RequestHandler mHandler;
+    QList<QLocalSocket*> mSubscribers;
+
+    // Connections that send longer lines or don't read their events are
+    // dropped.
+    static const int maxLineLength = 64 * 1024;
+    static const int maxPendingBytes = 1024 * 1024;
+
+    void onNewConnection();
+    void onReadyRead(QLocalSocket* socket);
+    QJsonObject reply(QLocalSocket* socket, QJsonObject request);
+    void write(QLocalSocket* socket, QJsonObject json);
+};
+
+#endif // CONTROLSERVER_H
@@ -0,0 +1,166 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "fsmonitor.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QProcessEnvironment>
+
+#include <stdio.h>
+
+FsMonitor::FsMonitor(RepoWatcher* watcher, QObject *parent)
+    : QObject{parent}
+    , mWatcher(watcher)
+{
+    connect(&mServer, &QLocalServer::newConnection,
+            this, &FsMonitor::onNewConnection);
+}
+
+bool FsMonitor::listen()
+{
+    // Only the current user may connect
+    mServer.setSocketOptions(QLocalServer::UserAccessOption);
+    if (mServer.listen(serverName())) { return true; }
+
+    // The socket may be left over from an instance that crashed. Only remove
+    // it if nobody is serving it.
+    QLocalSocket probe;
+    probe.connectToServer(serverName());
+    if (probe.waitForConnected(500)) {
+        emit message("Fsmonitor hook is served by another instance.");
+        return false;
+    }
+    QLocalServer::removeServer(serverName());
+    if (mServer.listen(serverName())) { return true; }
+
+    emit message("Failed to start fsmonitor hook server: " + mServer.errorString());
+    return false;
+}
+
+bool FsMonitor::isListening()
+{
+    return mServer.isListening();
+}
+
+QString FsMonitor::hookCommand()
+{
+    // Git runs the hook with the shell
+    QString app = QCoreApplication::applicationFilePath();
+    app.replace("'", "'\\''");
+    return QString("'%1' --fsmonitor-hook").arg(app);
+}
+
+int FsMonitor::runHook(QString version, QString token)
+{
+    // Failing makes Git scan the work tree itself
+    if (version != "2") { return 1; }
+
+    QLocalSocket socket;
+    socket.connectToServer(serverName());
+    if (!socket.waitForConnected(hookTimeoutMsecs)) { return 1; }
+
+    QJsonObject request;
+    request.insert("version", 2);
+    request.insert("token", token);
+    request.insert("worktree", QDir::currentPath());
+    socket.write(QJsonDocument(request).toJson(QJsonDocument::Compact) + "\n");
+    if (!socket.waitForBytesWritten(hookTimeoutMsecs)) { return 1; }
+
+    // The server closes the connection after the reply
+    QByteArray reply;
+    QElapsedTimer timer;
+    timer.start();
+    while (socket.state() == QLocalSocket::ConnectedState) {
+        int remaining = hookTimeoutMsecs - timer.elapsed();
+        if ((remaining <= 0) || !socket.waitForReadyRead(remaining)) { break; }
+        reply.append(socket.readAll());
+    }
+    if (socket.state() == QLocalSocket::ConnectedState) {
+        // Timed out
+        return 1;
+    }
+    reply.append(socket.readAll());
+    if (reply.isEmpty()) { return 1; }
+
+    fwrite(reply.constData(), 1, reply.size(), stdout);
+    fflush(stdout);
+    return 0;
+}
+
+QString FsMonitor::serverName()
+{
+    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+    QString user = env.value("USER", env.value("USERNAME"));
+    return QString("gid-sync-fsmonitor-%1").arg(user);
+}
+
+void FsMonitor::onNewConnection()
+{
+    while (QLocalSocket* socket = mServer.nextPendingConnection()) {
+        connect(socket, &QLocalSocket::disconnected,
+                socket, &QLocalSocket::deleteLater);
+        connect(socket, &QLocalSocket::readyRead, this, [=]()
+        {
+            onReadyRead(socket);
+        });
+    }
+}
+
+void FsMonitor::onReadyRead(QLocalSocket* socket)
+{
+    if (!socket->canReadLine()) { return; }
+
+    QJsonObject request = QJsonDocument::fromJson(socket->readLine()).object();
+    socket->write(reply(request));
+    socket->disconnectFromServer();
+}
+
+QByteArray FsMonitor::reply(QJsonObject request)
+{
+    // An empty reply makes the hook fail
+    if (request.value("version").toInt() != 2) { return QByteArray(); }
+
+    QString path = mWatcher->repoForWorktree(request.value("worktree").toString());
+    if (path.isEmpty()) { return QByteArray(); }
+
+    QString newToken;
+    QStringList changedPaths;
+    bool known = mWatcher->changesSince(path, request.value("token").toString(),
+                                        &newToken, &changedPaths);
+    if (newToken.isEmpty()) { return QByteArray(); }
+
+    // Version 2 reply: token, then the changed paths, all NUL terminated.
+    // A single "/" means everything could have changed.
+    QByteArray ret = newToken.toUtf8();
+    ret.append('\0');
+    if (!known) {
+        ret.append('/');
+        ret.append('\0');
+    } else {
+        foreach (QString changed, changedPaths) {
+            ret.append(changed.toUtf8());
+            ret.append('\0');
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,80 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* FsMonitor
+ *
+ * Serves Git's fsmonitor hook (protocol version 2) from the RepoWatcher, so
+ * that git status and git add only look at paths that changed instead of
+ * scanning the whole work tree.
+ *
+ * Git runs the hook as "<core.fsmonitor> 2 <token>" in the work tree. The
+ * hook is this app started with --fsmonitor-hook (see hookCommand()), which
+ * passes the request on to the running instance over a local socket and
+ * prints the reply. If no instance is running, or it does not watch the repo,
+ * the hook fails or reports everything as changed, and Git falls back to a
+ * full scan. The hook never reports fewer changes than it knows of.
+ *
+ * To use it for Git commands run outside of this app too:
+ *   git config core.fsmonitor "gid-sync --fsmonitor-hook"
+ *   git config core.fsmonitorHookVersion 2
+ */
+
+#ifndef FSMONITOR_H
+#define FSMONITOR_H
+
+#include "repowatcher.h"
+
+#include <QJsonObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QObject>
+
+class FsMonitor : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FsMonitor(RepoWatcher* watcher, QObject *parent = nullptr);
+
+    bool listen();
+    bool isListening();
+
+    // Command to set as core.fsmonitor to use this app as hook
+    static QString hookCommand();
+
+    // Entry point of the hook process. Writes the reply for Git to stdout and
+    // returns the process exit code.
+    static int runHook(QString version, QString token);
+
+signals:
+    void message(QString msg);
+
+private:
+    RepoWatcher* mWatcher;
+    QLocalServer mServer;
+
+    static const int hookTimeoutMsecs = 2000;
+    static QString serverName();
+
+    void onNewConnection();
+    void onReadyRead(QLocalSocket* socket);
+    QByteArray reply(QJsonObject request);
+};
+
+#endif // FSMONITOR_H
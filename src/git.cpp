@@ -19,6 +19,54 @@
  *****************************************************************************/
 
 #include "git.h"
+#include "gitbackend.h"
+
+#include <QElapsedTimer>
+#include <QRegularExpression>
+
+#include <cstring>
+
+#ifndef Q_OS_WIN
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+GitProcess::GitProcess(QObject* parent)
+    : QProcess(parent)
+{
+#if !defined(Q_OS_WIN) && (QT_VERSION >= QT_VERSION_CHECK(6, 0, 0))
+    setChildProcessModifier([]() { ::setpgid(0, 0); });
+#endif
+}
+
+void GitProcess::stopProcessGroup(int graceMsecs)
+{
+    if (state() == QProcess::NotRunning) { return; }
+
+#ifdef Q_OS_WIN
+    Q_UNUSED(graceMsecs);
+    kill();
+    waitForFinished(1000);
+#else
+    // Terminate first so git gets the chance to remove its lock files
+    pid_t pgid = static_cast<pid_t>(processId());
+    ::kill(-pgid, SIGTERM);
+    if (!waitForFinished(graceMsecs)) {
+        ::kill(-pgid, SIGKILL);
+        waitForFinished(1000);
+    }
+#endif
+}
+
+#if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
+void GitProcess::setupChildProcess()
+{
+#ifndef Q_OS_WIN
+    // Called in the child process before exec. Start a new process group.
+    ::setpgid(0, 0);
+#endif
+}
+#endif
 
 Git::Git(QObject* parent)
     : QObject(parent)
@@ -66,6 +114,15 @@ Git::Result<bool> Git::pathIsRepo(QString path)
 {
     if (path.isEmpty()) { path = mPath; }
 
+    Result<QString> isRepo = nativeRead(path, "rev-parse --git-dir", [=]()
+    {
+        return Result<QString>(readPathIsRepo(path).result ? "true" : "false");
+    });
+    return Result<bool>(isRepo.result == "true");
+}
+
+Git::Result<bool> Git::readPathIsRepo(QString path)
+{
     Result<bool> ret(false);
 
     // Quick & dirty check for normal repository (working dir)
@@ -97,9 +154,23 @@ Git::Result<bool> Git::isBareRepository(QString path)
     if (path.isEmpty()) { path = mPath; }
 
     Result<bool> ret(false);
-    ret.gitOutput = runGit("rev-parse --is-bare-repository", path);
-    if (!ret.gitOutput.hasError) {
-        ret.result = ret.gitOutput.stdoutput.startsWith("true");
+
+    QString dir = gitDir(path);
+    if (dir.isEmpty()) {
+        ret.gitOutput = nativeOutput("rev-parse --is-bare-repository",
+                                     "Not a git repository: " + path);
+        return ret;
+    }
+    ret.gitOutput = nativeOutput("rev-parse --is-bare-repository");
+
+    if (QDir(dir) != QDir(path)) {
+        // Path is a work tree with a separate Git directory
+        ret.result = false;
+    } else {
+        QString bare = configValue("core.bare", path).result.toLower();
+        ret.result = bare.isEmpty()
+                || (bare == "true") || (bare == "yes")
+                || (bare == "on") || (bare == "1");
     }
 
     return ret;
@@ -159,17 +230,36 @@ Git::Output Git::resetHard(QString path)
     return out;
 }
 
+Git::Output Git::addPaths(QStringList paths, QString path)
+{
+    if (path.isEmpty()) { path = mPath; }
+
+    QByteArray input;
+    foreach (QString p, paths) {
+        input.append(p.toUtf8());
+        input.append('\0');
+    }
+
+    return runGitWithInput("--literal-pathspecs add -A"
+                           " --pathspec-from-file=- --pathspec-file-nul",
+                           input, path);
+}
+
 int Git::getOngoingOperationState(QString path)
 {
     if (path.isEmpty()) { path = mPath; }
 
-    // TODO: This only works for root dir.
-    //       Can use git rev-parse --git-dir to get git dir from anywhere in
-    //       work tree.
+    return nativeRead(path, "ongoing operations", [=]()
+    {
+        return Result<QString>(QString::number(readOngoingOperationState(path)));
+    }).result.toInt();
+}
 
+int Git::readOngoingOperationState(QString path)
+{
     int ret = OpNone;
 
-    QDir dir(QString("%1/.git").arg(path));
+    QDir dir(gitDir(path));
     QStringList entries = dir.entryList(QDir::Files | QDir::Dirs | QDir::Hidden);
     if (entries.contains("rebase-merge")) {
         ret |= OpRebase;
@@ -214,20 +304,396 @@ Git::Result<Git::Compare> Git::compareWithHead(QString ref, QString path)
     return ret;
 }
 
+Git::Result<QString> Git::remoteRefSha(QString remote, QString ref, QString path)
+{
+    if (path.isEmpty()) { path = mPath; }
+
+    Result<QString> ret;
+
+    // With protocol v2 only the requested ref is advertised by the server
+    // (ls-refs with a ref prefix) instead of all of them.
+    ret.gitOutput = runGit(QString("-c protocol.version=2 ls-remote %1 %2")
+                               .arg(remote, ref), path);
+    if (!ret.gitOutput.hasError) {
+        // Lines are "<sha>\t<ref>". The pattern matches ref tails, so check
+        // for the exact ref.
+        foreach (QByteArray line, ret.gitOutput.stdoutput.split('\n')) {
+            QList<QByteArray> parts = line.trimmed().split('\t');
+            if ((parts.count() == 2) && (parts.value(1) == ref.toUtf8())) {
+                ret.result = QString(parts.value(0));
+                break;
+            }
+        }
+    }
+
+    return ret;
+}
+
+Git::Result<Git::Status> Git::statusSnapshot(QString path)
+{
+    if (path.isEmpty()) { path = mPath; }
+
+    Result<Status> ret;
+
+    Result<bool> bare = isBareRepository(path);
+    if (bare.result) {
+        // No work tree to get a status of
+        ret.result.bare = true;
+        ret.gitOutput = bare.gitOutput;
+        return ret;
+    }
+
+    ret.gitOutput = runGit("status --porcelain=v2 --branch -z", path);
+    if (ret.gitOutput.hasError) {
+        return ret;
+    }
+
+    Status& status = ret.result;
+
+    // Position after the n-th space of the record, where the path starts
+    auto pathStart = [](const QByteArray& record, int fields) -> int
+    {
+        int pos = 0;
+        for (int i = 0; i < fields; i++) {
+            pos = record.indexOf(' ', pos);
+            if (pos < 0) { return -1; }
+            pos++;
+        }
+        return pos;
+    };
+
+    // Records are NUL terminated. The original path of a renamed entry is a
+    // separate record following it.
+    QList<QByteArray> records = ret.gitOutput.stdoutput.split('\0');
+    for (int i = 0; i < records.count(); i++) {
+        const QByteArray& record = records[i];
+        if (record.isEmpty()) { continue; }
+
+        if (record.startsWith("# ")) {
+            QByteArray header = record.mid(2);
+            if (header.startsWith("branch.oid ")) {
+                QByteArray oid = header.mid(11);
+                status.oid = (oid == "(initial)") ? "" : QString(oid);
+            } else if (header.startsWith("branch.head ")) {
+                QByteArray head = header.mid(12);
+                status.branch = (head == "(detached)") ? "" : QString::fromUtf8(head);
+            } else if (header.startsWith("branch.upstream ")) {
+                status.upstream = QString::fromUtf8(header.mid(16));
+            } else if (header.startsWith("branch.ab ")) {
+                QList<QByteArray> ab = header.mid(10).split(' ');
+                status.ahead = ab.value(0).mid(1).toInt();
+                status.behind = ab.value(1).mid(1).toInt();
+                status.hasAheadBehind = true;
+            }
+            continue;
+        }
+
+        StatusEntry entry;
+        entry.type = record.at(0);
+        int start = -1;
+        switch (entry.type) {
+        case '1':
+            start = pathStart(record, 8);
+            break;
+        case '2':
+            start = pathStart(record, 9);
+            entry.origPath = QString::fromUtf8(records.value(i + 1));
+            i++;
+            break;
+        case 'u':
+            start = pathStart(record, 10);
+            break;
+        case '?':
+            start = 2;
+            break;
+        default:
+            // Ignored entries ('!') are not requested
+            continue;
+        }
+        if (start < 0) { continue; }
+
+        if (entry.type != '?') {
+            entry.xy = QString::fromUtf8(record.mid(2, 2));
+        }
+        entry.path = QString::fromUtf8(record.mid(start));
+        status.entries.append(entry);
+    }
+
+    return ret;
+}
+
+bool Git::Status::compareWithUpstream(Compare* compare) const
+{
+    if (!hasAheadBehind) { return false; }
+
+    if ((ahead == 0) && (behind == 0)) {
+        *compare = Compare::Equal;
+    } else if (behind == 0) {
+        *compare = Compare::Ahead;
+    } else if (ahead == 0) {
+        *compare = Compare::Behind;
+    } else {
+        *compare = Compare::Diverged;
+    }
+    return true;
+}
+
 Git::Result<QString> Git::currentBranch(QString path)
 {
     if (path.isEmpty()) { path = mPath; }
 
+    return nativeRead(path, "symbolic-ref --quiet --short HEAD", [=]()
+    {
+        return readCurrentBranch(path);
+    });
+}
+
+Git::Result<QString> Git::readCurrentBranch(QString path)
+{
     Result<QString> ret;
 
-    // The --quiet option will suppress an error output message
-    // --short ensures only the branch hame is given, without refs/heads/
+    // Read HEAD directly, equivalent to: symbolic-ref --quiet --short HEAD
 
-    ret.gitOutput = runGit(QString("symbolic-ref --quiet --short HEAD"), path);
-    if (!ret.gitOutput.hasError) {
-        ret.result = ret.gitOutput.stdoutput.trimmed();
+    QString command = "symbolic-ref --quiet --short HEAD";
+    QString dir = gitDir(path);
+    if (dir.isEmpty()) {
+        ret.gitOutput = nativeOutput(command, "Not a git repository: " + path);
+        return ret;
     }
 
+    QFile f(dir + "/HEAD");
+    if (!f.open(QIODevice::ReadOnly)) {
+        ret.gitOutput = nativeOutput(command, "Failed to read HEAD: "
+                                              + f.errorString());
+        return ret;
+    }
+    QString head = QString::fromUtf8(f.readAll()).trimmed();
+
+    if (!head.startsWith("ref:")) {
+        ret.gitOutput = nativeOutput(command, "HEAD is detached: " + head);
+        return ret;
+    }
+
+    QString ref = head.mid(4).trimmed();
+    if (ref.startsWith("refs/heads/")) {
+        ref = ref.mid(QString("refs/heads/").length());
+    }
+    ret.result = ref;
+    ret.gitOutput = nativeOutput(command);
+
+    return ret;
+}
+
+QString Git::gitDir(QString path)
+{
+    if (path.isEmpty()) { path = mPath; }
+
+    QDir dir(path);
+    QFileInfo dotGit(dir.filePath(".git"));
+
+    if (dotGit.isDir()) {
+        return dotGit.absoluteFilePath();
+    }
+
+    if (dotGit.isFile()) {
+        // Linked worktree or submodule. The file contains the path to the
+        // actual Git directory, possibly relative to the work tree.
+        QFile f(dotGit.absoluteFilePath());
+        if (f.open(QIODevice::ReadOnly)) {
+            QString line = QString::fromUtf8(f.readLine()).trimmed();
+            if (line.startsWith("gitdir:")) {
+                QString gitdir = line.mid(7).trimmed();
+                return QDir::cleanPath(dir.absoluteFilePath(gitdir));
+            }
+        }
+        return "";
+    }
+
+    // Bare repo
+    if (dir.exists("HEAD") && dir.exists("objects") && dir.exists("refs")) {
+        return dir.absolutePath();
+    }
+
+    return "";
+}
+
+QString Git::commonDir(QString path)
+{
+    QString dir = gitDir(path);
+    if (dir.isEmpty()) { return ""; }
+
+    // Linked worktrees point to the main Git directory with a commondir file
+    QFile f(dir + "/commondir");
+    if (f.open(QIODevice::ReadOnly)) {
+        QString common = QString::fromUtf8(f.readLine()).trimmed();
+        if (!common.isEmpty()) {
+            return QDir::cleanPath(QDir(dir).absoluteFilePath(common));
+        }
+    }
+
+    return dir;
+}
+
+Git::Result<QString> Git::resolveRef(QString ref, QString path)
+{
+    if (path.isEmpty()) { path = mPath; }
+
+    return nativeRead(path, "rev-parse " + ref, [=]()
+    {
+        return readRef(ref, path);
+    });
+}
+
+Git::Result<QString> Git::readRef(QString ref, QString path)
+{
+    Result<QString> ret;
+
+    QString command = "rev-parse " + ref;
+    QString dir = gitDir(path);
+    QString common = commonDir(path);
+    if (dir.isEmpty()) {
+        ret.gitOutput = nativeOutput(command, "Not a git repository: " + path);
+        return ret;
+    }
+
+    QString name = ref;
+    const int maxSymrefDepth = 5;
+    for (int depth = 0; depth < maxSymrefDepth; depth++) {
+
+        // HEAD and other per-worktree refs live in the worktree's own Git
+        // directory. Everything else is shared.
+        bool perWorktree = !name.startsWith("refs/")
+                        || name.startsWith("refs/bisect/")
+                        || name.startsWith("refs/worktree/")
+                        || name.startsWith("refs/rewritten/");
+
+        QString content;
+        QFile f((perWorktree ? dir : common) + "/" + name);
+        if (f.open(QIODevice::ReadOnly)) {
+            content = QString::fromUtf8(f.readAll()).trimmed();
+        } else if (!perWorktree) {
+            content = readPackedRef(common + "/packed-refs", name);
+        }
+
+        if (content.startsWith("ref:")) {
+            // Symbolic ref
+            name = content.mid(4).trimmed();
+            continue;
+        }
+
+        if (content.isEmpty()) {
+            ret.gitOutput = nativeOutput(command, "Unknown ref: " + name);
+        } else {
+            ret.result = content;
+            ret.gitOutput = nativeOutput(command);
+        }
+        return ret;
+    }
+
+    ret.gitOutput = nativeOutput(command, "Symbolic refs nested too deep: " + ref);
+    return ret;
+}
+
+Git::Result<QString> Git::configValue(QString key, QString path)
+{
+    if (path.isEmpty()) { path = mPath; }
+
+    return nativeRead(path, "config " + key, [=]()
+    {
+        return readConfigValue(key, path);
+    });
+}
+
+Git::Result<QString> Git::readConfigValue(QString key, QString path)
+{
+    Result<QString> ret;
+
+    // Section and key names are case insensitive, subsections are not
+    QString normalised = key;
+    int first = key.indexOf('.');
+    int last = key.lastIndexOf('.');
+    if ((first < 0) || (first == last)) {
+        normalised = key.toLower();
+    } else {
+        normalised = key.left(first).toLower()
+                   + key.mid(first, last - first)
+                   + key.mid(last).toLower();
+    }
+
+    QString command = "config " + key;
+    bool complete = true;
+    QList<ConfigEntry> config = readConfig(path, &complete);
+    if (!complete) {
+        ret.gitOutput = runGit("config --get " + key, path);
+        ret.result = QString::fromUtf8(ret.gitOutput.stdoutput).trimmed();
+        return ret;
+    }
+
+    bool found = false;
+    foreach (const ConfigEntry& entry, config) {
+        if (entry.key == normalised) {
+            ret.result = entry.value;
+            found = true;
+        }
+    }
+
+    ret.gitOutput = nativeOutput(command, found ? "" : "Key not found: " + key);
+    return ret;
+}
+
+Git::Result<QString> Git::remoteUrl(QString remote, QString path)
+{
+    if (path.isEmpty()) { path = mPath; }
+
+    return nativeRead(path, "remote get-url " + remote, [=]()
+    {
+        return readRemoteUrl(remote, path);
+    });
+}
+
+Git::Result<QString> Git::readRemoteUrl(QString remote, QString path)
+{
+    Result<QString> ret;
+
+    QString command = "remote get-url " + remote;
+    QString urlKey = QString("remote.%1.url").arg(remote);
+    QString url;
+    QString bestBase;
+    QString bestPrefix;
+    bool complete = true;
+    QList<ConfigEntry> config = readConfig(path, &complete);
+    if (!complete) {
+        ret.gitOutput = runGit("remote get-url " + remote, path);
+        ret.result = QString::fromUtf8(ret.gitOutput.stdoutput).trimmed();
+        return ret;
+    }
+
+    foreach (const ConfigEntry& entry, config) {
+        if (entry.key == urlKey) {
+            url = entry.value;
+        }
+    }
+    if (url.isEmpty()) {
+        ret.gitOutput = nativeOutput(command, "No such remote: " + remote);
+        return ret;
+    }
+
+    // Apply the longest matching url.<base>.insteadOf
+    foreach (const ConfigEntry& entry, config) {
+        if (!entry.key.startsWith("url.") || !entry.key.endsWith(".insteadof")) {
+            continue;
+        }
+        if (url.startsWith(entry.value) && (entry.value.length() > bestPrefix.length())) {
+            bestPrefix = entry.value;
+            bestBase = entry.key.mid(4, entry.key.length() - 4 - 10);
+        }
+    }
+    if (!bestPrefix.isEmpty()) {
+        url = bestBase + url.mid(bestPrefix.length());
+    }
+
+    ret.result = url;
+    ret.gitOutput = nativeOutput(command);
     return ret;
 }
 
@@ -241,17 +707,128 @@ void Git::setGitCmd(QString c)
     mGitCmd = c;
 }
 
-Git::Output Git::run(QString path, QString cmd)
+void Git::setTimeout(int msecs)
+{
+    mTimeoutMsecs = msecs;
+}
+
+int Git::timeout()
+{
+    return mTimeoutMsecs;
+}
+
+void Git::setCancelToken(CancelTokenPtr token)
+{
+    mCancelToken = token;
+}
+
+Git::CancelTokenPtr Git::cancelToken()
+{
+    return mCancelToken;
+}
+
+void Git::setFsmonitorHook(QString command)
+{
+    mFsmonitorHook = command;
+}
+
+QString Git::fsmonitorHook()
+{
+    return mFsmonitorHook;
+}
+
+void Git::setSshCommand(QString command)
+{
+    mSshCommand = command;
+
+    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+    if (!command.isEmpty()) {
+        env.insert("GIT_SSH_COMMAND", command);
+    }
+    mProcess.setProcessEnvironment(env);
+}
+
+QString Git::sshCommand()
+{
+    return mSshCommand;
+}
+
+void Git::setBackend(GitBackendPtr backend)
+{
+    mBackend = backend;
+}
+
+Git::Output Git::run(QString path, QString cmd, QByteArray input)
+{
+    Output out;
+    out.command = cmd;
+
+    if (mCancelToken && mCancelToken->isCancelled()) {
+        out.cancelled = true;
+        out.hasError = true;
+        return out;
+    }
+
+    if (!mBackend) {
+        return runProcess(path, cmd, input);
+    }
+    if (mBackend->run(path, cmd, input, mCancelToken, mTimeoutMsecs, &out)) {
+        return out;
+    }
+    out = runProcess(path, cmd, input);
+    mBackend->ran(path, cmd, input, out);
+    return out;
+}
+
+Git::Output Git::runProcess(QString path, QString cmd, QByteArray input)
 {
     Output out;
     out.command = cmd;
+
+    QElapsedTimer timer;
+    timer.start();
+
     mProcess.setWorkingDirectory(path);
     mProcess.start(cmd);
-    mProcess.waitForFinished();
+    if (!mProcess.waitForStarted()) {
+        out.durationMsecs = timer.elapsed();
+        out.erroroutput = mProcess.errorString().toUtf8();
+        out.hasError = true;
+        return out;
+    }
+    if (!input.isEmpty()) {
+        // Written while waiting below
+        mProcess.write(input);
+    }
+    mProcess.closeWriteChannel();
+
+    // Wait in short steps so the timeout and cancel token can be checked.
+    // waitForFinished() returns false immediately if the process is not
+    // running anymore.
+    const int stepMsecs = 100;
+    while (!mProcess.waitForFinished(stepMsecs)) {
+        if (mProcess.state() == QProcess::NotRunning) {
+            break;
+        }
+        if (mCancelToken && mCancelToken->isCancelled()) {
+            out.cancelled = true;
+            mProcess.stopProcessGroup();
+            break;
+        }
+        if ((mTimeoutMsecs > 0) && (timer.elapsed() > mTimeoutMsecs)) {
+            out.timedOut = true;
+            mProcess.stopProcessGroup();
+            break;
+        }
+    }
+
+    out.durationMsecs = timer.elapsed();
     out.stdoutput = mProcess.readAllStandardOutput();
     out.erroroutput = mProcess.readAllStandardError();
 
-    if (mProcess.exitStatus() == QProcess::CrashExit) {
+    if (out.timedOut || out.cancelled) {
+        out.hasError = true;
+    } else if (mProcess.exitStatus() == QProcess::CrashExit) {
         out.hasError = true;
     } else {
         out.exitcode = mProcess.exitCode();
@@ -266,10 +843,512 @@ Git::Output Git::run(QString path, QString cmd)
 }
 
 Git::Output Git::runGit(QString arguments, QString path)
+{
+    return runGitWithInput(arguments, QByteArray(), path);
+}
+
+Git::Output Git::runGitWithInput(QString arguments, QByteArray input, QString path)
 {
     if (path.isEmpty()) { path = mPath; }
 
-    return run(path, QString("%1 %2").arg(mGitCmd).arg(arguments));
+    QString config;
+    if (!mFsmonitorHook.isEmpty()) {
+        config = QString("-c \"core.fsmonitor=%1\" -c core.fsmonitorHookVersion=2 ")
+                     .arg(mFsmonitorHook);
+    }
+
+    qint64 traceStart = mTracer ? mTracer->nowUsecs() : 0;
+    Output out = run(path, QString("%1 %2%3").arg(mGitCmd).arg(config).arg(arguments),
+                     input);
+    if (mTracer) {
+        QJsonObject args;
+        args.insert("path", path);
+        args.insert("arguments", arguments);
+        args.insert("exitcode", out.exitcode);
+        mTracer->complete("git " + subcommand(arguments), "git", traceStart,
+                          args);
+    }
+    if (mRecordCommandTimes) {
+        CommandTime t;
+        t.name = subcommand(arguments);
+        t.msecs = out.durationMsecs;
+        mCommandTimes.append(t);
+    }
+    return out;
+}
+
+void Git::setTracer(TracerPtr tracer)
+{
+    mTracer = tracer;
+}
+
+void Git::setRecordCommandTimes(bool record)
+{
+    mRecordCommandTimes = record;
+}
+
+QList<Git::CommandTime> Git::takeCommandTimes()
+{
+    QList<CommandTime> ret = mCommandTimes;
+    mCommandTimes.clear();
+    return ret;
+}
+
+QString Git::subcommand(QString arguments)
+{
+    // Skip global options, e.g. "-c key=value --literal-pathspecs add"
+    QStringList words = arguments.simplified().split(" ");
+    for (int i = 0; i < words.count(); i++) {
+        QString word = words.at(i);
+        if ((word == "-c") || (word == "-C")) {
+            i++;
+        } else if (!word.startsWith('-')) {
+            return word;
+        }
+    }
+    return "git";
+}
+
+QList<Git::ConfigEntry> Git::parseConfigFile(QString filename)
+{
+    QList<ConfigEntry> entries;
+
+    QFile f(filename);
+    if (!f.open(QIODevice::ReadOnly)) {
+        return entries;
+    }
+    const QString text = QString::fromUtf8(f.readAll());
+
+    // Keys are stored as section.name or section.subsection.name, with section
+    // and name in lower case.
+    QString section;
+    int i = 0;
+    int n = text.length();
+
+    auto skipLine = [&]()
+    {
+        while ((i < n) && (text[i] != '\n')) { i++; }
+    };
+
+    while (i < n) {
+        QChar c = text[i];
+
+        if (c.isSpace()) {
+            i++;
+            continue;
+        }
+
+        if ((c == '#') || (c == ';')) {
+            skipLine();
+            continue;
+        }
+
+        if (c == '[') {
+            int end = text.indexOf(']', i);
+            if (end < 0) { break; }
+            QString header = text.mid(i + 1, end - i - 1).trimmed();
+            i = end + 1;
+
+            int quote = header.indexOf('"');
+            if (quote >= 0) {
+                // [section "subsection"]
+                QString sub = header.mid(quote + 1);
+                if (sub.endsWith('"')) { sub.chop(1); }
+                sub.replace("\\\\", "\\").replace("\\\"", "\"");
+                section = header.left(quote).trimmed().toLower() + "." + sub;
+            } else {
+                // [section] or deprecated [section.subsection]
+                section = header.toLower();
+            }
+            continue;
+        }
+
+        // Key name
+        int start = i;
+        while ((i < n) && (text[i].isLetterOrNumber() || (text[i] == '-'))) {
+            i++;
+        }
+        QString name = text.mid(start, i - start).toLower();
+        if (name.isEmpty()) {
+            skipLine();
+            continue;
+        }
+        while ((i < n) && ((text[i] == ' ') || (text[i] == '\t'))) {
+            i++;
+        }
+
+        QString value;
+        if ((i < n) && (text[i] == '=')) {
+            i++;
+            // Value, with quotes, escapes, comments and line continuations.
+            // Leading and trailing whitespace is dropped outside quotes.
+            bool inQuote = false;
+            bool started = false;
+            QString pendingSpace;
+            while ((i < n) && (text[i] != '\n')) {
+                c = text[i];
+                if (!inQuote && ((c == '#') || (c == ';'))) {
+                    skipLine();
+                    break;
+                }
+                if (c == '\\') {
+                    QChar e = (i + 1 < n) ? text[i + 1] : QChar();
+                    if (e == '\r') {
+                        i++;
+                        e = (i + 1 < n) ? text[i + 1] : QChar();
+                    }
+                    i += 2;
+                    if (e == '\n') { continue; }
+                    if (e == 'n') { e = '\n'; }
+                    else if (e == 't') { e = '\t'; }
+                    else if (e == 'b') { e = '\b'; }
+                    value += pendingSpace;
+                    pendingSpace.clear();
+                    value += e;
+                    started = true;
+                    continue;
+                }
+                if (c == '"') {
+                    inQuote = !inQuote;
+                    value += pendingSpace;
+                    pendingSpace.clear();
+                    started = true;
+                    i++;
+                    continue;
+                }
+                if ((c == ' ') || (c == '\t') || (c == '\r')) {
+                    if (inQuote) {
+                        value += c;
+                    } else if (started) {
+                        pendingSpace += c;
+                    }
+                    i++;
+                    continue;
+                }
+                value += pendingSpace;
+                pendingSpace.clear();
+                value += c;
+                started = true;
+                i++;
+            }
+        } else {
+            // A key without value is a boolean true
+            value = "true";
+            skipLine();
+        }
+
+        if (!section.isEmpty()) {
+            entries.append({section + "." + name, value});
+        }
+    }
+
+    return entries;
+}
+
+QStringList Git::configFiles(QString path)
+{
+    if (path.isEmpty()) { path = mPath; }
+
+    bool complete = true;
+    QStringList files;
+    readConfig(path, &complete, &files);
+    if (!complete) {
+        return QStringList();
+    }
+    files.removeDuplicates();
+    return files;
+}
+
+QList<Git::ConfigEntry> Git::readConfig(QString path, bool* complete,
+                                        QStringList* files)
+{
+    // Same order of precedence as git: later entries override earlier ones.
+    QList<ConfigEntry> entries;
+    *complete = true;
+
+    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+
+    if (!env.contains("GIT_CONFIG_NOSYSTEM")) {
+#ifdef Q_OS_WIN
+        QString system = "C:/Program Files/Git/etc/gitconfig";
+#else
+        QString system = "/etc/gitconfig";
+#endif
+        readConfigFile(env.value("GIT_CONFIG_SYSTEM", system), path, 0,
+                       &entries, complete, files);
+    }
+
+    if (env.contains("GIT_CONFIG_GLOBAL")) {
+        readConfigFile(env.value("GIT_CONFIG_GLOBAL"), path, 0, &entries,
+                       complete, files);
+    } else {
+        QString xdgConfig = env.value("XDG_CONFIG_HOME",
+                                      QDir::homePath() + "/.config");
+        readConfigFile(xdgConfig + "/git/config", path, 0, &entries, complete,
+                       files);
+        readConfigFile(QDir::homePath() + "/.gitconfig", path, 0, &entries,
+                       complete, files);
+    }
+
+    QString common = commonDir(path);
+    if (!common.isEmpty()) {
+        readConfigFile(common + "/config", path, 0, &entries, complete, files);
+    }
+
+    // Config from the command line or environment (GIT_CONFIG_COUNT etc.)
+    // is not read. Let git handle it.
+    if (env.contains("GIT_CONFIG_PARAMETERS") || env.contains("GIT_CONFIG_COUNT")) {
+        *complete = false;
+    }
+
+    return entries;
+}
+
+void Git::readConfigFile(QString filename, QString path, int depth,
+                         QList<ConfigEntry>* entries, bool* complete,
+                         QStringList* files)
+{
+    // Same limit as git
+    const int maxIncludeDepth = 10;
+    if (depth > maxIncludeDepth) {
+        *complete = false;
+        return;
+    }
+    if (files) {
+        files->append(filename);
+    }
+
+    QString fileDir = QFileInfo(filename).absolutePath();
+    auto expandPath = [&](QString p) -> QString
+    {
+        if (p.startsWith("~/")) {
+            return QDir::homePath() + p.mid(1);
+        }
+        return QDir(fileDir).absoluteFilePath(p);
+    };
+
+    // Included files are read in place of the include directive
+    foreach (const ConfigEntry& entry, parseConfigFile(filename)) {
+        entries->append(entry);
+
+        if (entry.key == "include.path") {
+            readConfigFile(expandPath(entry.value), path, depth + 1, entries,
+                           complete, files);
+            continue;
+        }
+        if (!entry.key.startsWith("includeif.") || !entry.key.endsWith(".path")) {
+            continue;
+        }
+
+        QString condition = entry.key.mid(10, entry.key.length() - 10 - 5);
+        bool matches = false;
+        if (condition.startsWith("gitdir:") || condition.startsWith("gitdir/i:")) {
+            bool caseInsensitive = condition.startsWith("gitdir/i:");
+            QString pattern = condition.mid(condition.indexOf(':') + 1);
+            if (pattern.startsWith("~/")) {
+                pattern = QDir::homePath() + pattern.mid(1);
+            } else if (pattern.startsWith("./")) {
+                pattern = fileDir + pattern.mid(1);
+            } else if (!QDir::isAbsolutePath(pattern)) {
+                pattern = "**/" + pattern;
+            }
+            QString dir = gitDir(path);
+            if (!dir.isEmpty()) {
+                QString canonical = QFileInfo(dir).canonicalFilePath();
+                matches = matchesIncludePattern(pattern, dir, caseInsensitive)
+                          || matchesIncludePattern(pattern, canonical,
+                                                   caseInsensitive);
+            }
+        } else if (condition.startsWith("onbranch:")) {
+            if (files) {
+                // Switching branches may change the config
+                files->append(gitDir(path) + "/HEAD");
+            }
+            Result<QString> branch = readCurrentBranch(path);
+            if (!branch.gitOutput.hasError) {
+                matches = matchesIncludePattern(condition.mid(9), branch.result);
+            }
+        } else {
+            // E.g. hasconfig:remote.*.url:
+            *complete = false;
+        }
+        if (matches) {
+            readConfigFile(expandPath(entry.value), path, depth + 1, entries,
+                           complete, files);
+        }
+    }
+}
+
+bool Git::matchesIncludePattern(QString pattern, QString path,
+                                bool caseInsensitive)
+{
+    if (pattern.endsWith('/')) {
+        pattern += "**";
+    }
+
+    // Translate the wildmatch pattern to a regular expression. * and ? do
+    // not match a slash, **/ matches any number of directories.
+    QString re = "^";
+    int i = 0;
+    while (i < pattern.length()) {
+        QChar c = pattern[i];
+        if (pattern.mid(i).startsWith("**/")) {
+            re += "(.*/)?";
+            i += 3;
+        } else if (pattern.mid(i) == "**") {
+            re += ".*";
+            i += 2;
+        } else if (c == '*') {
+            re += "[^/]*";
+            i++;
+        } else if (c == '?') {
+            re += "[^/]";
+            i++;
+        } else if (c == '[') {
+            int end = pattern.indexOf(']', i + 2);
+            if (end < 0) {
+                re += "\\[";
+                i++;
+            } else {
+                QString set = pattern.mid(i + 1, end - i - 1);
+                if (set.startsWith('!')) { set[0] = '^'; }
+                re += "[" + set.replace("\\", "\\\\") + "]";
+                i = end + 1;
+            }
+        } else {
+            re += QRegularExpression::escape(QString(c));
+            i++;
+        }
+    }
+    re += "$";
+
+    QRegularExpression regex(re, caseInsensitive
+                                 ? QRegularExpression::CaseInsensitiveOption
+                                 : QRegularExpression::NoPatternOption);
+    return regex.match(path).hasMatch();
+}
+
+QString Git::readPackedRef(QString filename, QString ref)
+{
+    QFile f(filename);
+    if (!f.open(QIODevice::ReadOnly)) { return ""; }
+    qint64 size = f.size();
+    if (size <= 0) { return ""; }
+
+    const char* data = reinterpret_cast<const char*>(f.map(0, size));
+    if (!data) { return ""; }
+
+    // Lines are "<sha> <refname>", optionally followed by a peeled line
+    // "^<sha>" for annotated tags. The header states whether the file is
+    // sorted by refname, which allows a binary search.
+    QByteArray target = ref.toUtf8();
+    QByteArray ret;
+    bool sorted = false;
+    qint64 begin = 0;
+
+    auto lineEnd = [&](qint64 pos) -> qint64
+    {
+        const char* nl = static_cast<const char*>(memchr(data + pos, '\n', size - pos));
+        return nl ? (nl - data) : size;
+    };
+    auto lineStart = [&](qint64 pos, qint64 lo) -> qint64
+    {
+        while ((pos > lo) && (data[pos - 1] != '\n')) { pos--; }
+        return pos;
+    };
+    // Returns the refname of the record at pos and stores its sha
+    auto parseRecord = [&](qint64 pos, QByteArray* sha) -> QByteArray
+    {
+        qint64 end = lineEnd(pos);
+        QByteArray line(data + pos, end - pos);
+        if (line.endsWith('\r')) { line.chop(1); }
+        int space = line.indexOf(' ');
+        if (space < 0) { return QByteArray(); }
+        *sha = line.left(space);
+        return line.mid(space + 1);
+    };
+
+    while ((begin < size) && (data[begin] == '#')) {
+        QByteArray header(data + begin, lineEnd(begin) - begin);
+        if (header.contains(" sorted")) { sorted = true; }
+        begin = lineEnd(begin) + 1;
+    }
+
+    if (sorted) {
+        qint64 lo = begin;
+        qint64 hi = size;
+        while (lo < hi) {
+            qint64 mid = lo + (hi - lo) / 2;
+            qint64 pos = lineStart(mid, lo);
+            if ((data[pos] == '^') && (pos > lo)) {
+                // Peeled line belongs to the previous record
+                pos = lineStart(pos - 1, lo);
+            }
+            QByteArray sha;
+            QByteArray name = parseRecord(pos, &sha);
+            int cmp = qstrcmp(name, target);
+            if (cmp == 0) {
+                ret = sha;
+                break;
+            } else if (cmp < 0) {
+                // Move past this record and its peeled line, if any
+                lo = lineEnd(pos) + 1;
+                if ((lo < size) && (data[lo] == '^')) {
+                    lo = lineEnd(lo) + 1;
+                }
+            } else {
+                hi = pos;
+            }
+        }
+    } else {
+        qint64 pos = begin;
+        while (pos < size) {
+            if (data[pos] != '^') {
+                QByteArray sha;
+                if (parseRecord(pos, &sha) == target) {
+                    ret = sha;
+                    break;
+                }
+            }
+            pos = lineEnd(pos) + 1;
+        }
+    }
+
+    f.unmap(reinterpret_cast<uchar*>(const_cast<char*>(data)));
+
+    return QString::fromUtf8(ret);
+}
+
+Git::Result<QString> Git::nativeRead(QString path, QString command,
+                                     std::function<Result<QString>()> read)
+{
+    // Named like the output of the reader, see nativeOutput()
+    QString cmd = "(native) " + command;
+
+    Result<QString> ret;
+    if (mBackend && mBackend->run(path, cmd, QByteArray(), CancelTokenPtr(),
+                                  0, &ret.gitOutput)) {
+        ret.result = QString::fromUtf8(ret.gitOutput.stdoutput);
+        return ret;
+    }
+
+    ret = read();
+    if (mBackend) {
+        Output out = ret.gitOutput;
+        out.stdoutput = ret.result.toUtf8();
+        mBackend->ran(path, cmd, QByteArray(), out);
+    }
+    return ret;
+}
+
+Git::Output Git::nativeOutput(QString command, QString error)
+{
+    Output out;
+    out.command = "(native) " + command;
+    out.hasError = !error.isEmpty();
+    out.exitcode = out.hasError ? 1 : 0;
+    out.erroroutput = error.toUtf8();
+    return out;
 }
 
 void Git::init()
@@ -285,8 +1364,14 @@ QString Git::Output::toString() const
 {
     QString s;
     s.append("Command: " + command + "\n");
-    s.append(QString("Exitcode: %1 - %2\n")
-                 .arg(exitcode).arg(exitcode == 0 ? "Success" : "Error"));
+    if (timedOut) {
+        s.append(QString("Timed out after %1 ms\n").arg(durationMsecs));
+    } else if (cancelled) {
+        s.append("Cancelled\n");
+    } else {
+        s.append(QString("Exitcode: %1 - %2\n")
+                     .arg(exitcode).arg(exitcode == 0 ? "Success" : "Error"));
+    }
     s.append("Stdout:\n" + stdoutput + "\n");
     s.append("Stderr:\n" + erroroutput + "\n");
     return s;
@@ -21,12 +21,39 @@
 #ifndef GIT_H
 #define GIT_H
 
+#include <QAtomicInt>
 #include <QDir>
 #include <QFileInfo>
 #include <QObject>
 #include <QProcess>
+#include <QSharedPointer>
 #include <QStringList>
 
+#include <functional>
+
+#include "tracer.h"
+
+class GitBackend;
+typedef QSharedPointer<GitBackend> GitBackendPtr;
+
+// QProcess that starts the command in its own process group, so the command
+// and everything it started (e.g. ssh started by git fetch) can be stopped
+// together.
+class GitProcess : public QProcess
+{
+public:
+    explicit GitProcess(QObject* parent = nullptr);
+
+    // Terminate the whole process group, and kill it if it does not exit
+    // within graceMsecs.
+    void stopProcessGroup(int graceMsecs = 2000);
+
+#if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
+protected:
+    void setupChildProcess() override;
+#endif
+};
+
 class Git : public QObject
 {
     Q_OBJECT
@@ -40,9 +67,25 @@ public:
         QByteArray erroroutput;
         int exitcode = -1;
         bool hasError = false;
+        // Process was stopped because it ran longer than the timeout
+        bool timedOut = false;
+        // Process was stopped because the cancel token was triggered
+        bool cancelled = false;
+        qint64 durationMsecs = 0;
         QString toString() const;
     };
 
+    // Shared between threads to cancel commands of a Git object from anywhere.
+    class CancelToken
+    {
+    public:
+        void cancel() { mCancelled.storeRelease(1); }
+        bool isCancelled() const { return mCancelled.loadAcquire() != 0; }
+    private:
+        QAtomicInt mCancelled;
+    };
+    typedef QSharedPointer<CancelToken> CancelTokenPtr;
+
     template <typename T>
     struct Result {
         T result;
@@ -63,6 +106,10 @@ public:
     Output cleanDryRun(QString path = "");
     Output clean(QString path = "");
     Output resetHard(QString path = "");
+    // Stage changes (including new and deleted files) of only the specified
+    // paths, relative to the work tree, like add -A limited to those paths.
+    // Paths are passed literally, not as patterns.
+    Output addPaths(QStringList paths, QString path = "");
 
     enum OngoingOperation {
         OpNone = 0x00,
@@ -82,21 +129,171 @@ public:
     };
     Result<Compare> compareWithHead(QString ref, QString path = "");
 
+    struct StatusEntry {
+        // '1': changed, '2': renamed or copied, 'u': unmerged, '?': untracked
+        char type = '1';
+        // Index and work tree status, e.g. ".M" (see git status --porcelain=v2)
+        QString xy;
+        QString path;
+        // Original path of a renamed or copied entry
+        QString origPath;
+    };
+
+    struct Status {
+        bool bare = false;
+        // Sha of HEAD. Empty for a new repo without commits.
+        QString oid;
+        // Empty if HEAD is detached
+        QString branch;
+        // E.g. origin/master. Empty if no upstream is configured.
+        QString upstream;
+        // Only valid if the upstream exists
+        bool hasAheadBehind = false;
+        int ahead = 0;
+        int behind = 0;
+        QList<StatusEntry> entries;
+
+        bool isModified() const { return !entries.isEmpty(); }
+        // Compare result relative to the upstream, if known
+        bool compareWithUpstream(Compare* compare) const;
+    };
+    // Branch info and changed entries from a single git status command
+    Result<Status> statusSnapshot(QString path = "");
+
     Result<QString> currentBranch(QString path = "");
 
+    // Native readers. These read the files in the Git directory directly
+    // instead of starting a git process. Like commands, they go through the
+    // backend if set, except gitDir() and commonDir() which only locate the
+    // files.
+
+    // Git directory of a work tree, following the gitdir file of linked
+    // worktrees and submodules. For a bare repo this is the path itself.
+    // Empty if path is not a repo.
+    QString gitDir(QString path = "");
+    // Directory containing the refs, packed-refs and config shared by all
+    // worktrees of the repo.
+    QString commonDir(QString path = "");
+    // Sha of a ref (e.g. HEAD, refs/remotes/origin/master), following
+    // symbolic refs.
+    Result<QString> resolveRef(QString ref, QString path = "");
+    // Last value of the config key (e.g. remote.origin.url) in the system,
+    // global and repo config, following include.path and includeIf. Runs
+    // git config for include conditions that can't be checked natively.
+    Result<QString> configValue(QString key, QString path = "");
+    // URL of the remote, with url.<base>.insteadOf rewrites applied. Runs
+    // git remote get-url when configValue() would run git config.
+    Result<QString> remoteUrl(QString remote, QString path = "");
+    // Files that configValue() reads for the repo (system, global, repo and
+    // included files, also those that don't exist), so that config changes
+    // can be noticed by their time stamps. Empty if configValue() would run
+    // git config.
+    QStringList configFiles(QString path = "");
+
+    // Config entries of a single file, without following includes. Keys are
+    // section.name or section.subsection.name, with section and name in
+    // lower case.
+    struct ConfigEntry {
+        QString key;
+        QString value;
+    };
+    static QList<ConfigEntry> parseConfigFile(QString filename);
+    // Sha of the ref in a packed-refs file. Empty if not found.
+    static QString readPackedRef(QString filename, QString ref);
+    // Whether the path matches the pattern of an includeIf gitdir: or
+    // onbranch: condition (wildmatch with ** and a trailing / meaning
+    // everything below).
+    static bool matchesIncludePattern(QString pattern, QString path,
+                                      bool caseInsensitive = false);
+
+    // Sha of a ref (e.g. refs/heads/master) on the remote, without fetching.
+    // Empty if the remote does not have the ref.
+    Result<QString> remoteRefSha(QString remote, QString ref, QString path = "");
+
     QString getGitCmd();
     void setGitCmd(QString c);
 
+    // Commands running longer than this are stopped and reported as timed out.
+    // Zero means no timeout.
+    static const int defaultTimeoutMsecs = 10 * 60 * 1000;
+    void setTimeout(int msecs);
+    int timeout();
+
+    // Commands running while the token is cancelled are stopped and reported
+    // as cancelled. Commands started after cancelling fail immediately.
+    void setCancelToken(CancelTokenPtr token);
+    CancelTokenPtr cancelToken();
+
+    // If set, commands are run with core.fsmonitor set to this hook command
+    // (hook protocol version 2), so Git only checks paths the hook reports as
+    // changed.
+    void setFsmonitorHook(QString command);
+    QString fsmonitorHook();
+
+    // Duration of each Git command run by this object, if recording
+    struct CommandTime {
+        // Git subcommand, e.g. "status"
+        QString name;
+        qint64 msecs = 0;
+    };
+    void setRecordCommandTimes(bool record);
+    QList<CommandTime> takeCommandTimes();
+
+    // If set, every Git command is written to the trace
+    void setTracer(TracerPtr tracer);
+
+    // If set, Git uses this command to run ssh (GIT_SSH_COMMAND)
+    void setSshCommand(QString command);
+    QString sshCommand();
+
+    // If set, commands go through the backend, which may answer them instead
+    // of running them (see GitBackend). Used for recording and replaying.
+    void setBackend(GitBackendPtr backend);
+
     Output runGit(QString arguments, QString path = "");
+    // Run the command with input written to its stdin
+    Output runGitWithInput(QString arguments, QByteArray input, QString path = "");
+
 
 private:
     void init();
 
+    // Entries of all config files in order of precedence. complete is set to
+    // false if an include condition could not be checked.
+    // The files read, whether they exist or not, are added to files if set.
+    QList<ConfigEntry> readConfig(QString path, bool* complete,
+                                  QStringList* files = nullptr);
+    void readConfigFile(QString filename, QString path, int depth,
+                        QList<ConfigEntry>* entries, bool* complete,
+                        QStringList* files);
+    static Output nativeOutput(QString command, QString error = "");
+    // Lets the backend answer the native read, or passes the result of read
+    // on to it. The result is the stdout of the backend's output.
+    Result<QString> nativeRead(QString path, QString command,
+                               std::function<Result<QString>()> read);
+    // The native readers without the backend
+    Result<bool> readPathIsRepo(QString path);
+    int readOngoingOperationState(QString path);
+    Result<QString> readCurrentBranch(QString path);
+    Result<QString> readRef(QString ref, QString path);
+    Result<QString> readConfigValue(QString key, QString path);
+    Result<QString> readRemoteUrl(QString remote, QString path);
+
     QString mPath;
     QString mGitCmd;
+    int mTimeoutMsecs = defaultTimeoutMsecs;
+    CancelTokenPtr mCancelToken;
+    QString mFsmonitorHook;
+    QString mSshCommand;
+    bool mRecordCommandTimes = false;
+    TracerPtr mTracer;
+    GitBackendPtr mBackend;
+    QList<CommandTime> mCommandTimes;
+    static QString subcommand(QString arguments);
 
-    QProcess mProcess;
-    Output run(QString path, QString cmd);
+    GitProcess mProcess;
+    Output run(QString path, QString cmd, QByteArray input = QByteArray());
+    Output runProcess(QString path, QString cmd, QByteArray input);
 };
 
 #endif // GIT_H
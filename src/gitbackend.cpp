@@ -0,0 +1,234 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "gitbackend.h"
+
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMutexLocker>
+#include <QThread>
+
+void GitRecording::append(Entry entry)
+{
+    QMutexLocker locker(&mMutex);
+    if (!mIndex.contains(entry.path)) {
+        mPaths.append(entry.path);
+    }
+    mIndex[entry.path][entry.cmd].append(mEntries.count());
+    mEntries.append(entry);
+}
+
+int GitRecording::count()
+{
+    QMutexLocker locker(&mMutex);
+    return mEntries.count();
+}
+
+QStringList GitRecording::paths()
+{
+    QMutexLocker locker(&mMutex);
+    return mPaths;
+}
+
+QString GitRecording::nextPath()
+{
+    QMutexLocker locker(&mMutex);
+    if (mPaths.isEmpty()) { return QString(); }
+
+    QString path = mPaths.at(mNextPath % mPaths.count());
+    mNextPath = (mNextPath + 1) % mPaths.count();
+    return path;
+}
+
+QList<GitRecording::Entry> GitRecording::entries()
+{
+    QMutexLocker locker(&mMutex);
+    return mEntries;
+}
+
+QList<GitRecording::Entry> GitRecording::entries(QString path, QString cmd)
+{
+    QMutexLocker locker(&mMutex);
+    QList<Entry> ret;
+    foreach (int i, mIndex.value(path).value(cmd)) {
+        ret.append(mEntries.at(i));
+    }
+    return ret;
+}
+
+GidFile::Result GitRecording::save(QString filename)
+{
+    QMutexLocker locker(&mMutex);
+
+    QByteArray data;
+    foreach (const Entry& e, mEntries) {
+        QJsonObject j;
+        j.insert("path", e.path);
+        j.insert("cmd", e.cmd);
+        j.insert("input", QString(e.input.toBase64()));
+        j.insert("stdout", QString(e.output.stdoutput.toBase64()));
+        j.insert("stderr", QString(e.output.erroroutput.toBase64()));
+        j.insert("exitcode", e.output.exitcode);
+        j.insert("hasError", e.output.hasError);
+        j.insert("timedOut", e.output.timedOut);
+        j.insert("msecs", e.output.durationMsecs);
+        data.append(QJsonDocument(j).toJson(QJsonDocument::Compact));
+        data.append('\n');
+    }
+    return GidFile::write(filename, data);
+}
+
+GidFile::Result GitRecording::load(QString filename)
+{
+    GidFile::ReadResult r = GidFile::read(filename);
+    if (!r.result.success) { return r.result; }
+
+    QList<Entry> entries;
+    int lineNumber = 0;
+    foreach (QByteArray line, r.data.split('\n')) {
+        lineNumber++;
+        if (line.trimmed().isEmpty()) { continue; }
+
+        QJsonParseError error;
+        QJsonObject j = QJsonDocument::fromJson(line, &error).object();
+        if (error.error != QJsonParseError::NoError) {
+            GidFile::Result ret;
+            ret.success = false;
+            ret.errorString = QString("Line %1: %2")
+                                  .arg(lineNumber).arg(error.errorString());
+            return ret;
+        }
+        Entry e;
+        e.path = j.value("path").toString();
+        e.cmd = j.value("cmd").toString();
+        e.input = QByteArray::fromBase64(j.value("input").toString().toUtf8());
+        e.output.command = e.cmd;
+        e.output.stdoutput = QByteArray::fromBase64(
+                    j.value("stdout").toString().toUtf8());
+        e.output.erroroutput = QByteArray::fromBase64(
+                    j.value("stderr").toString().toUtf8());
+        e.output.exitcode = j.value("exitcode").toInt(-1);
+        e.output.hasError = j.value("hasError").toBool();
+        e.output.timedOut = j.value("timedOut").toBool();
+        e.output.durationMsecs = qint64(j.value("msecs").toDouble());
+        entries.append(e);
+    }
+
+    foreach (const Entry& e, entries) {
+        append(e);
+    }
+    return r.result;
+}
+
+// -----------------------------------------------------------------------------
+
+RecordingGitBackend::RecordingGitBackend(GitRecordingPtr recording)
+    : mRecording(recording)
+{
+}
+
+bool RecordingGitBackend::run(QString /*path*/, QString /*cmd*/,
+                              QByteArray /*input*/,
+                              Git::CancelTokenPtr /*cancelToken*/,
+                              int /*timeoutMsecs*/, Git::Output* /*out*/)
+{
+    return false;
+}
+
+void RecordingGitBackend::ran(QString path, QString cmd, QByteArray input,
+                              const Git::Output& out)
+{
+    // Cancelled commands say nothing about how Git behaves
+    if (out.cancelled) { return; }
+
+    GitRecording::Entry e;
+    e.path = path;
+    e.cmd = cmd;
+    e.input = input;
+    e.output = out;
+    mRecording->append(e);
+}
+
+// -----------------------------------------------------------------------------
+
+ReplayGitBackend::ReplayGitBackend(GitRecordingPtr recording,
+                                   double latencyScale)
+    : mRecording(recording)
+    , mLatencyScale(qMax(0.0, latencyScale))
+    , mPath(recording->nextPath())
+{
+}
+
+bool ReplayGitBackend::run(QString /*path*/, QString cmd, QByteArray /*input*/,
+                           Git::CancelTokenPtr cancelToken, int timeoutMsecs,
+                           Git::Output* out)
+{
+    QList<GitRecording::Entry> entries = mRecording->entries(mPath, cmd);
+    if (entries.isEmpty()) {
+        out->command = cmd;
+        out->hasError = true;
+        out->erroroutput = "Not in recording: " + cmd.toUtf8();
+        return true;
+    }
+
+    int position = 0;
+    {
+        QMutexLocker locker(&mMutex);
+        position = qMin(mPositions.value(cmd), entries.count() - 1);
+        mPositions.insert(cmd, position + 1);
+    }
+
+    *out = entries.at(position).output;
+    qint64 durationMsecs = qRound64(out->durationMsecs * mLatencyScale);
+    out->durationMsecs = durationMsecs;
+
+    // Wait in short steps so the timeout and cancel token can be checked,
+    // like Git does for processes
+    const qint64 stepMsecs = 100;
+    QElapsedTimer timer;
+    timer.start();
+    forever {
+        qint64 remaining = durationMsecs - timer.elapsed();
+        if (remaining <= 0) { break; }
+        if (cancelToken && cancelToken->isCancelled()) {
+            out->cancelled = true;
+            break;
+        }
+        if ((timeoutMsecs > 0) && (timer.elapsed() > timeoutMsecs)) {
+            out->timedOut = true;
+            break;
+        }
+        QThread::msleep(qMin(remaining, stepMsecs));
+    }
+
+    if (out->cancelled || out->timedOut) {
+        out->durationMsecs = timer.elapsed();
+        out->exitcode = -1;
+        out->hasError = true;
+    }
+    return true;
+}
+
+void ReplayGitBackend::ran(QString /*path*/, QString /*cmd*/,
+                           QByteArray /*input*/, const Git::Output& /*out*/)
+{
+    // Never runs commands
+}
@@ -0,0 +1,152 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* GitBackend
+ *
+ * Lets the Git commands of a Git object be recorded or replayed instead of
+ * run, for deterministic performance tests of SyncEngine without subprocesses
+ * (see the bench directory).
+ *
+ * RecordingGitBackend lets the commands run as usual and stores each command
+ * line with its repo path, output and duration in a GitRecording.
+ * ReplayGitBackend answers the commands from a recording without starting any
+ * process, after waiting the recorded duration times a scale factor (zero for
+ * no waiting). The wait ends early, like a process would, when the cancel
+ * token is triggered or the timeout has passed.
+ *
+ * The native reads of Git (repo check, branch, refs, config, ongoing
+ * operations) go through the backend too, as "(native) <command>" with the
+ * result as stdout. So a replay sees the refs and config the recorded repo had at the time and
+ * makes the same decisions, without the repo on disk.
+ *
+ * Each replay backend answers from one recorded repo, taking the recorded
+ * repos in turn, so a recording of a few repos can stand in for many. Within
+ * that repo commands are matched by their command line. If a command was
+ * recorded several times, the recordings are returned in order and then the
+ * last one is repeated. Each backend keeps its own position, so use one per
+ * Git object (e.g. per refresh job) and share the recording.
+ */
+
+#ifndef GITBACKEND_H
+#define GITBACKEND_H
+
+#include "gidfile.h"
+#include "git.h"
+
+#include <QHash>
+#include <QMutex>
+
+class GitBackend
+{
+public:
+    virtual ~GitBackend() {}
+
+    // Return true with out set to answer the command instead of running it.
+    // The cancel token (may be null) and timeout (zero for none) are those of
+    // the Git object.
+    virtual bool run(QString path, QString cmd, QByteArray input,
+                     Git::CancelTokenPtr cancelToken, int timeoutMsecs,
+                     Git::Output* out) = 0;
+    // Called after a command has run as a process
+    virtual void ran(QString path, QString cmd, QByteArray input,
+                     const Git::Output& out) = 0;
+};
+
+// -----------------------------------------------------------------------------
+
+class GitRecording
+{
+public:
+    struct Entry
+    {
+        // Repo the command ran in
+        QString path;
+        QString cmd;
+        QByteArray input;
+        Git::Output output;
+    };
+
+    void append(Entry entry);
+    int count();
+    // Recorded repos, in order of their first command
+    QStringList paths();
+    // The recorded repos in turn, starting over after the last one
+    QString nextPath();
+    // All recorded entries, in order
+    QList<Entry> entries();
+    // Recorded entries of the command line in the repo, in order
+    QList<Entry> entries(QString path, QString cmd);
+
+    // One JSON object per line, outputs base64 encoded
+    GidFile::Result save(QString filename);
+    GidFile::Result load(QString filename);
+
+private:
+    QMutex mMutex;
+    QList<Entry> mEntries;
+    QStringList mPaths;
+    int mNextPath = 0;
+    // Entry indexes per path and command line
+    QHash<QString, QHash<QString, QList<int>>> mIndex;
+};
+typedef QSharedPointer<GitRecording> GitRecordingPtr;
+
+// -----------------------------------------------------------------------------
+
+class RecordingGitBackend : public GitBackend
+{
+public:
+    explicit RecordingGitBackend(GitRecordingPtr recording);
+
+    bool run(QString path, QString cmd, QByteArray input,
+             Git::CancelTokenPtr cancelToken, int timeoutMsecs,
+             Git::Output* out) override;
+    void ran(QString path, QString cmd, QByteArray input,
+             const Git::Output& out) override;
+
+private:
+    GitRecordingPtr mRecording;
+};
+
+// -----------------------------------------------------------------------------
+
+class ReplayGitBackend : public GitBackend
+{
+public:
+    explicit ReplayGitBackend(GitRecordingPtr recording,
+                              double latencyScale = 1.0);
+
+    bool run(QString path, QString cmd, QByteArray input,
+             Git::CancelTokenPtr cancelToken, int timeoutMsecs,
+             Git::Output* out) override;
+    void ran(QString path, QString cmd, QByteArray input,
+             const Git::Output& out) override;
+
+private:
+    GitRecordingPtr mRecording;
+    double mLatencyScale;
+    // Recorded repo this backend answers from
+    QString mPath;
+    QMutex mMutex;
+    // Next entry to return per command line
+    QHash<QString, int> mPositions;
+};
+
+#endif // GITBACKEND_H
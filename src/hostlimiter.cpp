@@ -0,0 +1,121 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "hostlimiter.h"
+
+#include <QUrl>
+
+#include <math.h>
+
+HostLimiter::HostLimiter()
+{
+    mClock.start();
+}
+
+void HostLimiter::setMaxConcurrent(int count)
+{
+    mMaxConcurrent = qMax(0, count);
+}
+
+void HostLimiter::setRate(double perMinute, int burst)
+{
+    mPerMinute = qMax(0.0, perMinute);
+    mBurst = qMax(1, burst);
+}
+
+QString HostLimiter::hostOfUrl(QString url)
+{
+    if (url.contains("://")) {
+        // file:// URLs have no host
+        return QUrl(url).host().toLower();
+    }
+
+    // scp-like syntax: [user@]host:path. A colon after the first slash is
+    // part of a local path.
+    int colon = url.indexOf(':');
+    int slash = url.indexOf('/');
+    if ((colon <= 0) || ((slash >= 0) && (slash < colon))) {
+        return QString();
+    }
+#ifdef Q_OS_WIN
+    // Drive letter, e.g. C:/repo
+    if (colon == 1) { return QString(); }
+#endif
+    QString host = url.left(colon);
+    host = host.mid(host.lastIndexOf('@') + 1);
+    return host.toLower();
+}
+
+qint64 HostLimiter::tryAcquire(QString name)
+{
+    if (name.isEmpty()) { return 0; }
+
+    Host& h = host(name);
+    if ((mMaxConcurrent > 0) && (h.running >= mMaxConcurrent)) {
+        return -1;
+    }
+
+    if (mPerMinute > 0) {
+        refill(h);
+        if (h.tokens < 1) {
+            double msecsPerToken = 60000.0 / mPerMinute;
+            return qMax(qint64(1), qint64(ceil((1 - h.tokens) * msecsPerToken)));
+        }
+        h.tokens -= 1;
+    }
+
+    h.running++;
+    return 0;
+}
+
+void HostLimiter::acquireUnlimited(QString name)
+{
+    if (name.isEmpty()) { return; }
+    host(name).running++;
+}
+
+void HostLimiter::release(QString name)
+{
+    if (name.isEmpty()) { return; }
+
+    Host& h = host(name);
+    h.running = qMax(0, h.running - 1);
+}
+
+HostLimiter::Host& HostLimiter::host(QString name)
+{
+    auto it = mHosts.find(name);
+    if (it == mHosts.end()) {
+        Host h;
+        // Start with a full bucket
+        h.tokens = mBurst;
+        h.lastRefillMsecs = mClock.elapsed();
+        it = mHosts.insert(name, h);
+    }
+    return it.value();
+}
+
+void HostLimiter::refill(Host& h)
+{
+    qint64 now = mClock.elapsed();
+    double added = (now - h.lastRefillMsecs) * mPerMinute / 60000.0;
+    h.tokens = qMin(double(mBurst), h.tokens + added);
+    h.lastRefillMsecs = now;
+}
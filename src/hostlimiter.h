@@ -0,0 +1,81 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* HostLimiter
+ *
+ * Limits how hard the refreshes hit each remote host: at most a number of
+ * refreshes per host at the same time, and a token bucket limiting the rate
+ * at which refreshes of a host are started. Hosts are independent, so a busy
+ * host does not hold back refreshes of other hosts.
+ *
+ * Repos without a known host (e.g. a local remote) are not limited.
+ *
+ * Not thread safe. SyncEngine uses it under its own mutex.
+ */
+
+#ifndef HOSTLIMITER_H
+#define HOSTLIMITER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QString>
+
+class HostLimiter
+{
+public:
+    HostLimiter();
+
+    // Zero means no limit
+    void setMaxConcurrent(int count);
+    // Refreshes started per minute on average, with bursts of up to burst
+    // refreshes. A rate of zero means no limit.
+    void setRate(double perMinute, int burst);
+
+    // Host name of a remote URL, e.g. "example.com" for both
+    // "https://example.com/repo.git" and "git@example.com:repo.git". Empty
+    // for local paths.
+    static QString hostOfUrl(QString url);
+
+    // Returns 0 and takes a slot and a token if a refresh of the host may
+    // start now. Otherwise returns the msecs until a token is available, or
+    // -1 if it has to wait for a running refresh of the host to finish.
+    qint64 tryAcquire(QString host);
+    // Take a slot without checking the limits
+    void acquireUnlimited(QString host);
+    void release(QString host);
+
+private:
+    struct Host {
+        int running = 0;
+        double tokens = 0;
+        qint64 lastRefillMsecs = 0;
+    };
+
+    int mMaxConcurrent = 0;
+    double mPerMinute = 0;
+    int mBurst = 1;
+    QHash<QString, Host> mHosts;
+    QElapsedTimer mClock;
+
+    Host& host(QString name);
+    void refill(Host& h);
+};
+
+#endif // HOSTLIMITER_H
@@ -0,0 +1,115 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "latencyhistogram.h"
+
+#include <QtAlgorithms>
+#include <QtMath>
+
+void LatencyHistogram::add(qint64 msecs)
+{
+    msecs = qMax(qint64(0), msecs);
+    int index = bucketIndex(msecs);
+    if (index >= mBuckets.count()) {
+        mBuckets.resize(index + 1);
+    }
+    mBuckets[index]++;
+    mCount++;
+    mMax = qMax(mMax, msecs);
+}
+
+void LatencyHistogram::clear()
+{
+    mBuckets.clear();
+    mCount = 0;
+    mMax = 0;
+}
+
+qint64 LatencyHistogram::count() const
+{
+    return mCount;
+}
+
+qint64 LatencyHistogram::max() const
+{
+    return mMax;
+}
+
+qint64 LatencyHistogram::percentile(double p) const
+{
+    if (mCount == 0) { return 0; }
+
+    qint64 rank = qCeil(qBound(0.0, p, 100.0) / 100.0 * mCount);
+    rank = qMax(qint64(1), rank);
+    qint64 seen = 0;
+    for (int i = 0; i < mBuckets.count(); i++) {
+        seen += mBuckets.at(i);
+        if (seen >= rank) {
+            return qMin(bucketUpperBound(i), mMax);
+        }
+    }
+    return mMax;
+}
+
+int LatencyHistogram::bucketIndex(qint64 msecs)
+{
+    if (msecs < linearBuckets) { return int(msecs); }
+
+    // Position of the highest bit, at least 4 here
+    int exp = 63 - qCountLeadingZeroBits(quint64(msecs));
+    int sub = (msecs >> (exp - subBucketBits)) & ((1 << subBucketBits) - 1);
+    return linearBuckets + ((exp - 4) << subBucketBits) + sub;
+}
+
+qint64 LatencyHistogram::bucketUpperBound(int index)
+{
+    if (index < linearBuckets) { return index; }
+
+    int exp = 4 + ((index - linearBuckets) >> subBucketBits);
+    int sub = (index - linearBuckets) & ((1 << subBucketBits) - 1);
+    qint64 width = qint64(1) << (exp - subBucketBits);
+    qint64 lower = qint64((1 << subBucketBits) + sub) << (exp - subBucketBits);
+    return lower + width - 1;
+}
+
+void LatencyStats::add(QString repoPath, QString key, qint64 msecs)
+{
+    mStats[repoPath][key].add(msecs);
+}
+
+void LatencyStats::removeRepo(QString repoPath)
+{
+    mStats.remove(repoPath);
+}
+
+void LatencyStats::clear()
+{
+    mStats.clear();
+}
+
+QList<QString> LatencyStats::repoPaths() const
+{
+    return mStats.keys();
+}
+
+QMap<QString, LatencyHistogram> LatencyStats::histograms(QString repoPath) const
+{
+    return mStats.value(repoPath);
+}
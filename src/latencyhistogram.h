@@ -0,0 +1,78 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* LatencyHistogram
+ *
+ * Histogram of durations in milliseconds with a fixed, small memory use,
+ * for percentiles of refresh stages and Git commands.
+ *
+ * Durations below 16 ms have a bucket each. Above that, every power of two
+ * is split into 8 buckets, so percentiles are within 12.5% of the actual
+ * value. Count and max are exact.
+ *
+ * LatencyStats keeps a histogram per repo and per stage or command.
+ */
+
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <QMap>
+#include <QString>
+#include <QVector>
+
+class LatencyHistogram
+{
+public:
+    void add(qint64 msecs);
+    void clear();
+
+    qint64 count() const;
+    qint64 max() const;
+    // Duration below which p percent of the durations fall, e.g. p = 95
+    qint64 percentile(double p) const;
+
+private:
+    QVector<quint32> mBuckets;
+    qint64 mCount = 0;
+    qint64 mMax = 0;
+
+    static const int linearBuckets = 16;
+    static const int subBucketBits = 3;
+    static int bucketIndex(qint64 msecs);
+    static qint64 bucketUpperBound(int index);
+};
+
+class LatencyStats
+{
+public:
+    // Key is a stage or command name
+    void add(QString repoPath, QString key, qint64 msecs);
+    void removeRepo(QString repoPath);
+    void clear();
+
+    QList<QString> repoPaths() const;
+    // Histograms of the repo by key
+    QMap<QString, LatencyHistogram> histograms(QString repoPath) const;
+
+private:
+    QMap<QString, QMap<QString, LatencyHistogram>> mStats;
+};
+
+#endif // LATENCYHISTOGRAM_H
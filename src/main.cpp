@@ -18,11 +18,15 @@
  *
  *****************************************************************************/
 
+#include "fsmonitor.h"
 #include "mainwindow.h"
+#include "synccommand.h"
+#include "syncdaemon.h"
 #include "version.h"
 
 #include <QApplication>
 #include <QCommandLineParser>
+#include <QScopedPointer>
 
 #include <iostream>
 
@@ -41,13 +45,37 @@ void printVersion()
     print("");
 }
 
+bool hasArg(int argc, char *argv[], QString arg)
+{
+    for (int i = 1; i < argc; i++) {
+        if (QString(argv[i]) == arg) { return true; }
+    }
+    return false;
+}
+
 int main(int argc, char *argv[])
 {
-    printVersion();
+    // Run as Git fsmonitor hook: gid-sync --fsmonitor-hook <version> <token>
+    // Git reads the reply from stdout, so nothing else may be printed.
+    if ((argc >= 2) && (QString(argv[1]) == "--fsmonitor-hook")) {
+        QCoreApplication a(argc, argv);
+        QStringList args = a.arguments();
+        return FsMonitor::runHook(args.value(2), args.value(3));
+    }
 
-    QApplication a(argc, argv);
-    QApplication::setApplicationName(APP_NAME);
-    QApplication::setApplicationVersion(APP_VERSION);
+    // Output of --sync may be parsed by scripts
+    bool sync = hasArg(argc, argv, "--sync");
+    if (!sync) {
+        printVersion();
+    }
+
+    // The daemon and --sync must not need a display, so no QApplication
+    bool daemon = hasArg(argc, argv, "--daemon");
+    QScopedPointer<QCoreApplication> a((daemon || sync)
+                                       ? new QCoreApplication(argc, argv)
+                                       : new QApplication(argc, argv));
+    QCoreApplication::setApplicationName(APP_NAME);
+    QCoreApplication::setApplicationVersion(APP_VERSION);
 
     QCommandLineParser parser;
     parser.addHelpOption();
@@ -55,14 +83,74 @@ int main(int argc, char *argv[])
     QCommandLineOption versionOption({"v", "version"}, "Display version information.");
     parser.addOption(versionOption);
 
-    parser.process(a);
+    QCommandLineOption daemonOption("daemon",
+        "Run without GUI, refreshing the repos in the settings until stopped.");
+    parser.addOption(daemonOption);
+
+    QCommandLineOption logFileOption("log-file",
+        "Daemon: append log to <file> instead of stdout.", "file");
+    parser.addOption(logFileOption);
+
+    QCommandLineOption syncOption("sync",
+        "Refresh the specified repos (or --all) once and exit. Exit code is 0 "
+        "if all succeeded, 1 if any failed, 2 for invalid arguments and 3 if "
+        "all failures were network errors.");
+    parser.addOption(syncOption);
+
+    QCommandLineOption allOption("all", "Sync: all repos in the settings.");
+    parser.addOption(allOption);
+
+    QCommandLineOption jobsOption("jobs",
+        "Sync: refresh up to <n> repos at the same time.", "n");
+    parser.addOption(jobsOption);
+
+    QCommandLineOption jsonOption("json",
+        "Sync: print the result of each repo as a line of JSON.");
+    parser.addOption(jsonOption);
+
+    parser.addPositionalArgument("repos", "Sync: repo names or paths.",
+                                 "[repos...]");
+
+    parser.process(*a);
 
     if (parser.isSet(versionOption)) {
-        // Version was already printed at start
+        if (sync) {
+            printVersion();
+        }
         return 0;
     }
 
+    if (sync) {
+        SyncCommand::Args syncArgs;
+        syncArgs.repos = parser.positionalArguments();
+        syncArgs.all = parser.isSet(allOption);
+        syncArgs.json = parser.isSet(jsonOption);
+        if (parser.isSet(jobsOption)) {
+            bool ok = false;
+            syncArgs.jobs = parser.value(jobsOption).toInt(&ok);
+            if (!ok || (syncArgs.jobs < 1)) {
+                std::cerr << "Invalid number of jobs." << std::endl;
+                return SyncCommand::ExitUsage;
+            }
+        }
+        SyncCommand c(syncArgs);
+        if (!c.start()) {
+            return c.exitCode();
+        }
+        return a->exec();
+    }
+
+    if (daemon) {
+        SyncDaemon::Args daemonArgs;
+        daemonArgs.logFile = parser.value(logFileOption);
+        SyncDaemon d(daemonArgs);
+        if (!d.start()) {
+            return 1;
+        }
+        return a->exec();
+    }
+
     MainWindow::Args mwArgs;
     MainWindow w(mwArgs);
-    return a.exec();
+    return a->exec();
 }
@@ -27,14 +27,15 @@
 #include <QDesktopServices>
 #include <QFileDialog>
 #include <QFileInfo>
-#include <QHostInfo>
 #include <QInputDialog>
+#include <QHideEvent>
+#include <QJsonArray>
 #include <QMessageBox>
+#include <QShowEvent>
 #include <QTimer>
 
 void MainWindow::Repo::logError(QString summary, QString errorString)
 {
-    ok = false;
     statusSummary = summary;
     statusLines.append(summary);
     if (!errorString.isEmpty()) {
@@ -51,6 +52,7 @@ MainWindow::MainWindow(Args args, QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
     , mArgs(args)
+    , mController(&mSettings)
 {
     ui->setupUi(this);
 
@@ -75,20 +77,37 @@ MainWindow::MainWindow(Args args, QWidget *parent)
     }
     ui->label_settingsPath->setText("Settings path: " + mSettings.settingsFilePath());
 
-    // Load repos from settings
-    foreach (Settings::RepoPtr repoSettings, mSettings.repos) {
-        initRepo(repoSettings);
+    connect(&mController, &RepoController::message, this, &MainWindow::print);
+    connect(&mController, &RepoController::repoAdded,
+            this, &MainWindow::onRepoAdded);
+    connect(&mController, &RepoController::repoStateChanged,
+            this, &MainWindow::onRepoStateChanged);
+    connect(&mController, &RepoController::syncEvent,
+            this, &MainWindow::onSyncEvent);
+
+    connect(&mControl, &ControlServer::message, this, &MainWindow::print);
+    mControl.setRequestHandler([=](QJsonObject request)
+    {
+        return onControlRequest(request);
+    });
+    if (mSettings.controlSocket) {
+        mControl.listen();
     }
 
+    mSettings.maxParallelRefreshes = qMax(1, mSettings.maxParallelRefreshes);
+    ui->label_settings_maxParallel->setText(
+                QString::number(mSettings.maxParallelRefreshes));
+
     // Set default client name if missing
     if (mSettings.ourName.isEmpty()) {
-        mSettings.ourName = QString("%1/%2").arg(getHostname(), getUsername());
+        mSettings.ourName = Settings::defaultOurName();
     }
     ui->label_settings_ourName->setText(mSettings.ourName);
 
-    setupTrayIcon();
+    // Load repos from settings
+    mController.start();
 
-    guiTimer.start(1000, this);
+    setupTrayIcon();
 }
 
 MainWindow::~MainWindow()
@@ -127,17 +146,10 @@ void MainWindow::closeEvent(QCloseEvent* event)
     }
 }
 
-void MainWindow::initRepo(Settings::RepoPtr repoSettings)
+void MainWindow::onRepoAdded(Settings::RepoPtr repoSettings)
 {
     RepoPtr repo(new Repo());
     repo->settings = repoSettings;
-    connect(&(repo->timer), &QTimer::timeout, this, [=]()
-    {
-        refreshRepo(repo);
-    });
-    repo->timer.setSingleShot(true);
-    repo->timer.setInterval(repoSettings->refreshRateMinutes * 60 * 1000);
-
     repos.append(repo);
 
     // Setup tray menus
@@ -149,7 +161,8 @@ void MainWindow::initRepo(Settings::RepoPtr repoSettings)
 
     repo->refreshAction = repo->submenu.addAction(QIcon("://refresh"),
                                                    "Refresh",
-                            this, [=](){ refreshRepo(repo); });
+                    this, [=](){ mController.refresh(repo->settings,
+                                                     RefreshScheduler::Manual); });
 
     repo->pauseAction = repo->submenu.addAction(QIcon("://pause"),
                                                  "Pause",
@@ -159,6 +172,21 @@ void MainWindow::initRepo(Settings::RepoPtr repoSettings)
                                                     "Open Folder",
                             this, [=](){ onRepoOpenPathActionTriggered(repo); });
 
+    // Show the state found by the previous run until the repo is refreshed
+    RepoCache::Entry cache = mController.cacheEntry(repoSettings);
+    if (cache.isValid()) {
+        repo->statusSummary = cache.lastSummary;
+        repo->branch = cache.branch;
+        repo->remote = cache.remote;
+        repo->remoteUrl = cache.remoteUrl;
+        repo->lastRefreshMsecs = cache.lastDurationMsecs;
+        repo->log("Last refreshed: "
+                  + cache.lastRefresh.toString("yyyy-MM-dd hh:mm:ss"));
+        if (!cache.lastSummary.isEmpty()) {
+            repo->log(cache.lastSummary);
+        }
+    }
+
     // Add to GUI list
     QListWidgetItem* item = new QListWidgetItem();
     item->setText(repo->settings->name);
@@ -168,482 +196,215 @@ void MainWindow::initRepo(Settings::RepoPtr repoSettings)
     // Select item in list
     ui->listWidget_repos->setCurrentItem(item);
 
-    refreshRepo(repo);
+    updateRepoGui(repo);
 }
 
-void MainWindow::startRepoTimer(RepoPtr repo)
+RepoController::RepoPtr MainWindow::repoState(RepoPtr repo)
 {
-    int msec = repo->settings->refreshRateMinutes * 60 * 1000;
-
-    // Interval of zero means never refresh
-    if (msec > 0) {
-        repo->timer.start(msec);
-    }
+    return mController.repo(repo->settings);
 }
 
-void MainWindow::refreshRepo(RepoPtr repo)
+bool MainWindow::isRepoTimerActive(RepoPtr repo)
 {
-    bool contains = false;
-    foreach (RefreshJobPtr job, refreshJobs) {
-        if (job->repo == repo) {
-            contains = true;
-            break;
-        }
-    }
-
-    if (!contains) {
-        RefreshJobPtr job(new RefreshJob());
-        job->repo = repo;
-        repo->refreshing = true;
-        refreshJobs.append(job);
-        if (!refreshBusy) {
-            processRefreshJobs();
-        }
-        updateRepoGui(repo);
-        updateTrayIcon();
-    }
+    RepoController::RepoPtr state = repoState(repo);
+    return state && mController.isTimerActive(state);
 }
 
-void MainWindow::processRefreshJobs()
+MainWindow::RepoPtr MainWindow::repoForSettings(Settings::RepoPtr repoSettings)
 {
-    if (refreshJobs.isEmpty()) {
-        refreshBusy = false;
-        return;
-    }
-
-    refreshBusy = true;
-    RefreshJobPtr job = refreshJobs.value(0);
-
-    switch (job->state) {
-    case 0:
-        refresh_init(job);
-        break;
-    case 1:
-        refresh_ongoingOps(job);
-        break;
-    case 2:
-        refresh_branchRemoteInfo(job);
-        break;
-    case 3:
-        refresh_commit(job);
-        break;
-    case 4:
-        refresh_fetch(job);
-        break;
-    case 5:
-        refresh_compare(job);
-        break;
-    case 6:
-        refresh_compareAfterRebase(job);
-        break;
-    case 7:
-        refresh_pushAfterRebase(job);
-        break;
+    foreach (RepoPtr repo, repos) {
+        if (repo->settings == repoSettings) {
+            return repo;
+        }
     }
+    return RepoPtr();
 }
 
-void MainWindow::popRefreshJob()
+MainWindow::RepoPtr MainWindow::repoForPath(QString path)
 {
-    if (!refreshJobs.isEmpty()) {
-        refreshJobs.removeFirst();
+    foreach (RepoPtr repo, repos) {
+        if (repo->settings->path == path) {
+            return repo;
+        }
     }
+    return RepoPtr();
 }
 
-void MainWindow::refresh_successNext(RefreshJobPtr job)
+void MainWindow::onRepoStateChanged(Settings::RepoPtr repoSettings)
 {
-    RepoPtr repo = job->repo;
-
-    repo->refreshing = false;
-
-    startRepoTimer(repo);
+    RepoPtr repo = repoForSettings(repoSettings);
+    if (!repo) { return; }
 
     updateRepoGui(repo);
     updateTrayIcon();
-
-    popRefreshJob();
-    refresh_continue();
 }
 
-void MainWindow::refresh_errorNext(RefreshJobPtr job)
+void MainWindow::onSyncEvent(SyncEngine::Event event)
 {
-    RepoPtr repo = job->repo;
-
-    repo->refreshing = false;
+    RepoPtr repo = repoForSettings(event.repo);
+    if (!repo) { return; }
 
-    // Tray popup message
-    if (!this->isVisible()) {
-        mTrayIcon.showMessage(repo->settings->path,
-                              repo->statusSummary);
+    switch (event.type) {
+    case SyncEngine::Event::Started:
+        onRefreshStarted(repo);
+        break;
+    case SyncEngine::Event::Log:
+        repo->log(event.text);
+        break;
+    case SyncEngine::Event::Error:
+        repo->logError(event.text, event.detail);
+        break;
+    case SyncEngine::Event::BranchInfo:
+        repo->branch = event.branch;
+        repo->remote = event.remote;
+        repo->remoteUrl = event.remoteUrl;
+        break;
+    case SyncEngine::Event::Finished:
+        onRefreshFinished(repo, event);
+        return;
+    case SyncEngine::Event::WakeUp:
+        break;
     }
 
     updateRepoGui(repo);
-    updateTrayIcon();
-
-    popRefreshJob();
-    refresh_continue();
-}
-
-void MainWindow::refresh_nextState(RefreshJobPtr job)
-{
-    job->state++;
-    updateRepoGui(job->repo);
-    refresh_continue();
-}
-
-void MainWindow::refresh_continue()
-{
-    threadWorker.doInGuiThread([=](){ processRefreshJobs(); });
 }
 
-void MainWindow::refresh_init(RefreshJobPtr job)
+void MainWindow::onRefreshStarted(RepoPtr repo)
 {
-    RepoPtr repo = job->repo;
-
-    repo->timer.stop();
-
     repo->statusLines.clear();
     repo->statusSummary.clear();
 
-    repo->log(QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss"));
-
-    if (repo->settings->path.isEmpty()) {
-        repo->logError("Path empty");
-        refresh_errorNext(job);
-        return;
-    }
-
-    Git git(repo->settings->path);
-    if (!git.pathIsRepo().result) {
-        repo->logError("Path is not a Git repo.");
-        refresh_errorNext(job);
-        return;
-    }
-
-    refresh_nextState(job);
-}
-
-void MainWindow::refresh_ongoingOps(RefreshJobPtr job)
-{
-    RepoPtr repo = job->repo;
-
-    Git git(repo->settings->path);
-    int ongoingOp = git.getOngoingOperationState();
-    if (ongoingOp != Git::OpNone) {
-        QStringList ops;
-        if (ongoingOp & Git::OpRebase) { ops.append("rebase"); }
-        if (ongoingOp & Git::OpMerge) { ops.append("merge"); }
-        if (ongoingOp & Git::OpCherryPick) { ops.append("cherry-pick"); }
-        if (ongoingOp & Git::OpBisect) { ops.append("bisect"); }
-        if (ops.isEmpty()) { ops.append("unknown"); }
-
-        repo->logError(QString("Unsafe to sync, operation ongoing: %1.")
-                           .arg(ops.join(", ")));
-        refresh_errorNext(job);
-        return;
-    }
-
-    refresh_nextState(job);
+    updateRepoGui(repo);
 }
 
-void MainWindow::refresh_branchRemoteInfo(RefreshJobPtr job)
+void MainWindow::onRefreshFinished(RepoPtr repo, SyncEngine::Event event)
 {
-    RepoPtr repo = job->repo;
-
-    // Get current branch name
-    Git git(repo->settings->path);
-    Git::Result<QString> s = git.currentBranch();
-    if (!s.gitOutput.hasError) {
-        repo->log("Detected current branch: " + s.result);
-        job->branch = s.result;
-    } else {
-        repo->logError("Could not detect current branch. Possibly detached head.",
-                       s.gitOutput.toString());
-        refresh_errorNext(job);
-        return;
-    }
-    repo->branch = job->branch;
+    repo->lastRefreshMsecs = event.durationMsecs;
+    print(QString("Refresh of %1 took %2 ms")
+              .arg(repo->settings->name).arg(event.durationMsecs));
+    addLatencies(repo, event);
 
-    // TODO: Could detect remote to use here
-    job->remote = "origin";
-    repo->remote = job->remote;
+    RepoController::RepoPtr state = repoState(repo);
+    if (!event.ok) {
+        if (state->retrying) {
+            repo->log(QString("Network error. Retry %1 in %2 secs.")
+                          .arg(state->retryCount)
+                          .arg(mController.remainingTime(state) / 1000));
+        }
 
-    // Get remote URL
-    Git::Output out = git.runGit("remote get-url " + job->remote);
-    if (!out.hasError) {
-        repo->remoteUrl = QString(out.stdoutput).trimmed();
-    } else {
-        repo->logError(QString("Could not get URL for remote: %1. Check if remote exists.")
-                           .arg(job->remote));
-        refresh_errorNext(job);
-        return;
+        // Tray popup message, only once for a series of retries
+        if (!this->isVisible() && (state->retryCount <= 1)) {
+            mTrayIcon.showMessage(repo->settings->path,
+                                  repo->statusSummary);
+        }
     }
 
-    refresh_nextState(job);
+    updateRepoGui(repo);
+    updateTrayIcon();
 }
 
-void MainWindow::refresh_commit(RefreshJobPtr job)
+QJsonObject MainWindow::onControlRequest(QJsonObject request)
 {
-    RepoPtr repo = job->repo;
-
-    Git git(repo->settings->path);
-    Git::Result<bool> b = git.isRepoModified();
-    if (b.gitOutput.hasError) {
-        repo->logError("Git error occurred while checking if repo is modified",
-                       b.gitOutput.toString());
-        refresh_errorNext(job);
-        return;
-    }
-    if (!b.result) {
-        repo->log("Repo has not been modified locally.");
-    } else {
-        repo->log("Repo has been modified locally.");
-
-        Git::Output out;
+    QString cmd = request.value("cmd").toString();
+    QJsonObject ret;
+    ret.insert("ok", true);
 
-        // Add all changes
-        out = git.runGit("add -A");
-        if (out.hasError) {
-            repo->logError("Git error occurred while adding all",
-                           out.toString());
-            refresh_errorNext(job);
-            return;
+    if (cmd == "list") {
+        QJsonArray list;
+        foreach (RepoPtr repo, repos) {
+            list.append(repoToJson(repo));
         }
+        ret.insert("repos", list);
+        return ret;
+    }
 
-        // Commit
-        repo->log("Committing local changes...");
-        QString ourName = mSettings.ourName;
-        ourName = ourName.replace("\"", "\\\"");
-        QString args = QString("commit -m \"Changes from %1\"").arg(ourName);
-        out = git.runGit(args);
-        if (out.hasError) {
-            repo->logError("Git error occurred while committing",
-                           out.toString());
-            refresh_errorNext(job);
-            return;
+    RepoPtr repo;
+    if (request.contains("repo")) {
+        repo = repoForNameOrPath(request.value("repo").toString());
+        if (!repo) {
+            return ControlServer::errorReply("Unknown repo");
         }
+    } else if (cmd != "refresh") {
+        return ControlServer::errorReply("No repo specified");
+    }
 
-        // Confirm that repo is now unmodified
-        b = git.isRepoModified();
-        if (b.gitOutput.hasError) {
-            repo->logError("Git error occurred while checking if repo is modified:",
-                           b.gitOutput.toString());
-            refresh_errorNext(job);
-            return;
-        }
-        if (b.result) {
-            repo->logError("Repo is still unclean after commit.");
-            refresh_errorNext(job);
-            return;
+    if (cmd == "status") {
+        ret.insert("repo", repoToJson(repo));
+    } else if (cmd == "refresh") {
+        if (repo) {
+            mController.refresh(repo->settings, RefreshScheduler::Manual);
         } else {
-            repo->log("Repo clean after commit.");
+            mController.refreshAll();
         }
+    } else if (cmd == "pause") {
+        mController.pause(repo->settings);
+    } else if (cmd == "resume") {
+        mController.resume(repo->settings);
+    } else {
+        return ControlServer::errorReply("Unknown command: " + cmd);
     }
-
-    refresh_nextState(job);
-}
-
-void MainWindow::refresh_fetch(RefreshJobPtr job)
-{
-    RepoPtr repo = job->repo;
-
-    repo->log("Fetching...");
-    updateRepoGui(repo);
-
-    QString path = repo->settings->path; // For use in worker thread
-    threadWorker.doInWorkerThread([=]()
-    {
-        // Fetch
-        QString args = QString("fetch %1 %2").arg(job->remote, job->branch);
-        Git git(path);
-        Git::Output out = git.runGit(args);
-        threadWorker.doInGuiThread([=]()
-        {
-            if (out.hasError) {
-                repo->logError("Git error occurred while fetching.",
-                               out.toString());
-                refresh_errorNext(job);
-                return;
-            }
-            refresh_nextState(job);
-        });
-    });
+    return ret;
 }
 
-void MainWindow::refresh_compare(RefreshJobPtr job)
+MainWindow::RepoPtr MainWindow::repoForNameOrPath(QString nameOrPath)
 {
-    RepoPtr repo = job->repo;
-
-    Git git(repo->settings->path);
-    Git::Result<Git::Compare> c = git.compareWithHead(QString("%1/%2")
-                                            .arg(job->remote, job->branch));
-    if (c.gitOutput.hasError) {
-        repo->logError("Git error while comparing:",
-                       c.gitOutput.toString());
-        refresh_errorNext(job);
-        return;
-    }
-
-    if (c.result == Git::Compare::NoUpstream) {
-
-        repo->logError("No relation between remote and HEAD. Aborting.");
-        refresh_errorNext(job);
-        return;
-
-    } else if (c.result == Git::Compare::Equal) {
-
-        repo->log("In sync! Done.");
-        repo->ok = true;
-        refresh_successNext(job);
-        return;
-
-    } else if (c.result == Git::Compare::Ahead) {
-
-        refresh_ahead(job);
-
-    } else if (c.result == Git::Compare::Behind) {
-
-        refresh_behind(job);
-
-    } else if (c.result == Git::Compare::Diverged) {
-
-        refresh_diverged(job);
+    RepoPtr repo = repoForPath(nameOrPath);
+    if (repo) { return repo; }
 
+    foreach (RepoPtr r, repos) {
+        if (r->settings->name == nameOrPath) {
+            return r;
+        }
     }
+    return RepoPtr();
 }
 
-void MainWindow::refresh_ahead(RefreshJobPtr job)
+QJsonObject MainWindow::repoToJson(RepoPtr repo)
 {
-    RepoPtr repo = job->repo;
-
-    repo->log("Ahead of remote. Pushing changes...");
-    updateRepoGui(repo);
-
-    QString path = repo->settings->path; // For use in worker thread
-    threadWorker.doInWorkerThread([=]()
-    {
-        Git git(path);
-        Git::Output out = git.runGit(QString("push %1 %2:%2")
-                                              .arg(job->remote, job->branch));
-        threadWorker.doInGuiThread([=]()
-        {
-            if (out.hasError) {
-                repo->logError("Git error while pushing:",
-                               out.toString());
-                refresh_errorNext(job);
-                return;
-            }
-            repo->log("Pushed successfully. In sync! Done.");
-            repo->ok = true;
-            refresh_successNext(job);
-        });
-    });
-}
-
-void MainWindow::refresh_behind(RefreshJobPtr job)
-{
-    RepoPtr repo = job->repo;
-
-    repo->log("Behind remote. Fast-forwarding...");
-    updateRepoGui(repo);
-
-    QString path = repo->settings->path; // For use in worker thread
-    threadWorker.doInWorkerThread([=]()
-    {
-        Git git(path);
-        Git::Output out = git.runGit(QString("merge --ff --ff-only %1/%2")
-                                              .arg(job->remote, job->branch));
-        threadWorker.doInGuiThread([=]()
-        {
-            if (out.hasError) {
-                repo->logError("Git error while merging:",
-                               out.toString());
-                refresh_errorNext(job);
-                return;
-            }
-            repo->log("Merged successfully. In sync! Done.");
-            repo->ok = true;
-            refresh_successNext(job);
-        });
-    });
+    RepoController::RepoPtr state = repoState(repo);
+    QJsonObject j;
+    j.insert("name", repo->settings->name);
+    j.insert("path", repo->settings->path);
+    j.insert("status", repoStatusText(repo));
+    j.insert("ok", state->ok);
+    j.insert("refreshing", state->refreshing);
+    j.insert("retrying", state->retrying);
+    j.insert("retryCount", state->retryCount);
+    j.insert("summary", repo->statusSummary.trimmed());
+    j.insert("branch", repo->branch);
+    j.insert("remote", repo->remote);
+    j.insert("remoteUrl", repo->remoteUrl);
+    j.insert("lastRefreshMsecs", repo->lastRefreshMsecs);
+    j.insert("nextRefreshMsecs", mController.remainingTime(state));
+    return j;
 }
 
-void MainWindow::refresh_diverged(RefreshJobPtr job)
+void MainWindow::publishRepoStatus(RepoPtr repo, QString statusText)
 {
-    RepoPtr repo = job->repo;
+    // Only on changes, not for every log line
+    QString status = statusText + "\n" + repo->statusSummary;
+    if (status == repo->publishedStatus) { return; }
+    repo->publishedStatus = status;
 
-    repo->log("Diverged from remote. Rebasing...");
-    updateRepoGui(repo);
-
-    QString path = repo->settings->path; // For use in worker thread
-    threadWorker.doInWorkerThread([=]()
-    {
-        Git git(path);
-        Git::Output out = git.runGit(QString("rebase %1/%2")
-                                              .arg(job->remote, job->branch));
-        threadWorker.doInGuiThread([=]()
-        {
-            if (out.hasError) {
-                repo->logError("Git error while rebasing.",
-                               out.toString());
-                repo->log("Rebasing failed. There are likely conflicting changes."
-                          " Resolve them and finish the rebase before trying again.");
-                refresh_errorNext(job);
-                return;
-            }
-            refresh_nextState(job);
-        });
-    });
+    QJsonObject event;
+    event.insert("event", "status");
+    event.insert("repo", repoToJson(repo));
+    mControl.publish(event);
 }
 
-void MainWindow::refresh_compareAfterRebase(RefreshJobPtr job)
+QString MainWindow::repoStatusText(RepoPtr repo)
 {
-    RepoPtr repo = job->repo;
-
-    // Compare again and confirm we are ahead
-    Git git(repo->settings->path);
-    Git::Result<Git::Compare> c = git.compareWithHead(QString("%1/%2")
-                                            .arg(job->remote, job->branch));
-    if (c.gitOutput.hasError) {
-        repo->logError("Git error while comparing:",
-                       c.gitOutput.toString());
-        refresh_errorNext(job);
-        return;
-    }
-    if (c.result != Git::Compare::Ahead) {
-        repo->logError("We are not ahead."
-                       " Something may have gone wrong with the rebase.");
-        refresh_errorNext(job);
-        return;
+    RepoController::RepoPtr state = repoState(repo);
+    QString name = mController.stateName(state);
+    if (name == "refreshing") {
+        return "Refreshing";
+    } else if (name == "error") {
+        return state->retrying ? "Error, retrying" : "Error";
+    } else if (name == "ok") {
+        return "OK";
+    } else {
+        return "Paused";
     }
-    refresh_nextState(job);
-}
-
-void MainWindow::refresh_pushAfterRebase(RefreshJobPtr job)
-{
-    RepoPtr repo = job->repo;
-
-    repo->log("We are ahead. Rebase went fine. Pushing...");
-    updateRepoGui(repo);
-
-    QString path = repo->settings->path; // For use in worker thread
-    threadWorker.doInWorkerThread([=]()
-    {
-        Git git(path);
-        Git::Output out = git.runGit(QString("push %1 %2:%2")
-                                              .arg(job->remote, job->branch));
-        threadWorker.doInGuiThread([=]()
-        {
-            if (out.hasError) {
-                repo->logError("Git error while pushing:",
-                               out.toString());
-                refresh_errorNext(job);
-                return;
-            }
-            repo->log("Pushed successfully. In sync! Done.");
-            repo->ok = true;
-            refresh_successNext(job);
-        });
-    });
 }
 
 void MainWindow::updateRepoGui(RepoPtr repo)
@@ -653,21 +414,22 @@ void MainWindow::updateRepoGui(RepoPtr repo)
     static QIcon pausedIcon("://pause");
     static QIcon refreshingIcon("://refresh_repo");
 
+    RepoController::RepoPtr state = repoState(repo);
+    if (!state) { return; }
+
     QIcon icon;
-    QString statusText;
-    if (repo->refreshing) {
-        statusText = "Refreshing";
+    QString statusText = repoStatusText(repo);
+    QString stateName = mController.stateName(state);
+    if (stateName == "refreshing") {
         icon = refreshingIcon;
-    } else if (!repo->ok) {
-        statusText = "Error";
+    } else if (stateName == "error") {
         icon = errorIcon;
-    } else if (repo->timer.isActive()) {
-        statusText = "OK";
+    } else if (stateName == "ok") {
         icon = okIcon;
     } else {
-        statusText = "Paused";
         icon = pausedIcon;
     }
+    publishRepoStatus(repo, statusText);
 
     repo->submenu.setIcon(icon);
     repo->submenu.setTitle(QString("%1 - %2")
@@ -675,7 +437,7 @@ void MainWindow::updateRepoGui(RepoPtr repo)
                             .arg(statusText));
     repo->statusAction->setText(QString("Status: %1")
                                 .arg(statusText));
-    repo->pauseAction->setEnabled(repo->timer.isActive());
+    repo->pauseAction->setEnabled(isRepoTimerActive(repo));
 
     // Update repo info area if selected in list widget
     QListWidgetItem* item = listItemRepoMap.key(repo);
@@ -691,7 +453,7 @@ void MainWindow::updateRepoGui(RepoPtr repo)
                       .arg(repo->statusSummary.trimmed().isEmpty() ? "" : ": ")
                       .arg(repo->statusSummary.trimmed()));
         ui->plainTextEdit_repoLog->setPlainText(repo->statusLines.join("\n"));
-        ui->pushButton_pause->setEnabled(repo->timer.isActive());
+        ui->pushButton_pause->setEnabled(isRepoTimerActive(repo));
         updateRepoRefreshTimeInGui(repo);
     }
     // Update list item name
@@ -715,17 +477,40 @@ void MainWindow::timerEvent(QTimerEvent* event)
     }
 }
 
+void MainWindow::showEvent(QShowEvent* event)
+{
+    QMainWindow::showEvent(event);
+
+    // Refresh times are only shown in the window, so no need to wake up every
+    // second while it is hidden.
+    guiTimer.start(1000, this);
+    RepoPtr repo = listItemRepoMap.value(ui->listWidget_repos->currentItem());
+    if (repo) {
+        updateRepoRefreshTimeInGui(repo);
+    }
+}
+
+void MainWindow::hideEvent(QHideEvent* event)
+{
+    QMainWindow::hideEvent(event);
+    guiTimer.stop();
+}
+
 void MainWindow::updateRepoRefreshTimeInGui(RepoPtr repo)
 {
+    RepoController::RepoPtr state = repoState(repo);
+    if (!state) { return; }
+
     QString text;
     if (repo->settings->refreshRateMinutes == 0) {
         text = "Auto-refresh disabled";
     } else {
-        if (repo->refreshing) {
+        if (state->refreshing) {
             text = "Refreshing";
-        } else if (repo->timer.isActive()) {
-            text = "Next refresh: ";
-            int secsRemaining = repo->timer.remainingTime() / 1000;
+        } else if (mController.isTimerActive(state)) {
+            text = state->retrying ? QString("Retry %1: ").arg(state->retryCount)
+                                   : QString("Next refresh: ");
+            int secsRemaining = mController.remainingTime(state) / 1000;
             if (secsRemaining < 60) {
                 text += QString("%1 secs").arg(secsRemaining);
             } else {
@@ -734,30 +519,71 @@ void MainWindow::updateRepoRefreshTimeInGui(RepoPtr repo)
         } else {
             text = "Auto-refresh paused";
         }
-        text = QString("%1 (Rate: every %2 mins)")
-                   .arg(text).arg(repo->settings->refreshRateMinutes);
+        Settings::RepoPtr s = repo->settings;
+        if (s->adaptiveRefresh) {
+            text = QString("%1 (Adaptive rate: every %2 mins, %3 to %4 mins)")
+                       .arg(text)
+                       .arg(mController.intervalMsecs(state) / 60000)
+                       .arg(s->minRefreshMinutes)
+                       .arg(s->maxRefreshMinutes);
+        } else {
+            text = QString("%1 (Rate: every %2 mins)")
+                       .arg(text).arg(s->refreshRateMinutes);
+        }
     }
     ui->label_repoRefreshTime->setText(text);
 }
 
-void MainWindow::print(QString msg)
+void MainWindow::addLatencies(RepoPtr repo, SyncEngine::Event event)
 {
-    qDebug() << msg;
+    QString path = repo->settings->path;
+    mLatencies.add(path, "refresh", event.durationMsecs);
+    foreach (SyncEngine::Event::Stage stage, event.stages) {
+        mLatencies.add(path, stage.state, stage.msecs);
+    }
+    foreach (SyncEngine::Event::Stage command, event.commands) {
+        mLatencies.add(path, command.state, command.msecs);
+    }
+
+    if (ui->stackedWidget->currentWidget() == ui->page_performance) {
+        updatePerformancePage();
+    }
 }
 
-QString MainWindow::getUsername()
+void MainWindow::updatePerformancePage()
 {
-    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
-#ifdef Q_OS_WIN
-    return env.value("USERNAME");
-#else
-    return env.value("USER");
-#endif
+    QTableWidget* table = ui->tableWidget_performance;
+    table->setSortingEnabled(false);
+    table->setRowCount(0);
+
+    foreach (RepoPtr repo, repos) {
+        QMap<QString, LatencyHistogram> histograms =
+                mLatencies.histograms(repo->settings->path);
+        foreach (QString key, histograms.keys()) {
+            const LatencyHistogram& h = histograms[key];
+            int row = table->rowCount();
+            table->insertRow(row);
+            table->setItem(row, 0, new QTableWidgetItem(repo->settings->name));
+            table->setItem(row, 1, new QTableWidgetItem(key));
+            QList<qint64> values {h.count(), h.percentile(50),
+                                  h.percentile(95), h.percentile(99), h.max()};
+            for (int i = 0; i < values.count(); i++) {
+                // Numbers as data so the columns sort numerically
+                QTableWidgetItem* item = new QTableWidgetItem();
+                item->setData(Qt::DisplayRole, values.at(i));
+                item->setTextAlignment(Qt::AlignRight | Qt::AlignVCenter);
+                table->setItem(row, 2 + i, item);
+            }
+        }
+    }
+
+    table->setSortingEnabled(true);
+    table->resizeColumnsToContents();
 }
 
-QString MainWindow::getHostname()
+void MainWindow::print(QString msg)
 {
-    return QHostInfo::localHostName();
+    qDebug() << msg;
 }
 
 void MainWindow::initTrayMenu()
@@ -810,7 +636,7 @@ void MainWindow::updateTrayIcon()
 
     mTrayIconTimer.stop();
 
-    foreach (RepoPtr repo, repos) {
+    foreach (RepoController::RepoPtr repo, mController.repos()) {
         if (repo->refreshing) { refreshing = true; }
         if (!repo->ok) { errors = true; }
     }
@@ -844,8 +670,7 @@ void MainWindow::onRepoStatusActionTriggered(RepoPtr repo)
 
 void MainWindow::onRepoPauseActionTriggered(RepoPtr repo)
 {
-    repo->timer.stop();
-    updateRepoGui(repo);
+    mController.pause(repo->settings);
 }
 
 void MainWindow::onRepoOpenPathActionTriggered(RepoPtr repo)
@@ -861,7 +686,7 @@ void MainWindow::on_pushButton_addRepo_clicked()
         r->name = QFileInfo(path).baseName();
         r->path = path;
         mSettings.repos.append(r);
-        initRepo(r);
+        mController.addRepo(r);
     }
 }
 
@@ -894,7 +719,7 @@ void MainWindow::on_pushButton_refresh_clicked()
     RepoPtr repo = listItemRepoMap.value(ui->listWidget_repos->currentItem());
     if (!repo) { return; }
 
-    refreshRepo(repo);
+    mController.refresh(repo->settings, RefreshScheduler::Manual);
 }
 
 void MainWindow::on_pushButton_pause_clicked()
@@ -907,9 +732,7 @@ void MainWindow::on_pushButton_pause_clicked()
 
 void MainWindow::on_action_Refresh_All_triggered()
 {
-    foreach (RepoPtr repo, repos) {
-        refreshRepo(repo);
-    }
+    mController.refreshAll();
 }
 
 void MainWindow::on_action_Quit_triggered()
@@ -937,6 +760,21 @@ void MainWindow::on_toolButton_ourName_edit_clicked()
 
     mSettings.ourName = name;
     ui->label_settings_ourName->setText(name);
+    mController.setOurName(name);
+}
+
+void MainWindow::on_toolButton_maxParallel_edit_clicked()
+{
+    bool ok = true;
+    int count = QInputDialog::getInt(this, "Parallel Refreshes",
+                                     "Maximum number of repos refreshed at the same time",
+                                     mSettings.maxParallelRefreshes,
+                                     1, 64, 1, &ok);
+    if (!ok) { return; }
+
+    mSettings.maxParallelRefreshes = count;
+    mController.setMaxParallel(count);
+    ui->label_settings_maxParallel->setText(QString::number(count));
 }
 
 void MainWindow::on_toolButton_editRepoName_clicked()
@@ -965,28 +803,42 @@ void MainWindow::on_toolButton_editRepoRefreshTime_clicked()
                                     0, 1000, 1, &ok);
     if (!ok) { return; }
 
-    if (mins != repo->settings->refreshRateMinutes) {
-
-        int lastInterval = repo->settings->refreshRateMinutes;
-        repo->settings->refreshRateMinutes = mins;
-
-        if (mins == 0) {
-            // Stop timer.
-            repo->timer.stop();
-        } else {
-            if (repo->timer.isActive()) {
-                // Restart the timer with the new interval if it is already active
-                startRepoTimer(repo);
-            } else {
-                // If the timer is not active, only restart it if the previous
-                // interval was zero (i.e. timer deactivated).
-                // Otherwise, timer is inactive due to error, and then we don't
-                // automatically restart the timer.
-                if (lastInterval == 0) {
-                    startRepoTimer(repo);
-                }
-            }
-        }
+    Settings::RepoPtr s = repo->settings;
+    bool adaptive = false;
+    int minMins = s->minRefreshMinutes;
+    int maxMins = s->maxRefreshMinutes;
+    if (mins > 0) {
+        QStringList modes {"Fixed rate", "Adaptive rate"};
+        QString mode = QInputDialog::getItem(this, "Repo Refresh Rate",
+                            "Adaptive rate refreshes more often while the"
+                            " repo changes, and less often while it doesn't.",
+                            modes, s->adaptiveRefresh ? 1 : 0, false, &ok);
+        if (!ok) { return; }
+        adaptive = (mode == modes.at(1));
+    }
+    if (adaptive) {
+        minMins = QInputDialog::getInt(this, "Repo Refresh Rate",
+                                       "Minimum minutes",
+                                       qMin(minMins, mins), 1, mins, 1, &ok);
+        if (!ok) { return; }
+        maxMins = QInputDialog::getInt(this, "Repo Refresh Rate",
+                                       "Maximum minutes",
+                                       qMax(maxMins, mins), mins, 10000, 1, &ok);
+        if (!ok) { return; }
+    }
+
+    bool changed = (mins != s->refreshRateMinutes)
+                   || (adaptive != s->adaptiveRefresh)
+                   || (adaptive && ((minMins != s->minRefreshMinutes)
+                                    || (maxMins != s->maxRefreshMinutes)));
+    if (changed) {
+
+        int lastInterval = s->refreshRateMinutes;
+        s->refreshRateMinutes = mins;
+        s->adaptiveRefresh = adaptive;
+        s->minRefreshMinutes = minMins;
+        s->maxRefreshMinutes = maxMins;
+        mController.refreshRateChanged(s, lastInterval);
 
     }
 
@@ -1004,8 +856,9 @@ void MainWindow::on_toolButton_removeRepo_clicked()
                         "Are you sure you want to remove the selected repo?");
     if (choice == QMessageBox::No) { return; }
 
-    repo->timer.stop();
+    mController.removeRepo(repo->settings);
     mSettings.repos.removeAll(repo->settings);
+    mLatencies.removeRepo(repo->settings->path);
     repos.removeAll(repo);
     listItemRepoMap.remove(item);
     delete item;
@@ -1024,6 +877,23 @@ void MainWindow::on_pushButton_settings_back_clicked()
     ui->stackedWidget->setCurrentWidget(ui->page_main);
 }
 
+void MainWindow::on_action_Performance_triggered()
+{
+    updatePerformancePage();
+    ui->stackedWidget->setCurrentWidget(ui->page_performance);
+}
+
+void MainWindow::on_pushButton_performance_back_clicked()
+{
+    ui->stackedWidget->setCurrentWidget(ui->page_main);
+}
+
+void MainWindow::on_pushButton_performance_reset_clicked()
+{
+    mLatencies.clear();
+    updatePerformancePage();
+}
+
 void MainWindow::on_action_About_triggered()
 {
     ui->stackedWidget->setCurrentWidget(ui->page_about);
@@ -21,9 +21,11 @@
 #ifndef MAINWINDOW_H
 #define MAINWINDOW_H
 
+#include "controlserver.h"
 #include "git.h"
+#include "latencyhistogram.h"
+#include "repocontroller.h"
 #include "settings.h"
-#include "ThreadWorker.h"
 
 #include <QListWidgetItem>
 #include <QMainWindow>
@@ -48,17 +50,19 @@ public:
 
     // -------------------------------------------------------------------------
 
+    // What is displayed of a repo. The refresh state is kept by the
+    // RepoController.
     struct Repo
     {
         Settings::RepoPtr settings;
-        QTimer timer;
-        bool ok = true;
-        bool refreshing = false;
         QString statusSummary;
         QStringList statusLines;
         QString branch;
         QString remote;
         QString remoteUrl;
+        qint64 lastRefreshMsecs = -1;
+        // Last status sent to control socket subscribers
+        QString publishedStatus;
 
         void logError(QString summary, QString errorString = "");
         void log(QString line);
@@ -80,6 +84,7 @@ private:
     Ui::MainWindow *ui;
     Args mArgs;
     Settings mSettings;
+    RepoController mController;
 
     void setupAboutPage();
 
@@ -89,56 +94,46 @@ private:
     QList<RepoPtr> repos;
     QMap<QListWidgetItem*, RepoPtr> listItemRepoMap;
 
-    void initRepo(Settings::RepoPtr repoSettings);
-    void startRepoTimer(RepoPtr repo);
+    void onRepoAdded(Settings::RepoPtr repoSettings);
+    // Refresh state of the repo
+    RepoController::RepoPtr repoState(RepoPtr repo);
+    bool isRepoTimerActive(RepoPtr repo);
 
     // -------------------------------------------------------------------------
 
-    struct RefreshJob {
-        RefreshJob() {}
-        RepoPtr repo;
-        int state = 0;
-        QString branch;
-        QString remote;
-    };
-    typedef QSharedPointer<RefreshJob> RefreshJobPtr;
-
-    QList<RefreshJobPtr> refreshJobs;
-    ThreadWorker threadWorker;
-
-    void refreshRepo(RepoPtr repo);
-    bool refreshBusy = false;
-    void processRefreshJobs();
-    void popRefreshJob();
-
-    void refresh_successNext(RefreshJobPtr job);
-    void refresh_errorNext(RefreshJobPtr job);
-    void refresh_nextState(RefreshJobPtr job);
-    void refresh_continue();
-
-    void refresh_init(RefreshJobPtr job);
-    void refresh_ongoingOps(RefreshJobPtr job);
-    void refresh_branchRemoteInfo(RefreshJobPtr job);
-    void refresh_commit(RefreshJobPtr job);
-    void refresh_fetch(RefreshJobPtr job);
-    void refresh_compare(RefreshJobPtr job);
-    void refresh_ahead(RefreshJobPtr job);
-    void refresh_behind(RefreshJobPtr job);
-    void refresh_diverged(RefreshJobPtr job);
-    void refresh_compareAfterRebase(RefreshJobPtr job);
-    void refresh_pushAfterRebase(RefreshJobPtr job);
+    ControlServer mControl;
+
+    RepoPtr repoForSettings(Settings::RepoPtr repoSettings);
+    RepoPtr repoForPath(QString path);
+    void onRepoStateChanged(Settings::RepoPtr repoSettings);
+    void onSyncEvent(SyncEngine::Event event);
+    void onRefreshStarted(RepoPtr repo);
+    void onRefreshFinished(RepoPtr repo, SyncEngine::Event event);
+
+    // -------------------------------------------------------------------------
+
+    QJsonObject onControlRequest(QJsonObject request);
+    RepoPtr repoForNameOrPath(QString nameOrPath);
+    QJsonObject repoToJson(RepoPtr repo);
+    void publishRepoStatus(RepoPtr repo, QString statusText);
 
     // -------------------------------------------------------------------------
 
     void updateRepoGui(RepoPtr repo);
+    QString repoStatusText(RepoPtr repo);
+    // Only runs while the window is shown
     QBasicTimer guiTimer;
     void timerEvent(QTimerEvent *event);
+    void showEvent(QShowEvent* event) override;
+    void hideEvent(QHideEvent* event) override;
     void updateRepoRefreshTimeInGui(RepoPtr repo);
 
-    void print(QString msg);
+    // Durations of refresh stages and Git commands per repo
+    LatencyStats mLatencies;
+    void addLatencies(RepoPtr repo, SyncEngine::Event event);
+    void updatePerformancePage();
 
-    QString getUsername();
-    QString getHostname();
+    void print(QString msg);
 
     // -------------------------------------------------------------------------
 
@@ -170,11 +165,15 @@ private slots:
     void on_action_Quit_triggered();
     void on_action_Show_Hide_triggered();
     void on_toolButton_ourName_edit_clicked();
+    void on_toolButton_maxParallel_edit_clicked();
     void on_toolButton_editRepoName_clicked();
     void on_toolButton_editRepoRefreshTime_clicked();
     void on_toolButton_removeRepo_clicked();
     void on_action_Settings_triggered();
     void on_pushButton_settings_back_clicked();
+    void on_action_Performance_triggered();
+    void on_pushButton_performance_back_clicked();
+    void on_pushButton_performance_reset_clicked();
     void on_action_About_triggered();
     void on_pushButton_about_back_clicked();
 };
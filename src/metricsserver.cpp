@@ -0,0 +1,126 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "metricsserver.h"
+
+#include <QFile>
+#include <QLocalSocket>
+#include <QTcpSocket>
+
+MetricsServer::MetricsServer(QObject *parent)
+    : QObject{parent}
+{
+    connect(&mTcpServer, &QTcpServer::newConnection, this, [=]()
+    {
+        while (QTcpSocket* socket = mTcpServer.nextPendingConnection()) {
+            connect(socket, &QTcpSocket::disconnected,
+                    socket, &QTcpSocket::deleteLater);
+            serve(socket, [=](){ socket->disconnectFromHost(); });
+        }
+    });
+    connect(&mLocalServer, &QLocalServer::newConnection, this, [=]()
+    {
+        while (QLocalSocket* socket = mLocalServer.nextPendingConnection()) {
+            connect(socket, &QLocalSocket::disconnected,
+                    socket, &QLocalSocket::deleteLater);
+            serve(socket, [=](){ socket->disconnectFromServer(); });
+        }
+    });
+}
+
+void MetricsServer::setTextCallback(TextCallback callback)
+{
+    mCallback = callback;
+}
+
+bool MetricsServer::listenTcp(quint16 port)
+{
+    if (mTcpServer.listen(QHostAddress::LocalHost, port)) { return true; }
+
+    emit message(QString("Failed to serve metrics on port %1: %2")
+                     .arg(port).arg(mTcpServer.errorString()));
+    return false;
+}
+
+bool MetricsServer::listenLocal(QString path)
+{
+    // A socket file left over from an earlier run would be in the way
+    if (QFile::exists(path)) {
+        QLocalSocket probe;
+        probe.connectToServer(path);
+        if (probe.waitForConnected(500)) {
+            emit message("Metrics socket is served by another instance.");
+            return false;
+        }
+        QLocalServer::removeServer(path);
+    }
+
+    mLocalServer.setSocketOptions(QLocalServer::UserAccessOption);
+    if (mLocalServer.listen(path)) { return true; }
+
+    emit message(QString("Failed to serve metrics on %1: %2")
+                     .arg(path).arg(mLocalServer.errorString()));
+    return false;
+}
+
+void MetricsServer::serve(QIODevice* socket, std::function<void()> close)
+{
+    // The request is complete at the empty line after the headers. The
+    // request data is kept in a property so nothing has to be cleaned up
+    // when the socket goes away.
+    connect(socket, &QIODevice::readyRead, this, [=]()
+    {
+        QByteArray request = socket->property("request").toByteArray()
+                             + socket->readAll();
+        if (request.contains("\r\n\r\n") || request.contains("\n\n")) {
+            socket->write(response(request));
+            close();
+        } else if (request.size() > maxRequestSize) {
+            close();
+        } else {
+            socket->setProperty("request", request);
+        }
+    });
+}
+
+QByteArray MetricsServer::response(QByteArray request)
+{
+    QList<QByteArray> requestLine = request.left(request.indexOf('\n'))
+                                           .trimmed().split(' ');
+    QByteArray method = requestLine.value(0);
+    QByteArray path = requestLine.value(1);
+
+    QByteArray status = "200 OK";
+    QByteArray body;
+    if (method != "GET") {
+        status = "405 Method Not Allowed";
+    } else if ((path != "/metrics") && (path != "/")) {
+        status = "404 Not Found";
+    } else if (mCallback) {
+        body = mCallback();
+    }
+
+    QByteArray ret = "HTTP/1.0 " + status + "\r\n";
+    ret += "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n";
+    ret += "Content-Length: " + QByteArray::number(body.size()) + "\r\n";
+    ret += "Connection: close\r\n\r\n";
+    ret += body;
+    return ret;
+}
@@ -0,0 +1,68 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* MetricsServer
+ *
+ * Serves metrics (see SyncMetrics) over HTTP for Prometheus and similar
+ * scrapers, on a TCP port on the loopback interface and/or on a Unix socket.
+ *
+ * Only GET /metrics (or /) is answered, with HTTP/1.0 and the connection is
+ * closed after each response. The text is produced by the callback, in the
+ * thread of this object, when a request comes in.
+ */
+
+#ifndef METRICSSERVER_H
+#define METRICSSERVER_H
+
+#include <QLocalServer>
+#include <QObject>
+#include <QTcpServer>
+
+#include <functional>
+
+class MetricsServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MetricsServer(QObject *parent = nullptr);
+
+    typedef std::function<QByteArray()> TextCallback;
+    void setTextCallback(TextCallback callback);
+
+    // Listen on 127.0.0.1
+    bool listenTcp(quint16 port);
+    // Listen on a Unix socket at the path
+    bool listenLocal(QString path);
+
+signals:
+    void message(QString msg);
+
+private:
+    TextCallback mCallback;
+    QTcpServer mTcpServer;
+    QLocalServer mLocalServer;
+
+    static const int maxRequestSize = 8 * 1024;
+
+    void serve(QIODevice* socket, std::function<void()> close);
+    QByteArray response(QByteArray request);
+};
+
+#endif // METRICSSERVER_H
@@ -0,0 +1,128 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "refreshplanner.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QRandomGenerator>
+#include <QtEndian>
+
+void RefreshPlanner::setOurName(QString name)
+{
+    mOurName = name;
+}
+
+void RefreshPlanner::setJitterPercent(int percent)
+{
+    mJitterPercent = qBound(0, percent, 50);
+}
+
+void RefreshPlanner::setPhaseSpreading(bool enable)
+{
+    mPhaseSpreading = enable;
+}
+
+void RefreshPlanner::setStartupRamp(int msecs)
+{
+    mStartupRampMsecs = qMax(0, msecs);
+}
+
+qint64 RefreshPlanner::nextRefreshDelay(qint64 intervalMsecs, QString remoteUrl)
+{
+    if (intervalMsecs <= 0) { return 0; }
+
+    qint64 delay = intervalMsecs;
+    if (mPhaseSpreading) {
+        // Next time the wall clock reaches our phase. Wall clock time is used
+        // so the phases of different clients relate to each other.
+        qint64 now = QDateTime::currentMSecsSinceEpoch();
+        qint64 offset = (now - phase(intervalMsecs, remoteUrl)) % intervalMsecs;
+        delay = intervalMsecs - offset;
+        // Don't refresh again too soon after e.g. a manual refresh
+        if (delay < intervalMsecs / 2) {
+            delay += intervalMsecs;
+        }
+    }
+
+    qint64 jitter = intervalMsecs * mJitterPercent / 100;
+    delay += randomBetween(-jitter, jitter);
+
+    return qMax(qint64(1000), delay);
+}
+
+qint64 RefreshPlanner::staggerDelay(int index, int count, int spreadMsecs)
+{
+    if ((count <= 1) || (spreadMsecs <= 0)) { return 0; }
+
+    // Evenly spaced, each randomly placed within its own step
+    qint64 step = spreadMsecs / count;
+    return index * step + randomBetween(0, step);
+}
+
+qint64 RefreshPlanner::startupDelay(int index, int count)
+{
+    return staggerDelay(index, count, mStartupRampMsecs);
+}
+
+qint64 RefreshPlanner::adaptedInterval(qint64 currentMsecs, bool changed,
+                                       qint64 minMsecs, qint64 maxMsecs)
+{
+    qint64 interval = changed ? minMsecs : currentMsecs * 2;
+    return qBound(minMsecs, interval, qMax(minMsecs, maxMsecs));
+}
+
+void RefreshPlanner::setRetryDelays(int baseMsecs, int maxMsecs)
+{
+    mRetryBaseMsecs = qMax(1000, baseMsecs);
+    mRetryMaxMsecs = qMax(mRetryBaseMsecs, maxMsecs);
+}
+
+qint64 RefreshPlanner::retryDelay(int attempt)
+{
+    qint64 delay = mRetryBaseMsecs;
+    for (int i = 1; (i < attempt) && (delay < mRetryMaxMsecs); i++) {
+        delay *= 2;
+    }
+    delay = qMin(delay, qint64(mRetryMaxMsecs));
+
+    // Jitter keeps clients that failed together from retrying together
+    return randomBetween(delay / 2, delay);
+}
+
+qint64 RefreshPlanner::phase(qint64 intervalMsecs, QString remoteUrl)
+{
+    if (intervalMsecs <= 0) { return 0; }
+
+    // Must be the same in every run and on every client, so qHash() (which is
+    // seeded per process) can't be used.
+    QByteArray hash = QCryptographicHash::hash(
+                (mOurName + "\n" + remoteUrl).toUtf8(),
+                QCryptographicHash::Sha1);
+    quint64 value = qFromBigEndian<quint64>(hash.constData());
+    return value % quint64(intervalMsecs);
+}
+
+qint64 RefreshPlanner::randomBetween(qint64 min, qint64 max)
+{
+    if (max <= min) { return min; }
+    quint64 range = quint64(max - min) + 1;
+    return min + qint64(QRandomGenerator::global()->generate64() % range);
+}
@@ -0,0 +1,90 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* RefreshPlanner
+ *
+ * Decides when repos are refreshed, so that refreshes are spread out over
+ * time instead of hitting the remote all at once.
+ *
+ * - Periodic refreshes are aligned to a phase within the refresh interval.
+ *   The phase is derived from our name and the remote URL, so clients sharing
+ *   a remote each get their own phase and stay spread out, also after all of
+ *   them were interrupted at the same time (e.g. by a network outage).
+ * - Random jitter of a percentage of the interval keeps timers from running in
+ *   lockstep.
+ * - Refreshes of many repos at once (startup, Refresh All) are staggered over
+ *   a ramp instead of all starting immediately.
+ * - Repos with adaptive refresh are refreshed often while they change and
+ *   less and less often while they don't.
+ * - Refreshes that failed due to a network problem are retried with capped
+ *   exponential backoff and jitter.
+ */
+
+#ifndef REFRESHPLANNER_H
+#define REFRESHPLANNER_H
+
+#include <QString>
+
+class RefreshPlanner
+{
+public:
+    void setOurName(QString name);
+    // Random jitter of up to plus or minus this percentage of the interval
+    void setJitterPercent(int percent);
+    // Enable aligning periodic refreshes to a per client phase. Off by
+    // default, as it moves a repo's first refresh to anywhere within the
+    // interval.
+    void setPhaseSpreading(bool enable);
+    // Time over which the startup refreshes are spread
+    void setStartupRamp(int msecs);
+
+    // Delay until the next periodic refresh
+    qint64 nextRefreshDelay(qint64 intervalMsecs, QString remoteUrl);
+
+    // Delay of refresh number index out of count, spread over spreadMsecs
+    qint64 staggerDelay(int index, int count, int spreadMsecs);
+    qint64 startupDelay(int index, int count);
+
+    // Interval following a refresh in adaptive mode. Drops to the minimum
+    // when changes were synced, otherwise doubles up to the maximum.
+    qint64 adaptedInterval(qint64 currentMsecs, bool changed,
+                           qint64 minMsecs, qint64 maxMsecs);
+
+    // Delay before retry number attempt (starting at 1) after a transient
+    // error. Doubles with each attempt up to the maximum, randomised between
+    // half and the full delay.
+    void setRetryDelays(int baseMsecs, int maxMsecs);
+    qint64 retryDelay(int attempt);
+
+    // Offset within the interval of this client's refreshes of the remote
+    qint64 phase(qint64 intervalMsecs, QString remoteUrl);
+
+private:
+    QString mOurName;
+    int mJitterPercent = 10;
+    bool mPhaseSpreading = false;
+    int mStartupRampMsecs = 60 * 1000;
+    int mRetryBaseMsecs = 30 * 1000;
+    int mRetryMaxMsecs = 30 * 60 * 1000;
+
+    qint64 randomBetween(qint64 min, qint64 max);
+};
+
+#endif // REFRESHPLANNER_H
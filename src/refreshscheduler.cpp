@@ -0,0 +1,138 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "refreshscheduler.h"
+
+bool RefreshScheduler::enqueue(Settings::RepoPtr repo, Priority priority)
+{
+    bool existing = mQueued.contains(repo);
+    if (existing && (mQueued.value(repo).priority <= priority)) {
+        return false;
+    }
+
+    // A previous item of the repo becomes stale
+    Queued queued;
+    queued.priority = priority;
+    queued.seq = ++mNextSeq;
+    mQueued.insert(repo, queued);
+
+    Item item;
+    item.repo = repo;
+    item.seq = queued.seq;
+    mQueues[priority].enqueue(item);
+
+    return !existing;
+}
+
+bool RefreshScheduler::contains(Settings::RepoPtr repo) const
+{
+    return mQueued.contains(repo);
+}
+
+bool RefreshScheduler::remove(Settings::RepoPtr repo)
+{
+    return mQueued.remove(repo) > 0;
+}
+
+void RefreshScheduler::clear()
+{
+    mQueued.clear();
+    for (int i = 0; i < PriorityCount; i++) {
+        mQueues[i].clear();
+        mSkipped[i] = 0;
+    }
+}
+
+bool RefreshScheduler::isEmpty() const
+{
+    return mQueued.isEmpty();
+}
+
+int RefreshScheduler::count() const
+{
+    return mQueued.count();
+}
+
+RefreshScheduler::Priority RefreshScheduler::nextPriority()
+{
+    return (Priority)pickClass();
+}
+
+Settings::RepoPtr RefreshScheduler::takeNext()
+{
+    int picked = pickClass();
+    if (picked < 0) { return Settings::RepoPtr(); }
+
+    Item item = mQueues[picked].dequeue();
+    mQueued.remove(item.repo);
+
+    mSkipped[picked] = 0;
+    for (int i = picked + 1; i < PriorityCount; i++) {
+        if (!mQueues[i].isEmpty()) {
+            mSkipped[i]++;
+        }
+    }
+
+    return item.repo;
+}
+
+bool RefreshScheduler::isCurrent(const Item& item) const
+{
+    auto it = mQueued.constFind(item.repo);
+    return (it != mQueued.constEnd()) && (it->seq == item.seq);
+}
+
+void RefreshScheduler::dropStale(int priority)
+{
+    QQueue<Item>& queue = mQueues[priority];
+    while (!queue.isEmpty() && !isCurrent(queue.head())) {
+        queue.dequeue();
+    }
+    if (queue.isEmpty()) {
+        mSkipped[priority] = 0;
+    }
+}
+
+int RefreshScheduler::pickClass()
+{
+    for (int i = 0; i < PriorityCount; i++) {
+        dropStale(i);
+    }
+
+    // Manual refreshes are never held back
+    if (!mQueues[Manual].isEmpty()) { return Manual; }
+
+    // Serve the class that has been passed over the most, if it is starving
+    int starving = -1;
+    for (int i = Manual + 1; i < PriorityCount; i++) {
+        if (mQueues[i].isEmpty() || (mSkipped[i] < starvationLimit)) {
+            continue;
+        }
+        if ((starving < 0) || (mSkipped[i] > mSkipped[starving])) {
+            starving = i;
+        }
+    }
+    if (starving >= 0) { return starving; }
+
+    for (int i = 0; i < PriorityCount; i++) {
+        if (!mQueues[i].isEmpty()) { return i; }
+    }
+    return -1;
+}
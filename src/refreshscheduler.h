@@ -0,0 +1,93 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* RefreshScheduler
+ *
+ * Queue of repos waiting to be refreshed, ordered by priority class.
+ *
+ * Repos are served in order of their class, first-in first-out within a
+ * class. Manual refreshes always go first. To keep the lower classes from
+ * starving while higher ones keep coming, a class is served next once it has
+ * been passed over starvationLimit times.
+ *
+ * A repo is queued at most once. Queuing a repo again with a higher priority
+ * moves it to that class. All operations are O(1) (amortised): items that were
+ * moved or removed are left in their queue and skipped when they reach the
+ * front.
+ *
+ * Not thread safe. SyncEngine uses it under its own mutex.
+ */
+
+#ifndef REFRESHSCHEDULER_H
+#define REFRESHSCHEDULER_H
+
+#include "settings.h"
+
+#include <QHash>
+#include <QQueue>
+
+class RefreshScheduler
+{
+public:
+    enum Priority {
+        Manual = 0, // Refresh of a single repo requested by the user
+        FileChange, // Files of the repo changed
+        Timer,      // Periodic refresh, Refresh All
+        Background, // Maintenance, e.g. catching up at startup
+        PriorityCount
+    };
+
+    // Returns false if the repo was already queued. It is then moved to the
+    // new priority if that is higher.
+    bool enqueue(Settings::RepoPtr repo, Priority priority);
+    bool contains(Settings::RepoPtr repo) const;
+    bool remove(Settings::RepoPtr repo);
+    void clear();
+    bool isEmpty() const;
+    int count() const;
+
+    // Priority class the next repo will be taken from. Only valid if not empty.
+    Priority nextPriority();
+    Settings::RepoPtr takeNext();
+
+private:
+    static const int starvationLimit = 8;
+
+    struct Item {
+        Settings::RepoPtr repo;
+        quint64 seq = 0;
+    };
+    struct Queued {
+        Priority priority = Timer;
+        quint64 seq = 0;
+    };
+
+    QHash<Settings::RepoPtr, Queued> mQueued;
+    QQueue<Item> mQueues[PriorityCount];
+    // Number of times each class was passed over while it had waiting repos
+    int mSkipped[PriorityCount] = {};
+    quint64 mNextSeq = 0;
+
+    bool isCurrent(const Item& item) const;
+    void dropStale(int priority);
+    int pickClass();
+};
+
+#endif // REFRESHSCHEDULER_H
@@ -0,0 +1,112 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "repocache.h"
+
+#include <QDir>
+#include <QJsonArray>
+#include <QJsonDocument>
+
+RepoCache::RepoCache(QString dir)
+    : mDir(dir)
+{
+}
+
+QString RepoCache::cacheFilePath()
+{
+    return QString("%1/%2").arg(mDir).arg("gid-sync-cache");
+}
+
+GidFile::Result RepoCache::save()
+{
+    QDir dir(mDir);
+    if (!dir.exists()) {
+        dir.mkpath(dir.path());
+    }
+
+    QJsonArray aRepos;
+    foreach (QString path, entries.keys()) {
+        QJsonObject j = entries.value(path).toJson();
+        j.insert("path", path);
+        aRepos.append(j);
+    }
+
+    QJsonObject jMain;
+    jMain.insert("repos", aRepos);
+
+    QJsonDocument jDoc;
+    jDoc.setObject(jMain);
+
+    return GidFile::write(cacheFilePath(), jDoc.toJson());
+}
+
+GidFile::Result RepoCache::load()
+{
+    GidFile::ReadResult r = GidFile::read(cacheFilePath());
+
+    if (r.result.success) {
+
+        QJsonDocument jDoc = QJsonDocument::fromJson(r.data);
+
+        QJsonArray aRepos = jDoc.object().value("repos").toArray();
+        foreach (QJsonValue v, aRepos) {
+            QJsonObject obj = v.toObject();
+            Entry entry;
+            entry.fromJson(obj);
+            entries.insert(obj.value("path").toString(), entry);
+        }
+
+    }
+
+    return r.result;
+}
+
+QJsonObject RepoCache::Entry::toJson() const
+{
+    QJsonObject j;
+    j.insert("lastRefresh", lastRefresh.toString(Qt::ISODateWithMs));
+    j.insert("lastOk", lastOk);
+    j.insert("lastSummary", lastSummary);
+    j.insert("lastDurationMsecs", lastDurationMsecs);
+    j.insert("intervalMsecs", intervalMsecs);
+    j.insert("branch", branch);
+    j.insert("remote", remote);
+    j.insert("remoteUrl", remoteUrl);
+    j.insert("headSha", headSha);
+    j.insert("indexMtimeMsecs", indexMtimeMsecs);
+    j.insert("indexSize", indexSize);
+    return j;
+}
+
+void RepoCache::Entry::fromJson(QJsonObject json)
+{
+    lastRefresh = QDateTime::fromString(json.value("lastRefresh").toString(),
+                                        Qt::ISODateWithMs);
+    lastOk = json.value("lastOk").toBool();
+    lastSummary = json.value("lastSummary").toString();
+    lastDurationMsecs = json.value("lastDurationMsecs").toVariant().toLongLong();
+    intervalMsecs = json.value("intervalMsecs").toVariant().toLongLong();
+    branch = json.value("branch").toString();
+    remote = json.value("remote").toString();
+    remoteUrl = json.value("remoteUrl").toString();
+    headSha = json.value("headSha").toString();
+    indexMtimeMsecs = json.value("indexMtimeMsecs").toVariant().toLongLong();
+    indexSize = json.value("indexSize").toVariant().toLongLong();
+}
@@ -0,0 +1,78 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* RepoCache
+ *
+ * State of each repo as found by its last refresh, saved next to the settings
+ * file. Used to show the repo state immediately at startup and to let a
+ * refresh skip work when nothing has changed since the last one.
+ */
+
+#ifndef REPOCACHE_H
+#define REPOCACHE_H
+
+#include "gidfile.h"
+
+#include <QDateTime>
+#include <QJsonObject>
+#include <QMap>
+#include <QString>
+
+class RepoCache
+{
+public:
+    explicit RepoCache(QString dir);
+
+    struct Entry
+    {
+        QDateTime lastRefresh;
+        bool lastOk = false;
+        QString lastSummary;
+        qint64 lastDurationMsecs = -1;
+        // Current interval of a repo with adaptive refresh, zero if not known
+        qint64 intervalMsecs = 0;
+
+        QString branch;
+        QString remote;
+        QString remoteUrl;
+
+        // Only valid after a successful refresh
+        QString headSha;
+        qint64 indexMtimeMsecs = 0;
+        qint64 indexSize = -1;
+
+        bool isValid() const { return lastRefresh.isValid(); }
+        QJsonObject toJson() const;
+        void fromJson(QJsonObject json);
+    };
+
+    // By repo path
+    QMap<QString, Entry> entries;
+
+    QString cacheFilePath();
+
+    GidFile::Result save();
+    GidFile::Result load();
+
+private:
+    QString mDir;
+};
+
+#endif // REPOCACHE_H
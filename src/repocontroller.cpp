@@ -0,0 +1,564 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "repocontroller.h"
+
+#include <QDateTime>
+#include <QSet>
+#include <QTimer>
+
+RepoController::RepoController(Settings* settings, QObject *parent)
+    : QObject(parent)
+    , mSettings(settings)
+    , mCache(settings->settingsDir())
+    , mFsMonitor(&mWatcher)
+{
+}
+
+RepoController::~RepoController()
+{
+    mCache.save();
+    if (mSettings->sshMultiplexing) {
+        mSshMux.closeAll();
+    }
+}
+
+void RepoController::start()
+{
+    GidFile::Result r = mCache.load();
+    if (!r.success) {
+        emit message("Failed to load repo cache: " + r.errorString);
+    }
+
+    // Events are reported from the engine's worker threads
+    mSyncEngine.setEventCallback([=](SyncEngine::Event event)
+    {
+        mThreadWorker.doInGuiThread([=](){ onSyncEvent(event); });
+    });
+
+    connect(&mRepoTimers, &TimerWheel::expired,
+            this, &RepoController::onRepoTimersExpired);
+
+    mWatcher.setQuietPeriod(mSettings->watchQuietMsecs);
+    mWatcher.setMaxDelay(mSettings->watchMaxDelayMsecs);
+    connect(&mWatcher, &RepoWatcher::repoChanged,
+            this, &RepoController::onRepoFilesChanged);
+    connect(&mWatcher, &RepoWatcher::message, this, &RepoController::message);
+
+    connect(&mFsMonitor, &FsMonitor::message, this, &RepoController::message);
+    if (mSettings->watchFilesystem && mSettings->fsmonitorHook
+            && mWatcher.isSupported() && mFsMonitor.listen()) {
+        mSyncEngine.setFsmonitorHook(FsMonitor::hookCommand());
+    }
+
+    mSyncEngine.setMaxParallel(qMax(1, mSettings->maxParallelRefreshes));
+    mSyncEngine.setNetworkTimeout(mSettings->networkTimeoutSecs * 1000);
+    mSyncEngine.setHostLimits(mSettings->maxRefreshesPerHost,
+                              mSettings->hostRefreshesPerMinute,
+                              mSettings->hostRefreshBurst);
+    if (mSettings->sshMultiplexing) {
+        mSshMux.setSshProgram(mSettings->sshProgram);
+        mSshMux.setPersistSecs(mSettings->sshControlPersistSecs);
+        mSyncEngine.setSshCommand(mSshMux.command());
+    }
+
+    connect(&mMetricsServer, &MetricsServer::message,
+            this, &RepoController::message);
+    mMetricsServer.setTextCallback([=]() { return metricsText(); });
+    if (mSettings->metricsPort > 0) {
+        mMetricsServer.listenTcp(mSettings->metricsPort);
+    }
+    if (!mSettings->metricsSocket.isEmpty()) {
+        mMetricsServer.listenLocal(mSettings->metricsSocket);
+    }
+
+    if (mSettings->traceEnabled) {
+        mTracer.reset(new Tracer(mSettings->settingsDir()));
+        mTracer->setMaxFileSize(qint64(mSettings->traceMaxFileSizeMB) * 1024 * 1024);
+        mTracer->setMaxFiles(mSettings->traceMaxFiles);
+        if (mTracer->open()) {
+            emit message("Writing trace to " + mTracer->filePath());
+            mSyncEngine.setTracer(mTracer);
+            connect(&mTraceFlushTimer, &QTimer::timeout, this, [=]()
+            {
+                mTracer->flush();
+            });
+            mTraceFlushTimer.start(1000);
+        } else {
+            emit message("Failed to open trace file " + mTracer->filePath());
+            mTracer.reset();
+        }
+    }
+
+    QString ourName = mSettings->ourName;
+    if (ourName.isEmpty()) {
+        ourName = Settings::defaultOurName();
+    }
+    mSyncEngine.setOurName(ourName);
+
+    mPlanner.setOurName(ourName);
+    mPlanner.setJitterPercent(mSettings->refreshJitterPercent);
+    mPlanner.setPhaseSpreading(mSettings->refreshPhaseSpreading);
+    mPlanner.setStartupRamp(mSettings->startupRampSecs * 1000);
+    mPlanner.setRetryDelays(mSettings->retryBaseSecs * 1000,
+                            mSettings->retryMaxSecs * 1000);
+
+    // Refreshes of repos that are due are spread over the startup ramp
+    int count = mSettings->repos.count();
+    for (int i = 0; i < count; i++) {
+        addRepo(mSettings->repos.at(i), mPlanner.startupDelay(i, count));
+    }
+}
+
+RepoController::RepoPtr RepoController::addRepo(Settings::RepoPtr repoSettings,
+                                                qint64 startupDelayMsecs)
+{
+    RepoPtr repo(new Repo());
+    repo->settings = repoSettings;
+    mRepos.append(repo);
+
+    if (mSettings->watchFilesystem) {
+        mWatcher.addRepo(repoSettings->path);
+    }
+
+    RepoCache::Entry cache = mCache.entries.value(repoSettings->path);
+    if (cache.isValid()) {
+        repo->ok = cache.lastOk;
+        repo->remoteUrl = cache.remoteUrl;
+        repo->intervalMsecs = cache.intervalMsecs;
+        if (cache.lastOk) {
+            mMetrics.setLastSuccess(repoSettings->path, cache.lastRefresh);
+        }
+    }
+    emit repoAdded(repoSettings);
+
+    // Only refresh now if the repo is due or had an error. Otherwise continue
+    // the previous run's timer.
+    qint64 msec = intervalMsecs(repo);
+    if (cache.isValid() && cache.lastOk && (msec > 0)) {
+        qint64 sinceLast = cache.lastRefresh.msecsTo(QDateTime::currentDateTime());
+        if ((sinceLast >= 0) && (sinceLast < msec)) {
+            mRepoTimers.start(repoSettings, msec - sinceLast);
+            emit repoStateChanged(repoSettings);
+            return repo;
+        }
+    }
+
+    if (startupDelayMsecs > 0) {
+        repo->startupRefresh = true;
+        mRepoTimers.start(repoSettings, startupDelayMsecs);
+        emit repoStateChanged(repoSettings);
+    } else {
+        refreshRepo(repo, RefreshScheduler::Background);
+    }
+    return repo;
+}
+
+void RepoController::removeRepo(Settings::RepoPtr repoSettings)
+{
+    RepoPtr r = repo(repoSettings);
+    if (!r) { return; }
+
+    mRepoTimers.stop(repoSettings);
+    mSyncEngine.cancel(repoSettings);
+    mCache.entries.remove(repoSettings->path);
+    mWatcher.removeRepo(repoSettings->path);
+    mMetrics.removeRepo(repoSettings->path);
+    mRepos.removeAll(r);
+}
+
+RepoController::RepoPtr RepoController::repo(Settings::RepoPtr repoSettings)
+{
+    foreach (RepoPtr repo, mRepos) {
+        if (repo->settings == repoSettings) {
+            return repo;
+        }
+    }
+    return RepoPtr();
+}
+
+QList<RepoController::RepoPtr> RepoController::repos()
+{
+    return mRepos;
+}
+
+RepoCache::Entry RepoController::cacheEntry(Settings::RepoPtr repoSettings)
+{
+    return mCache.entries.value(repoSettings->path);
+}
+
+void RepoController::refresh(Settings::RepoPtr repoSettings,
+                             RefreshScheduler::Priority priority)
+{
+    RepoPtr r = repo(repoSettings);
+    if (r) {
+        refreshRepo(r, priority);
+    }
+}
+
+void RepoController::refreshAll()
+{
+    // Bulk refresh, so single manual refreshes can still go first. Spread
+    // over a short time so the remotes are not hit all at once.
+    const int maxStepMsecs = 250;
+    int count = mRepos.count();
+    int spread = qMin(mSettings->startupRampSecs * 1000, count * maxStepMsecs);
+    for (int i = 0; i < count; i++) {
+        RepoPtr repo = mRepos.at(i);
+        qint64 delay = mPlanner.staggerDelay(i, count, spread);
+        if (delay < 1000) {
+            refreshRepo(repo, RefreshScheduler::Timer);
+        } else if (!repo->refreshing) {
+            mRepoTimers.start(repo->settings, delay);
+            emit repoStateChanged(repo->settings);
+        }
+    }
+}
+
+void RepoController::pause(Settings::RepoPtr repoSettings)
+{
+    RepoPtr r = repo(repoSettings);
+    if (!r) { return; }
+
+    mRepoTimers.stop(repoSettings);
+    r->retrying = false;
+    emit repoStateChanged(repoSettings);
+}
+
+void RepoController::resume(Settings::RepoPtr repoSettings)
+{
+    RepoPtr r = repo(repoSettings);
+    if (!r) { return; }
+
+    // A refreshing repo starts its timer when done
+    if (!r->refreshing && !isTimerActive(r)) {
+        r->retrying = false;
+        r->retryCount = 0;
+        startRepoTimer(r);
+        emit repoStateChanged(repoSettings);
+    }
+}
+
+void RepoController::refreshRateChanged(Settings::RepoPtr repoSettings,
+                                        int lastRateMinutes)
+{
+    RepoPtr r = repo(repoSettings);
+    if (!r) { return; }
+
+    // Start adapting from the new rate
+    r->intervalMsecs = 0;
+
+    if (repoSettings->refreshRateMinutes == 0) {
+        // Stop timer.
+        mRepoTimers.stop(repoSettings);
+    } else if (isTimerActive(r)) {
+        // Restart the timer with the new interval if it is already active
+        startRepoTimer(r);
+    } else if (lastRateMinutes == 0) {
+        // If the timer is not active, only restart it if the previous
+        // interval was zero (i.e. timer deactivated). Otherwise, timer is
+        // inactive due to error, and then we don't automatically restart
+        // the timer.
+        startRepoTimer(r);
+    }
+    emit repoStateChanged(repoSettings);
+}
+
+void RepoController::setOurName(QString name)
+{
+    mSyncEngine.setOurName(name);
+    mPlanner.setOurName(name);
+}
+
+void RepoController::setMaxParallel(int count)
+{
+    mSyncEngine.setMaxParallel(count);
+}
+
+QString RepoController::stateName(RepoPtr repo)
+{
+    if (repo->refreshing) {
+        return "refreshing";
+    } else if (!repo->ok) {
+        return "error";
+    } else if (isTimerActive(repo)) {
+        return "ok";
+    } else {
+        return "paused";
+    }
+}
+
+bool RepoController::isTimerActive(RepoPtr repo)
+{
+    return mRepoTimers.isActive(repo->settings);
+}
+
+qint64 RepoController::remainingTime(RepoPtr repo)
+{
+    return mRepoTimers.remainingTime(repo->settings);
+}
+
+qint64 RepoController::intervalMsecs(RepoPtr repo)
+{
+    Settings::RepoPtr s = repo->settings;
+    qint64 msec = qint64(s->refreshRateMinutes) * 60 * 1000;
+    if ((msec == 0) || !s->adaptiveRefresh) { return msec; }
+
+    if (repo->intervalMsecs > 0) {
+        msec = repo->intervalMsecs;
+    }
+    qint64 min = qint64(qMax(1, s->minRefreshMinutes)) * 60 * 1000;
+    qint64 max = qint64(qMax(1, s->maxRefreshMinutes)) * 60 * 1000;
+    return qBound(min, msec, qMax(min, max));
+}
+
+bool RepoController::isRefreshing()
+{
+    foreach (RepoPtr repo, mRepos) {
+        if (repo->refreshing) { return true; }
+    }
+    return false;
+}
+
+void RepoController::stop()
+{
+    mStopping = true;
+
+    // Refreshes still in the queue are dropped, running ones may finish
+    foreach (RepoPtr repo, mRepos) {
+        mRepoTimers.stop(repo->settings);
+        if (repo->refreshing && !repo->started) {
+            mSyncEngine.cancel(repo->settings);
+        }
+    }
+}
+
+void RepoController::cancelAll()
+{
+    mSyncEngine.cancelAll();
+}
+
+void RepoController::saveCache()
+{
+    mCache.save();
+}
+
+TracerPtr RepoController::tracer()
+{
+    return mTracer;
+}
+
+QByteArray RepoController::metricsText()
+{
+    QMap<QString, QString> names;
+    QMap<QString, int> states {{"ok", 0}, {"error", 0}, {"refreshing", 0},
+                               {"paused", 0}};
+    foreach (RepoPtr repo, mRepos) {
+        names.insert(repo->settings->path, repo->settings->name);
+        states[stateName(repo)]++;
+    }
+    return mMetrics.exposition(names, states, mSyncEngine.queuedCount(),
+                               mSyncEngine.runningCount());
+}
+
+void RepoController::startRepoTimer(RepoPtr repo)
+{
+    qint64 msec = intervalMsecs(repo);
+
+    // Interval of zero means never refresh
+    if (msec > 0) {
+        QString remoteUrl = repo->remoteUrl.isEmpty() ? repo->settings->path
+                                                      : repo->remoteUrl;
+        mRepoTimers.start(repo->settings,
+                          mPlanner.nextRefreshDelay(msec, remoteUrl));
+    }
+}
+
+void RepoController::onRepoTimersExpired(QList<Settings::RepoPtr> repoSettings)
+{
+    QSet<Settings::RepoPtr> due;
+    foreach (Settings::RepoPtr r, repoSettings) {
+        due.insert(r);
+    }
+    foreach (RepoPtr repo, mRepos) {
+        if (due.contains(repo->settings)) {
+            RefreshScheduler::Priority priority = repo->startupRefresh
+                                                  ? RefreshScheduler::Background
+                                                  : RefreshScheduler::Timer;
+            repo->startupRefresh = false;
+            refreshRepo(repo, priority);
+        }
+    }
+}
+
+RepoController::RepoPtr RepoController::repoForPath(QString path)
+{
+    foreach (RepoPtr repo, mRepos) {
+        if (repo->settings->path == path) {
+            return repo;
+        }
+    }
+    return RepoPtr();
+}
+
+void RepoController::onRepoFilesChanged(QString path)
+{
+    RepoPtr repo = repoForPath(path);
+    if (!repo) { return; }
+
+    if (!repo->refreshing && isTimerActive(repo)) {
+        refreshRepo(repo, RefreshScheduler::FileChange);
+    }
+    // Otherwise auto-refresh is paused or stopped due to an error. Changes
+    // while refreshing are reported once done, see refreshRepo().
+}
+
+void RepoController::refreshRepo(RepoPtr repo, RefreshScheduler::Priority priority)
+{
+    if (mStopping) { return; }
+
+    if (repo->refreshing) {
+        // Only raise the priority of the queued refresh. Don't touch the
+        // watcher's changed flag, as the refresh may already be running.
+        SyncEngine::Request request;
+        request.repo = repo->settings;
+        request.priority = priority;
+        mSyncEngine.refresh(request);
+        return;
+    }
+
+    QString path = repo->settings->path;
+    SyncEngine::Request request;
+    request.repo = repo->settings;
+    request.priority = priority;
+    request.cache = mCache.entries.value(path);
+    if (request.cache.remoteUrl.isEmpty()) {
+        request.cache.remoteUrl = repo->remoteUrl;
+    }
+    request.worktreeUnchanged = mWatcher.isWatching(path)
+                                && !mWatcher.takeWorktreeChanged(path);
+    request.fsmonitor = mWatcher.isWatching(path) && mFsMonitor.isListening();
+    if (mSyncEngine.refresh(request)) {
+        repo->refreshing = true;
+        // The refresh sees changes made before it runs. Commits made by the
+        // refresh itself must not trigger another one. Work tree changes
+        // while it runs are reported once it has finished.
+        mWatcher.setSuppressed(path, true);
+        emit repoStateChanged(repo->settings);
+    }
+}
+
+void RepoController::onSyncEvent(SyncEngine::Event event)
+{
+    if (event.type == SyncEngine::Event::WakeUp) {
+        QTimer::singleShot(event.durationMsecs, this, [=]()
+        {
+            mSyncEngine.wakeUp();
+        });
+        return;
+    }
+
+    RepoPtr r = repo(event.repo);
+    if (!r) {
+        // Repo has been removed in the meantime
+        return;
+    }
+
+    // Shows how long the event loop is busy with events
+    qint64 traceStart = mTracer ? mTracer->nowUsecs() : 0;
+    handleSyncEvent(r, event);
+    emit syncEvent(event);
+    if (mTracer) {
+        QJsonObject args;
+        args.insert("type", int(event.type));
+        mTracer->complete("sync event", "gui", traceStart, args);
+    }
+}
+
+void RepoController::handleSyncEvent(RepoPtr repo, SyncEngine::Event event)
+{
+    switch (event.type) {
+    case SyncEngine::Event::Started:
+        repo->started = true;
+        mRepoTimers.stop(repo->settings);
+        // The refresh sees the work tree changes made until now
+        mWatcher.setSuppressed(repo->settings->path, true);
+        break;
+    case SyncEngine::Event::Error:
+        repo->ok = false;
+        break;
+    case SyncEngine::Event::BranchInfo:
+        repo->remoteUrl = event.remoteUrl;
+        break;
+    case SyncEngine::Event::Finished:
+        onRefreshFinished(repo, event);
+        break;
+    case SyncEngine::Event::Log:
+    case SyncEngine::Event::WakeUp:
+        break;
+    }
+}
+
+void RepoController::onRefreshFinished(RepoPtr repo, SyncEngine::Event event)
+{
+    repo->refreshing = false;
+    repo->started = false;
+    repo->ok = event.ok;
+    mWatcher.setSuppressed(repo->settings->path, false);
+    mCache.entries.insert(repo->settings->path, event.cache);
+    mMetrics.addRefresh(repo->settings->path, event);
+    if (event.ok) {
+        mMetrics.setLastSuccess(repo->settings->path,
+                                QDateTime::currentDateTime());
+    }
+
+    if (mStopping) { return; }
+
+    if (event.ok) {
+        repo->retryCount = 0;
+        repo->retrying = false;
+        Settings::RepoPtr s = repo->settings;
+        if (s->adaptiveRefresh && (s->refreshRateMinutes > 0)) {
+            repo->intervalMsecs = mPlanner.adaptedInterval(
+                        intervalMsecs(repo), event.changed,
+                        qint64(s->minRefreshMinutes) * 60 * 1000,
+                        qint64(s->maxRefreshMinutes) * 60 * 1000);
+            mCache.entries[s->path].intervalMsecs = repo->intervalMsecs;
+        }
+        startRepoTimer(repo);
+    } else {
+        // Network problems (e.g. offline, VPN down) are retried instead of
+        // stopping auto-refresh until the user intervenes.
+        repo->retrying = event.transient
+                         && (repo->settings->refreshRateMinutes > 0);
+        if (repo->retrying) {
+            repo->retryCount++;
+            qint64 delay = mPlanner.retryDelay(repo->retryCount);
+            mRepoTimers.start(repo->settings, delay);
+        } else {
+            repo->retryCount = 0;
+        }
+    }
+
+    // Save the cache once all refreshes are done
+    if (!isRefreshing()) {
+        mCache.save();
+    }
+}
@@ -0,0 +1,171 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* RepoController
+ *
+ * Auto-refresh of the repos in the settings, shared by the main window and
+ * the daemon. GUI free, only needs a QCoreApplication.
+ *
+ * Owns the sync engine and everything around it: refresh timers (with the
+ * startup ramp, adaptive intervals and retries after network errors, see
+ * RefreshPlanner), the file watcher and fsmonitor hook, the repo cache, ssh
+ * connection sharing, the trace and the Prometheus metrics. All of it is set
+ * up from the settings by start().
+ *
+ * Engine events are handled in the thread of the controller. The repo state
+ * is updated first and then the event is passed on with syncEvent(), so the
+ * front end only has to display it. E.g. after a failed refresh, retrying and
+ * remainingTime() tell whether and when it is retried. Other state changes
+ * (refresh queued, timer started or stopped) are reported with
+ * repoStateChanged().
+ */
+
+#ifndef REPOCONTROLLER_H
+#define REPOCONTROLLER_H
+
+#include "fsmonitor.h"
+#include "metricsserver.h"
+#include "refreshplanner.h"
+#include "repocache.h"
+#include "repowatcher.h"
+#include "settings.h"
+#include "sshmux.h"
+#include "syncengine.h"
+#include "syncmetrics.h"
+#include "ThreadWorker.h"
+#include "timerwheel.h"
+#include "tracer.h"
+
+#include <QObject>
+#include <QTimer>
+
+class RepoController : public QObject
+{
+    Q_OBJECT
+public:
+    // The settings must outlive the controller. Repos are added with
+    // addRepo() and removed with removeRepo(), the settings' repo list is
+    // left to the caller.
+    explicit RepoController(Settings* settings, QObject *parent = nullptr);
+    ~RepoController();
+
+    struct Repo
+    {
+        Settings::RepoPtr settings;
+        // Last refresh succeeded
+        bool ok = true;
+        bool refreshing = false;
+        // Refresh has left the queue and is running
+        bool started = false;
+        // Timer is running for the staggered refresh at startup
+        bool startupRefresh = false;
+        // Current interval in adaptive mode, zero if not known yet
+        qint64 intervalMsecs = 0;
+        // Number of retries after transient errors. Timer is running for
+        // the next retry while retrying.
+        int retryCount = 0;
+        bool retrying = false;
+        QString remoteUrl;
+    };
+    typedef QSharedPointer<Repo> RepoPtr;
+
+    // Load the cache, set up everything from the settings and add the repos
+    // of the settings, spreading their refreshes over the startup ramp.
+    void start();
+
+    // A startup delay of zero refreshes the repo immediately if it is due
+    RepoPtr addRepo(Settings::RepoPtr repoSettings, qint64 startupDelayMsecs = 0);
+    void removeRepo(Settings::RepoPtr repoSettings);
+    RepoPtr repo(Settings::RepoPtr repoSettings);
+    QList<RepoPtr> repos();
+    // Last cached state of the repo from this or a previous run
+    RepoCache::Entry cacheEntry(Settings::RepoPtr repoSettings);
+
+    void refresh(Settings::RepoPtr repoSettings,
+                 RefreshScheduler::Priority priority);
+    // Bulk refresh spread over a short time
+    void refreshAll();
+    // Stop and restart auto-refresh
+    void pause(Settings::RepoPtr repoSettings);
+    void resume(Settings::RepoPtr repoSettings);
+    // Call after changing the refresh rate settings of the repo. Auto-refresh
+    // stopped due to an error stays stopped.
+    void refreshRateChanged(Settings::RepoPtr repoSettings, int lastRateMinutes);
+
+    void setOurName(QString name);
+    void setMaxParallel(int count);
+
+    // "ok", "error", "refreshing" or "paused"
+    QString stateName(RepoPtr repo);
+    bool isTimerActive(RepoPtr repo);
+    // Milliseconds until the next auto-refresh, or -1 if none
+    qint64 remainingTime(RepoPtr repo);
+    // Auto-refresh interval, zero if disabled
+    qint64 intervalMsecs(RepoPtr repo);
+    bool isRefreshing();
+
+    // Stop starting refreshes, e.g. when shutting down. Queued refreshes are
+    // dropped, running ones may finish.
+    void stop();
+    void cancelAll();
+
+    void saveCache();
+    TracerPtr tracer();
+
+signals:
+    void message(QString msg);
+    // Before anything is done with the repo, so the front end can set up its
+    // own state for it
+    void repoAdded(Settings::RepoPtr repo);
+    void syncEvent(SyncEngine::Event event);
+    void repoStateChanged(Settings::RepoPtr repo);
+
+private:
+    Settings* mSettings;
+    RepoCache mCache;
+    QList<RepoPtr> mRepos;
+    bool mStopping = false;
+
+    ThreadWorker mThreadWorker;
+    SyncEngine mSyncEngine;
+    RepoWatcher mWatcher;
+    FsMonitor mFsMonitor;
+    SshMux mSshMux;
+    TimerWheel mRepoTimers;
+    RefreshPlanner mPlanner;
+    TracerPtr mTracer;
+    // Writes buffered trace events regularly, so the file is current while
+    // the app is running
+    QTimer mTraceFlushTimer;
+    SyncMetrics mMetrics;
+    MetricsServer mMetricsServer;
+    QByteArray metricsText();
+
+    void startRepoTimer(RepoPtr repo);
+    void onRepoTimersExpired(QList<Settings::RepoPtr> repoSettings);
+    RepoPtr repoForPath(QString path);
+    void onRepoFilesChanged(QString path);
+    void refreshRepo(RepoPtr repo, RefreshScheduler::Priority priority);
+    void onSyncEvent(SyncEngine::Event event);
+    void handleSyncEvent(RepoPtr repo, SyncEngine::Event event);
+    void onRefreshFinished(RepoPtr repo, SyncEngine::Event event);
+};
+
+#endif // REPOCONTROLLER_H
@@ -0,0 +1,500 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "repowatcher.h"
+
+#include "git.h"
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSet>
+
+#ifdef Q_OS_LINUX
+#include <errno.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+RepoWatcher::RepoWatcher(QObject *parent)
+    : QObject{parent}
+{
+    mEpoch = QDateTime::currentMSecsSinceEpoch();
+
+    mWalkTimer.setSingleShot(true);
+    mWalkTimer.setInterval(0);
+    connect(&mWalkTimer, &QTimer::timeout, this, [=]() { onWalkTimer(); });
+
+#ifdef Q_OS_LINUX
+    mFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (mFd >= 0) {
+        mNotifier = new QSocketNotifier(mFd, QSocketNotifier::Read, this);
+        connect(mNotifier, &QSocketNotifier::activated,
+                this, [=]() { onReadable(); });
+    }
+#endif
+}
+
+RepoWatcher::~RepoWatcher()
+{
+#ifdef Q_OS_LINUX
+    if (mFd >= 0) {
+        delete mNotifier;
+        ::close(mFd);
+    }
+#endif
+}
+
+bool RepoWatcher::isSupported()
+{
+    return mFd >= 0;
+}
+
+void RepoWatcher::setQuietPeriod(int msecs)
+{
+    mQuietMsecs = msecs;
+}
+
+void RepoWatcher::setMaxDelay(int msecs)
+{
+    mMaxDelayMsecs = msecs;
+}
+
+bool RepoWatcher::addRepo(QString path)
+{
+    if (!isSupported()) { return false; }
+    if (mRepos.contains(path)) { return true; }
+
+    RepoPtr repo(new Repo());
+    repo->path = path;
+    repo->canonicalPath = QFileInfo(path).canonicalFilePath();
+    resetJournal(repo);
+    // Changes made before watching started are unknown
+    repo->worktreeChanged = true;
+    repo->quietTimer.setSingleShot(true);
+    connect(&repo->quietTimer, &QTimer::timeout, this, [=]()
+    {
+        emit repoChanged(path);
+    });
+
+    if (!watchRepo(repo)) {
+        return false;
+    }
+
+    mRepos.insert(path, repo);
+    return true;
+}
+
+void RepoWatcher::removeRepo(QString path)
+{
+    RepoPtr repo = mRepos.take(path);
+    if (repo) {
+        unwatchRepo(repo);
+        repo->quietTimer.stop();
+    }
+}
+
+bool RepoWatcher::isWatching(QString path)
+{
+    RepoPtr repo = mRepos.value(path);
+    return repo && repo->ready;
+}
+
+void RepoWatcher::setSuppressed(QString path, bool suppressed)
+{
+    RepoPtr repo = mRepos.value(path);
+    if (!repo) { return; }
+
+    if (suppressed) {
+        repo->worktreeChangedWhileSuppressed = false;
+        repo->suppressed = true;
+        return;
+    }
+
+    // Events caused while suppressed may not have been read yet
+    onReadable();
+    repo->quietTimer.stop();
+    repo->suppressed = false;
+    // Changes to HEAD and refs are our own commits and merges. The work tree
+    // may also have been edited by the user in the meantime, so report that
+    // as usual. Merges changing files are reported too, as they can't be told
+    // apart.
+    if (repo->worktreeChangedWhileSuppressed) {
+        repo->worktreeChangedWhileSuppressed = false;
+        onRepoEvent(repo);
+    }
+}
+
+bool RepoWatcher::takeWorktreeChanged(QString path)
+{
+    RepoPtr repo = mRepos.value(path);
+    if (!repo) { return true; }
+
+    bool changed = repo->worktreeChanged;
+    repo->worktreeChanged = false;
+    return changed;
+}
+
+QString RepoWatcher::repoForWorktree(QString dir)
+{
+    QString canonical = QFileInfo(dir).canonicalFilePath();
+    if (canonical.isEmpty()) { return QString(); }
+
+    foreach (RepoPtr repo, mRepos) {
+        if (repo->ready && (repo->canonicalPath == canonical)) {
+            return repo->path;
+        }
+    }
+    return QString();
+}
+
+bool RepoWatcher::changesSince(QString path, QString token,
+                               QString* newToken, QStringList* changedPaths)
+{
+    RepoPtr repo = mRepos.value(path);
+    if (!repo) { return false; }
+
+    // Handle events that are already queued so that all changes made before
+    // now are included.
+    onReadable();
+    // The overflow handling may have dropped the repo
+    if (!mRepos.contains(path)) { return false; }
+
+    *newToken = this->token(repo);
+    // Changes in directories not watched yet are not known
+    if (!repo->ready) { return false; }
+
+    // Token format: gidsync:<epoch>:<seq>
+    QStringList parts = token.split(':');
+    if ((parts.count() != 3) || (parts.value(0) != "gidsync")) { return false; }
+    bool ok1, ok2;
+    qint64 epoch = parts.value(1).toLongLong(&ok1);
+    quint64 seq = parts.value(2).toULongLong(&ok2);
+    if (!ok1 || !ok2 || (epoch != mEpoch)) { return false; }
+    if ((seq < repo->journalStart) || (seq > repo->seq)) { return false; }
+
+    QSet<QString> seen;
+    for (int i = repo->journal.count() - 1; i >= 0; i--) {
+        const QPair<quint64, QString>& entry = repo->journal.at(i);
+        if (entry.first <= seq) { break; }
+        if (!seen.contains(entry.second)) {
+            seen.insert(entry.second);
+            changedPaths->append(entry.second);
+        }
+    }
+    return true;
+}
+
+QString RepoWatcher::token(RepoPtr repo)
+{
+    return QString("gidsync:%1:%2").arg(mEpoch).arg(repo->seq);
+}
+
+void RepoWatcher::addToJournal(RepoPtr repo, QString relativePath)
+{
+    if (relativePath.isEmpty()) {
+        // The work tree itself changed
+        resetJournal(repo);
+        return;
+    }
+
+    repo->seq = ++mSeq;
+    repo->journal.append(qMakePair(repo->seq, relativePath));
+    if (repo->journal.count() > maxJournalSize) {
+        // Forget the oldest half. Older tokens then require a full scan.
+        int drop = repo->journal.count() / 2;
+        repo->journalStart = repo->journal.at(drop - 1).first;
+        repo->journal = repo->journal.mid(drop);
+    }
+}
+
+void RepoWatcher::resetJournal(RepoPtr repo)
+{
+    repo->seq = ++mSeq;
+    repo->journal.clear();
+    repo->journalStart = repo->seq;
+}
+
+bool RepoWatcher::watchRepo(RepoPtr repo)
+{
+    Git git(repo->path);
+    repo->gitDir = git.gitDir();
+    QString commonDir = git.commonDir();
+    if (repo->gitDir.isEmpty()) {
+        emit message("Not watching, path is not a Git repo: " + repo->path);
+        return false;
+    }
+    repo->refsDir = commonDir + "/refs/heads";
+
+    bool ok =    addWatch(repo, repo->gitDir, Watch::GitDir)
+              && addWatchRecursive(repo, repo->refsDir, Watch::Refs);
+    if (!ok) {
+        unwatchRepo(repo);
+        return false;
+    }
+
+    // The work tree may be large, see onWalkTimer()
+    repo->ready = false;
+    repo->pendingDirs = QStringList({repo->path});
+    if (!mWalking.contains(repo)) {
+        mWalking.append(repo);
+    }
+    mWalkTimer.start();
+    return true;
+}
+
+void RepoWatcher::onWalkTimer()
+{
+    // Watch the work tree directories in batches, so that adding many large
+    // repos does not block the event loop
+    int budget = walkBatchSize;
+    while ((budget > 0) && !mWalking.isEmpty()) {
+        RepoPtr repo = mWalking.first();
+        if (mRepos.value(repo->path) != repo) {
+            // Removed in the meantime
+            mWalking.removeFirst();
+            continue;
+        }
+        if (repo->pendingDirs.isEmpty()) {
+            // Tokens handed out during the walk may have missed changes
+            resetJournal(repo);
+            repo->worktreeChanged = true;
+            repo->ready = true;
+            mWalking.removeFirst();
+            continue;
+        }
+
+        QString dir = repo->pendingDirs.takeLast();
+        budget--;
+        if (!addWatch(repo, dir, Watch::Worktree)) {
+            // Not watched at all rather than partially
+            unwatchRepo(repo);
+            repo->quietTimer.stop();
+            mRepos.remove(repo->path);
+            mWalking.removeFirst();
+            continue;
+        }
+        QStringList subdirs = QDir(dir).entryList(QDir::Dirs | QDir::Hidden
+                                                  | QDir::NoDotAndDotDot
+                                                  | QDir::NoSymLinks);
+        foreach (QString subdir, subdirs) {
+            // The Git directory is not watched recursively
+            if (subdir == ".git") { continue; }
+            repo->pendingDirs.append(dir + "/" + subdir);
+        }
+    }
+
+    if (!mWalking.isEmpty()) {
+        mWalkTimer.start();
+    }
+}
+
+void RepoWatcher::unwatchRepo(RepoPtr repo)
+{
+#ifdef Q_OS_LINUX
+    foreach (int wd, repo->watches) {
+        inotify_rm_watch(mFd, wd);
+        mWatches.remove(wd);
+    }
+#endif
+    repo->watches.clear();
+}
+
+bool RepoWatcher::addWatch(RepoPtr repo, QString dir, Watch::Kind kind)
+{
+#ifdef Q_OS_LINUX
+    uint32_t mask = IN_ONLYDIR | IN_DONT_FOLLOW | IN_EXCL_UNLINK;
+    switch (kind) {
+    case Watch::Worktree:
+        mask |= IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB
+              | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF;
+        break;
+    case Watch::GitDir:
+    case Watch::Refs:
+        // Git updates files by renaming a lock file over them
+        mask |= IN_CREATE | IN_DELETE | IN_CLOSE_WRITE
+              | IN_MOVED_FROM | IN_MOVED_TO;
+        break;
+    }
+
+    int wd = inotify_add_watch(mFd, QFile::encodeName(dir).constData(), mask);
+    if (wd < 0) {
+        if (errno == ENOSPC) {
+            emit message(QString("Not watching %1: inotify watch limit reached."
+                                 " See /proc/sys/fs/inotify/max_user_watches.")
+                         .arg(repo->path));
+            return false;
+        }
+        // Directory may have been removed in the meantime
+        return true;
+    }
+
+    Watch w;
+    w.repo = repo;
+    w.dir = dir;
+    w.kind = kind;
+    mWatches.insert(wd, w);
+    if (!repo->watches.contains(wd)) {
+        repo->watches.append(wd);
+    }
+    return true;
+#else
+    Q_UNUSED(repo);
+    Q_UNUSED(dir);
+    Q_UNUSED(kind);
+    return false;
+#endif
+}
+
+bool RepoWatcher::addWatchRecursive(RepoPtr repo, QString dir, Watch::Kind kind)
+{
+    if (!addWatch(repo, dir, kind)) {
+        return false;
+    }
+
+    QStringList subdirs = QDir(dir).entryList(QDir::Dirs | QDir::Hidden
+                                              | QDir::NoDotAndDotDot
+                                              | QDir::NoSymLinks);
+    foreach (QString subdir, subdirs) {
+        // The Git directory (and with it .git/objects) is not watched
+        // recursively.
+        if ((kind == Watch::Worktree) && (subdir == ".git")) { continue; }
+
+        if (!addWatchRecursive(repo, dir + "/" + subdir, kind)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void RepoWatcher::onReadable()
+{
+#ifdef Q_OS_LINUX
+    alignas(struct inotify_event) char buf[64 * 1024];
+    bool overflow = false;
+
+    forever {
+        ssize_t len = ::read(mFd, buf, sizeof(buf));
+        if (len <= 0) { break; }
+
+        char* p = buf;
+        while (p < buf + len) {
+            struct inotify_event* ev = reinterpret_cast<struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + ev->len;
+
+            if (ev->mask & IN_Q_OVERFLOW) {
+                overflow = true;
+                continue;
+            }
+            if (!mWatches.contains(ev->wd)) { continue; }
+            Watch w = mWatches.value(ev->wd);
+
+            if (ev->mask & IN_IGNORED) {
+                // Watched directory was removed
+                mWatches.remove(ev->wd);
+                w.repo->watches.removeAll(ev->wd);
+                continue;
+            }
+
+            QString name = (ev->len > 0) ? QFile::decodeName(ev->name) : QString();
+            bool newDir = (ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO));
+
+            switch (w.kind) {
+            case Watch::GitDir:
+                // Only HEAD is of interest, e.g. after a checkout or commit
+                if (name != "HEAD") { continue; }
+                break;
+            case Watch::Refs:
+                if (name.endsWith(".lock")) { continue; }
+                if (newDir) {
+                    addWatchRecursive(w.repo, w.dir + "/" + name, Watch::Refs);
+                }
+                break;
+            case Watch::Worktree: {
+                if (name == ".git") { continue; }
+                QString relDir = w.dir.mid(w.repo->path.length() + 1);
+                if (!relDir.isEmpty()) { relDir += "/"; }
+                if (name.isEmpty()) {
+                    // The watched directory itself was deleted or moved
+                    addToJournal(w.repo, relDir);
+                } else if (ev->mask & IN_ISDIR) {
+                    if (newDir) {
+                        addWatchRecursive(w.repo, w.dir + "/" + name,
+                                          Watch::Worktree);
+                    }
+                    // Also covers files added before the new watch was
+                    addToJournal(w.repo, relDir + name + "/");
+                } else {
+                    addToJournal(w.repo, relDir + name);
+                }
+                w.repo->worktreeChanged = true;
+                if (w.repo->suppressed) {
+                    w.repo->worktreeChangedWhileSuppressed = true;
+                }
+                break;
+            }
+            }
+
+            onRepoEvent(w.repo);
+        }
+    }
+
+    if (overflow) {
+        onOverflow();
+    }
+#endif
+}
+
+void RepoWatcher::onOverflow()
+{
+    emit message("Filesystem event queue overflowed. Rescanning all repos.");
+
+    // Events were lost, so anything could have changed. Watches for new
+    // directories may also be missing.
+    foreach (RepoPtr repo, mRepos.values()) {
+        unwatchRepo(repo);
+        if (!watchRepo(repo)) {
+            // Not watched anymore, so changes are not known
+            mRepos.remove(repo->path);
+        }
+        repo->worktreeChanged = true;
+        resetJournal(repo);
+        onRepoEvent(repo);
+    }
+}
+
+void RepoWatcher::onRepoEvent(RepoPtr repo)
+{
+    if (repo->suppressed) { return; }
+
+    if (!repo->quietTimer.isActive()) {
+        repo->firstEvent.start();
+    }
+
+    if (repo->firstEvent.elapsed() >= mMaxDelayMsecs) {
+        // Changes keep on coming. Don't wait any longer.
+        repo->quietTimer.stop();
+        emit repoChanged(repo->path);
+    } else {
+        repo->quietTimer.start(mQuietMsecs);
+    }
+}
@@ -0,0 +1,169 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* RepoWatcher
+ *
+ * Watches the work trees of repos for changes using inotify (Linux only).
+ *
+ * All directories of a work tree are watched recursively, except for the Git
+ * directory. Of the Git directory, only HEAD and the local branch refs are
+ * watched so that commits made outside of this app are noticed too. The work
+ * tree directories are added in batches from the event loop, so adding many
+ * large repos does not block it. Until all are added, the repo does not count
+ * as watched.
+ *
+ * Events are debounced per repo: repoChanged() is emitted once no more events
+ * have arrived for the quiet period, or once the max delay has passed since
+ * the first event in case of continuous changes.
+ *
+ * While a repo is suppressed (e.g. while this app syncs it), events are still
+ * recorded but repoChanged() is not emitted, so our own commits do not
+ * trigger another refresh. Work tree changes are reported once the
+ * suppression ends.
+ *
+ * If the kernel event queue overflows, events are lost. All repos are then
+ * considered changed and their watches are rebuilt.
+ *
+ * Changed work tree paths are also kept in a journal per repo, numbered with
+ * tokens, so that changesSince() can answer Git's fsmonitor hook (see
+ * FsMonitor).
+ */
+
+#ifndef REPOWATCHER_H
+#define REPOWATCHER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMap>
+#include <QObject>
+#include <QSharedPointer>
+#include <QSocketNotifier>
+#include <QStringList>
+#include <QTimer>
+
+class RepoWatcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit RepoWatcher(QObject *parent = nullptr);
+    ~RepoWatcher();
+
+    bool isSupported();
+
+    void setQuietPeriod(int msecs);
+    void setMaxDelay(int msecs);
+
+    // Returns false if the repo can't be watched, e.g. when it is not a Git
+    // repo. If the inotify watch limit is reached while adding the work tree
+    // directories later on, the repo is dropped and not watched at all.
+    bool addRepo(QString path);
+    void removeRepo(QString path);
+    // Whether all directories of the repo are watched
+    bool isWatching(QString path);
+
+    // Don't emit repoChanged() for the repo while suppressed. The work tree
+    // flag and the journal are still updated. When the suppression ends,
+    // events still queued in the kernel are read, and repoChanged() follows
+    // if the work tree changed in the meantime. Changes to HEAD and the refs
+    // only are dropped. Suppressing again forgets the work tree changes seen
+    // so far.
+    void setSuppressed(QString path, bool suppressed);
+
+    // Returns whether files in the work tree changed since the last call, and
+    // clears the flag. Always true if the repo is not watched.
+    bool takeWorktreeChanged(QString path);
+
+    // Returns the repo path of the watched repo with the specified work tree
+    // directory, or an empty string if none.
+    QString repoForWorktree(QString dir);
+
+    // Work tree paths (relative, directories ending in '/') changed since the
+    // token was handed out. newToken is set to the token for the current
+    // state. Returns false if the changes since the token are not known (e.g.
+    // unknown or too old token, or events were lost), in which case everything
+    // must be considered changed.
+    bool changesSince(QString path, QString token, QString* newToken,
+                      QStringList* changedPaths);
+
+signals:
+    void repoChanged(QString path);
+    void message(QString msg);
+
+private:
+    struct Repo
+    {
+        QString path;
+        QString gitDir;
+        QString refsDir;
+        QList<int> watches;
+        bool worktreeChanged = false;
+        bool suppressed = false;
+        bool worktreeChangedWhileSuppressed = false;
+        // All work tree directories are watched
+        bool ready = false;
+        // Work tree directories still to be watched
+        QStringList pendingDirs;
+        QTimer quietTimer;
+        QElapsedTimer firstEvent;
+        QString canonicalPath;
+        // Change journal. Only changes after journalStart are known.
+        quint64 seq = 0;
+        quint64 journalStart = 0;
+        QList<QPair<quint64, QString>> journal;
+    };
+    typedef QSharedPointer<Repo> RepoPtr;
+
+    struct Watch
+    {
+        RepoPtr repo;
+        QString dir;
+        enum Kind { Worktree, GitDir, Refs } kind = Worktree;
+    };
+
+    int mFd = -1;
+    QSocketNotifier* mNotifier = nullptr;
+    QMap<QString, RepoPtr> mRepos;
+    QHash<int, Watch> mWatches;
+    // Repos whose work tree directories are being added
+    QList<RepoPtr> mWalking;
+    QTimer mWalkTimer;
+    static const int walkBatchSize = 200;
+    int mQuietMsecs = 3000;
+    int mMaxDelayMsecs = 30000;
+    // Distinguishes tokens of this run from those of earlier runs
+    qint64 mEpoch = 0;
+    // Shared by all repos so a re-added repo does not accept old tokens
+    quint64 mSeq = 0;
+    static const int maxJournalSize = 100000;
+
+    bool watchRepo(RepoPtr repo);
+    void unwatchRepo(RepoPtr repo);
+    bool addWatch(RepoPtr repo, QString dir, Watch::Kind kind);
+    bool addWatchRecursive(RepoPtr repo, QString dir, Watch::Kind kind);
+    void onWalkTimer();
+    void onReadable();
+    void onOverflow();
+    void onRepoEvent(RepoPtr repo);
+    void addToJournal(RepoPtr repo, QString relativePath);
+    void resetJournal(RepoPtr repo);
+    QString token(RepoPtr repo);
+};
+
+#endif // REPOWATCHER_H
@@ -22,8 +22,10 @@
 
 #include <QDebug>
 #include <QDir>
+#include <QHostInfo>
 #include <QJsonArray>
 #include <QJsonDocument>
+#include <QProcessEnvironment>
 #include <QStandardPaths>
 
 Settings::Settings() {}
@@ -38,6 +40,17 @@ QString Settings::settingsDir()
     return QStandardPaths::writableLocation(QStandardPaths::AppConfigLocation);
 }
 
+QString Settings::defaultOurName()
+{
+    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+#ifdef Q_OS_WIN
+    QString username = env.value("USERNAME");
+#else
+    QString username = env.value("USER");
+#endif
+    return QString("%1/%2").arg(QHostInfo::localHostName(), username);
+}
+
 GidFile::Result Settings::save()
 {
     QDir dir(settingsDir());
@@ -59,6 +72,29 @@ GidFile::Result Settings::save()
     QJsonObject jMain;
     jMain.insert("repos", aRepos);
     jMain.insert("ourName", ourName);
+    jMain.insert("maxParallelRefreshes", maxParallelRefreshes);
+    jMain.insert("networkTimeoutSecs", networkTimeoutSecs);
+    jMain.insert("maxRefreshesPerHost", maxRefreshesPerHost);
+    jMain.insert("hostRefreshesPerMinute", hostRefreshesPerMinute);
+    jMain.insert("hostRefreshBurst", hostRefreshBurst);
+    jMain.insert("sshMultiplexing", sshMultiplexing);
+    jMain.insert("sshControlPersistSecs", sshControlPersistSecs);
+    jMain.insert("sshProgram", sshProgram);
+    jMain.insert("watchFilesystem", watchFilesystem);
+    jMain.insert("watchQuietMsecs", watchQuietMsecs);
+    jMain.insert("watchMaxDelayMsecs", watchMaxDelayMsecs);
+    jMain.insert("fsmonitorHook", fsmonitorHook);
+    jMain.insert("controlSocket", controlSocket);
+    jMain.insert("metricsPort", metricsPort);
+    jMain.insert("metricsSocket", metricsSocket);
+    jMain.insert("traceEnabled", traceEnabled);
+    jMain.insert("traceMaxFileSizeMB", traceMaxFileSizeMB);
+    jMain.insert("traceMaxFiles", traceMaxFiles);
+    jMain.insert("refreshJitterPercent", refreshJitterPercent);
+    jMain.insert("refreshPhaseSpreading", refreshPhaseSpreading);
+    jMain.insert("startupRampSecs", startupRampSecs);
+    jMain.insert("retryBaseSecs", retryBaseSecs);
+    jMain.insert("retryMaxSecs", retryMaxSecs);
 
     QJsonDocument jDoc;
     jDoc.setObject(jMain);
@@ -87,6 +123,38 @@ GidFile::Result Settings::load()
         }
 
         ourName = jMain.value("ourName").toString();
+        maxParallelRefreshes = jMain.value("maxParallelRefreshes")
+                                   .toInt(maxParallelRefreshes);
+        networkTimeoutSecs = jMain.value("networkTimeoutSecs")
+                                 .toInt(networkTimeoutSecs);
+        maxRefreshesPerHost = jMain.value("maxRefreshesPerHost")
+                                  .toInt(maxRefreshesPerHost);
+        hostRefreshesPerMinute = jMain.value("hostRefreshesPerMinute")
+                                     .toDouble(hostRefreshesPerMinute);
+        hostRefreshBurst = jMain.value("hostRefreshBurst").toInt(hostRefreshBurst);
+        sshMultiplexing = jMain.value("sshMultiplexing").toBool(sshMultiplexing);
+        sshControlPersistSecs = jMain.value("sshControlPersistSecs")
+                                    .toInt(sshControlPersistSecs);
+        sshProgram = jMain.value("sshProgram").toString(sshProgram);
+        watchFilesystem = jMain.value("watchFilesystem").toBool(watchFilesystem);
+        watchQuietMsecs = jMain.value("watchQuietMsecs").toInt(watchQuietMsecs);
+        watchMaxDelayMsecs = jMain.value("watchMaxDelayMsecs")
+                                 .toInt(watchMaxDelayMsecs);
+        fsmonitorHook = jMain.value("fsmonitorHook").toBool(fsmonitorHook);
+        controlSocket = jMain.value("controlSocket").toBool(controlSocket);
+        metricsPort = jMain.value("metricsPort").toInt(metricsPort);
+        metricsSocket = jMain.value("metricsSocket").toString(metricsSocket);
+        traceEnabled = jMain.value("traceEnabled").toBool(traceEnabled);
+        traceMaxFileSizeMB = jMain.value("traceMaxFileSizeMB")
+                                 .toInt(traceMaxFileSizeMB);
+        traceMaxFiles = jMain.value("traceMaxFiles").toInt(traceMaxFiles);
+        refreshJitterPercent = jMain.value("refreshJitterPercent")
+                                   .toInt(refreshJitterPercent);
+        refreshPhaseSpreading = jMain.value("refreshPhaseSpreading")
+                                    .toBool(refreshPhaseSpreading);
+        startupRampSecs = jMain.value("startupRampSecs").toInt(startupRampSecs);
+        retryBaseSecs = jMain.value("retryBaseSecs").toInt(retryBaseSecs);
+        retryMaxSecs = jMain.value("retryMaxSecs").toInt(retryMaxSecs);
 
     }
 
@@ -99,6 +167,9 @@ QJsonObject Settings::Repo::toJson()
     j.insert("name", name);
     j.insert("path", path);
     j.insert("refreshRateMinutes", refreshRateMinutes);
+    j.insert("adaptiveRefresh", adaptiveRefresh);
+    j.insert("minRefreshMinutes", minRefreshMinutes);
+    j.insert("maxRefreshMinutes", maxRefreshMinutes);
     return j;
 }
 
@@ -107,4 +178,7 @@ void Settings::Repo::fromJson(QJsonObject json)
     name = json.value("name").toString();
     path = json.value("path").toString();
     refreshRateMinutes = json.value("refreshRateMinutes").toInt();
+    adaptiveRefresh = json.value("adaptiveRefresh").toBool(adaptiveRefresh);
+    minRefreshMinutes = json.value("minRefreshMinutes").toInt(minRefreshMinutes);
+    maxRefreshMinutes = json.value("maxRefreshMinutes").toInt(maxRefreshMinutes);
 }
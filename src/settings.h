@@ -37,6 +37,11 @@ public:
         QString name;
         QString path;
         int refreshRateMinutes = 60;
+        // Adapt the interval to how often the repo changes, starting at
+        // refreshRateMinutes and staying between the min and max.
+        bool adaptiveRefresh = false;
+        int minRefreshMinutes = 5;
+        int maxRefreshMinutes = 240;
         QJsonObject toJson();
         void fromJson(QJsonObject json);
     };
@@ -44,10 +49,54 @@ public:
 
     QList<RepoPtr> repos;
     QString ourName;
+    // Maximum number of repos refreshed at the same time
+    int maxParallelRefreshes = 4;
+    // Fetches and pushes running longer than this are stopped
+    int networkTimeoutSecs = 120;
+    // Per remote host limits, see HostLimiter. Zero means no limit.
+    int maxRefreshesPerHost = 4;
+    double hostRefreshesPerMinute = 60;
+    int hostRefreshBurst = 20;
+    // Share SSH connections to the same host between repos, see SshMux. Off
+    // by default, as it sets GIT_SSH_COMMAND for Git.
+    bool sshMultiplexing = false;
+    int sshControlPersistSecs = 120;
+    QString sshProgram = "ssh";
+    // Refresh repos when files change (Linux only), once no more changes
+    // have been seen for the quiet period, or at the latest after the max
+    // delay while changes keep coming.
+    bool watchFilesystem = true;
+    int watchQuietMsecs = 3000;
+    int watchMaxDelayMsecs = 30000;
+    // Let Git commands run by this app use the watcher as fsmonitor hook
+    bool fsmonitorHook = true;
+    // Local socket for other tools to query and control repos, see
+    // ControlServer
+    bool controlSocket = true;
+    // Spreading of refreshes over time, see RefreshPlanner. Phase spreading
+    // moves periodic refreshes to anywhere between half and one and a half
+    // intervals after the previous one, so it is opt-in.
+    int refreshJitterPercent = 10;
+    bool refreshPhaseSpreading = false;
+    int startupRampSecs = 60;
+    // Prometheus metrics on a loopback port (zero for none) and/or a Unix
+    // socket (empty for none), see MetricsServer
+    int metricsPort = 0;
+    QString metricsSocket;
+    // Trace of refreshes and Git commands for Perfetto, see Tracer
+    bool traceEnabled = false;
+    int traceMaxFileSizeMB = 20;
+    int traceMaxFiles = 3;
+    // Retrying after network errors
+    int retryBaseSecs = 30;
+    int retryMaxSecs = 30 * 60;
 
     QString settingsFilePath();
     QString settingsDir();
 
+    // Name used when ourName is not set: "<hostname>/<username>"
+    static QString defaultOurName();
+
     GidFile::Result save();
     GidFile::Result load();
 };
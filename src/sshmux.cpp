@@ -0,0 +1,97 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "sshmux.h"
+
+#include <QDir>
+#include <QFile>
+#include <QProcess>
+#include <QProcessEnvironment>
+#include <QStandardPaths>
+
+void SshMux::setSshProgram(QString program)
+{
+    mSshProgram = program;
+}
+
+void SshMux::setPersistSecs(int secs)
+{
+    mPersistSecs = qMax(1, secs);
+}
+
+QString SshMux::command()
+{
+#ifdef Q_OS_WIN
+    return QString();
+#else
+    // Don't override the user's choice of ssh command
+    QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+    if (env.contains("GIT_SSH_COMMAND") || env.contains("GIT_SSH")) {
+        return QString();
+    }
+
+    QString dir = socketDir();
+    if (dir.isEmpty()) { return QString(); }
+
+    // %C is a hash of the local host, remote host, port and user, which keeps
+    // the socket path short enough for a Unix socket.
+    return QString("%1 -o ControlMaster=auto -o ControlPath=%2"
+                   " -o ControlPersist=%3")
+            .arg(shellQuote(mSshProgram))
+            .arg(shellQuote(dir + "/%C"))
+            .arg(mPersistSecs);
+#endif
+}
+
+void SshMux::closeAll()
+{
+#ifndef Q_OS_WIN
+    QString dir = socketDir();
+    if (dir.isEmpty()) { return; }
+
+    foreach (QString name, QDir(dir).entryList(QDir::System | QDir::Files)) {
+        // The host argument is required but not used with an explicit
+        // ControlPath.
+        QProcess::startDetached(mSshProgram, {"-o", "ControlPath=" + dir + "/" + name,
+                                              "-O", "exit", "gid-sync"});
+    }
+#endif
+}
+
+QString SshMux::socketDir()
+{
+    // Private directory, as anyone who can connect to a socket can use the
+    // connection.
+    QString base = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation);
+    if (base.isEmpty()) { return QString(); }
+
+    QString dir = base + "/gid-sync-ssh";
+    if (!QDir().mkpath(dir)) { return QString(); }
+    QFile::setPermissions(dir, QFile::ReadOwner | QFile::WriteOwner
+                               | QFile::ExeOwner);
+    return dir;
+}
+
+QString SshMux::shellQuote(QString s)
+{
+    // GIT_SSH_COMMAND is run by the shell
+    s.replace("'", "'\\''");
+    return "'" + s + "'";
+}
@@ -0,0 +1,64 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* SshMux
+ *
+ * Shares SSH connections between the Git commands of all repos on the same
+ * host using OpenSSH connection multiplexing.
+ *
+ * Git is given an ssh command (through GIT_SSH_COMMAND) that uses a
+ * ControlMaster socket per user, host and port in a private directory. The
+ * first command to a host sets up the connection and later ones reuse it,
+ * skipping the SSH handshake. ControlPersist keeps the master connection open
+ * for a while after the last command, so it lasts through a wave of
+ * refreshes and closes by itself once idle.
+ *
+ * Not used on Windows, or if the user has set GIT_SSH_COMMAND or GIT_SSH.
+ * Repos with core.sshCommand configured are left alone by SyncEngine.
+ */
+
+#ifndef SSHMUX_H
+#define SSHMUX_H
+
+#include <QString>
+
+class SshMux
+{
+public:
+    // Program to run, e.g. a wrapper script for testing
+    void setSshProgram(QString program);
+    void setPersistSecs(int secs);
+
+    // Command for GIT_SSH_COMMAND. Empty if multiplexing can't be used.
+    QString command();
+
+    // Ask all master connections to exit, e.g. when quitting
+    void closeAll();
+
+    QString socketDir();
+
+private:
+    QString mSshProgram = "ssh";
+    int mPersistSecs = 120;
+
+    static QString shellQuote(QString s);
+};
+
+#endif // SSHMUX_H
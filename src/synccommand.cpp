@@ -0,0 +1,215 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "synccommand.h"
+
+#include <QCoreApplication>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QTimer>
+
+#include <iostream>
+
+SyncCommand::SyncCommand(Args args, QObject *parent)
+    : QObject(parent)
+    , mArgs(args)
+    , mCache(mSettings.settingsDir())
+{
+}
+
+SyncCommand::~SyncCommand()
+{
+    if (mSettings.sshMultiplexing) {
+        mSshMux.closeAll();
+    }
+}
+
+bool SyncCommand::start()
+{
+    if (mArgs.all == !mArgs.repos.isEmpty()) {
+        printError("Specify either --all or the repos to sync.");
+        mExitCode = ExitUsage;
+        return false;
+    }
+
+    GidFile::Result r = mSettings.load();
+    if (!r.success) {
+        printError("Failed to load settings: " + r.errorString);
+        mExitCode = ExitUsage;
+        return false;
+    }
+    r = mCache.load();
+    if (!r.success) {
+        printError("Failed to load repo cache: " + r.errorString);
+    }
+
+    QList<Settings::RepoPtr> repos = selectedRepos();
+    if (mExitCode != ExitOk) { return false; }
+    if (repos.isEmpty()) {
+        printError("No repos to sync.");
+        return false;
+    }
+
+    // Events are reported from the engine's worker threads
+    mSyncEngine.setEventCallback([=](SyncEngine::Event event)
+    {
+        mThreadWorker.doInGuiThread([=](){ onSyncEvent(event); });
+    });
+
+    int jobs = (mArgs.jobs > 0) ? mArgs.jobs : mSettings.maxParallelRefreshes;
+    mSyncEngine.setMaxParallel(qMax(1, jobs));
+    mSyncEngine.setNetworkTimeout(mSettings.networkTimeoutSecs * 1000);
+    mSyncEngine.setHostLimits(mSettings.maxRefreshesPerHost,
+                              mSettings.hostRefreshesPerMinute,
+                              mSettings.hostRefreshBurst);
+    if (mSettings.sshMultiplexing) {
+        mSshMux.setSshProgram(mSettings.sshProgram);
+        mSshMux.setPersistSecs(mSettings.sshControlPersistSecs);
+        mSyncEngine.setSshCommand(mSshMux.command());
+    }
+    mSyncEngine.setOurName(mSettings.ourName.isEmpty()
+                           ? Settings::defaultOurName() : mSettings.ourName);
+
+    foreach (Settings::RepoPtr repo, repos) {
+        SyncEngine::Request request;
+        request.repo = repo;
+        request.cache = mCache.entries.value(repo->path);
+        if (mSyncEngine.refresh(request)) {
+            mRemaining++;
+        }
+    }
+
+    return (mRemaining > 0);
+}
+
+int SyncCommand::exitCode()
+{
+    return mExitCode;
+}
+
+QList<Settings::RepoPtr> SyncCommand::selectedRepos()
+{
+    if (mArgs.all) {
+        return mSettings.repos;
+    }
+
+    QList<Settings::RepoPtr> ret;
+    foreach (QString arg, mArgs.repos) {
+        QString canonical = QFileInfo(arg).canonicalFilePath();
+        Settings::RepoPtr found;
+        foreach (Settings::RepoPtr repo, mSettings.repos) {
+            if ((repo->name == arg) || (repo->path == arg)
+                    || (!canonical.isEmpty() && (canonical ==
+                            QFileInfo(repo->path).canonicalFilePath()))) {
+                found = repo;
+                break;
+            }
+        }
+        if (!found) {
+            printError("Not a repo in the settings: " + arg);
+            mExitCode = ExitUsage;
+        } else if (!ret.contains(found)) {
+            ret.append(found);
+        }
+    }
+    return ret;
+}
+
+void SyncCommand::onSyncEvent(SyncEngine::Event event)
+{
+    switch (event.type) {
+    case SyncEngine::Event::WakeUp:
+        QTimer::singleShot(event.durationMsecs, this, [=]()
+        {
+            mSyncEngine.wakeUp();
+        });
+        break;
+    case SyncEngine::Event::Finished:
+        onRefreshFinished(event);
+        break;
+    default:
+        break;
+    }
+}
+
+void SyncCommand::onRefreshFinished(SyncEngine::Event event)
+{
+    Settings::RepoPtr repo = event.repo;
+    mCache.entries.insert(repo->path, event.cache);
+
+    if (!event.ok) {
+        mFailed = true;
+        if (!event.transient) { mAllTransient = false; }
+    }
+
+    if (mArgs.json) {
+        print(QString::fromUtf8(QJsonDocument(resultToJson(event))
+                                    .toJson(QJsonDocument::Compact)));
+    } else if (event.ok) {
+        print(QString("%1: ok (%2 ms)").arg(repo->name).arg(event.durationMsecs));
+    } else {
+        print(QString("%1: failed at %2: %3")
+                  .arg(repo->name, event.state, event.text));
+    }
+
+    mRemaining--;
+    if (mRemaining <= 0) {
+        mCache.save();
+        if (mFailed) {
+            mExitCode = mAllTransient ? ExitTransient : ExitFailed;
+        }
+        QCoreApplication::exit(mExitCode);
+    }
+}
+
+QJsonObject SyncCommand::resultToJson(SyncEngine::Event event)
+{
+    QJsonArray stages;
+    foreach (SyncEngine::Event::Stage stage, event.stages) {
+        QJsonObject j;
+        j.insert("state", stage.state);
+        j.insert("msecs", stage.msecs);
+        stages.append(j);
+    }
+
+    QJsonObject j;
+    j.insert("repo", event.repo->name);
+    j.insert("path", event.repo->path);
+    j.insert("ok", event.ok);
+    j.insert("changed", event.changed);
+    j.insert("transient", event.transient);
+    j.insert("state", event.state);
+    j.insert("durationMsecs", event.durationMsecs);
+    j.insert("stages", stages);
+    j.insert("error", event.text);
+    j.insert("errorDetail", event.detail);
+    return j;
+}
+
+void SyncCommand::print(QString line)
+{
+    std::cout << line.toStdString() << std::endl;
+}
+
+void SyncCommand::printError(QString line)
+{
+    std::cerr << line.toStdString() << std::endl;
+}
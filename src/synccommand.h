@@ -0,0 +1,104 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* SyncCommand
+ *
+ * One refresh pass over repos in the settings from the command line, e.g. for
+ * cron jobs and CI hooks:
+ *
+ *   gid-sync --sync [--jobs N] [--json] (--all | <repo name or path>...)
+ *
+ * The repos are refreshed by SyncEngine, the same as in the GUI, and the
+ * result of each repo is printed as it finishes. With --json this is one JSON
+ * object per line:
+ *
+ *   {"repo": name, "path": path, "ok": bool, "changed": bool,
+ *    "transient": bool, "state": last state run, "durationMsecs": n,
+ *    "stages": [{"state": name, "msecs": n}, ...],
+ *    "error": summary, "errorDetail": detail}
+ *
+ * The exit code is one of ExitCode. The repo cache is updated, the settings
+ * are not touched.
+ */
+
+#ifndef SYNCCOMMAND_H
+#define SYNCCOMMAND_H
+
+#include "repocache.h"
+#include "settings.h"
+#include "sshmux.h"
+#include "syncengine.h"
+#include "ThreadWorker.h"
+
+#include <QJsonObject>
+#include <QObject>
+
+class SyncCommand : public QObject
+{
+    Q_OBJECT
+public:
+    struct Args {
+        // Repo names or paths
+        QStringList repos;
+        bool all = false;
+        // Zero for the number in the settings
+        int jobs = 0;
+        bool json = false;
+    };
+
+    enum ExitCode {
+        ExitOk = 0,
+        // At least one repo failed
+        ExitFailed = 1,
+        // Invalid arguments, unknown repo or settings could not be loaded
+        ExitUsage = 2,
+        // All failures were network errors that may go away by themselves
+        ExitTransient = 3
+    };
+
+    explicit SyncCommand(Args args, QObject *parent = nullptr);
+    ~SyncCommand();
+
+    // Start the pass. QCoreApplication exits with the exit code when done.
+    // Returns false if there is nothing to run, exitCode() then tells why.
+    bool start();
+    int exitCode();
+
+private:
+    Args mArgs;
+    Settings mSettings;
+    RepoCache mCache;
+    ThreadWorker mThreadWorker;
+    SyncEngine mSyncEngine;
+    SshMux mSshMux;
+    int mExitCode = ExitOk;
+    int mRemaining = 0;
+    bool mFailed = false;
+    bool mAllTransient = true;
+
+    QList<Settings::RepoPtr> selectedRepos();
+    void onSyncEvent(SyncEngine::Event event);
+    void onRefreshFinished(SyncEngine::Event event);
+    QJsonObject resultToJson(SyncEngine::Event event);
+    void print(QString line);
+    void printError(QString line);
+};
+
+#endif // SYNCCOMMAND_H
@@ -0,0 +1,218 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "syncdaemon.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QTextStream>
+#include <QTimer>
+
+#include <iostream>
+
+#ifdef Q_OS_UNIX
+#include <signal.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+int SyncDaemon::sSignalFds[2] = {-1, -1};
+
+SyncDaemon::SyncDaemon(Args args, QObject *parent)
+    : QObject(parent)
+    , mArgs(args)
+    , mController(&mSettings)
+{
+}
+
+bool SyncDaemon::start()
+{
+    openLogFile();
+    if (!mArgs.logFile.isEmpty() && !mLogFile.isOpen()) {
+        std::cerr << "Failed to open log file: "
+                  << mArgs.logFile.toStdString() << std::endl;
+        return false;
+    }
+
+    if (!setupSignalHandlers()) {
+        log("Failed to set up signal handlers.");
+        return false;
+    }
+
+    GidFile::Result r = mSettings.load();
+    if (!r.success) {
+        log("Failed to load settings: " + r.errorString);
+        return false;
+    }
+    log("Settings loaded from " + mSettings.settingsFilePath());
+
+    connect(&mController, &RepoController::message, this, &SyncDaemon::log);
+    connect(&mController, &RepoController::syncEvent,
+            this, &SyncDaemon::onSyncEvent);
+
+    mController.start();
+    log(QString("Running with %1 repos.").arg(mSettings.repos.count()));
+
+    return true;
+}
+
+void SyncDaemon::stop()
+{
+    if (mStopping) {
+        log("Cancelling running refreshes.");
+        mController.cancelAll();
+        return;
+    }
+    mStopping = true;
+    log("Stopping.");
+
+    mController.stop();
+
+    QTimer::singleShot(qMax(0, mArgs.shutdownGraceSecs) * 1000, this, [=]()
+    {
+        if (mController.isRefreshing()) {
+            log("Grace period passed. Cancelling running refreshes.");
+            mController.cancelAll();
+        }
+    });
+
+    quitIfDone();
+}
+
+void SyncDaemon::openLogFile()
+{
+    if (mArgs.logFile.isEmpty()) { return; }
+
+    if (mLogFile.isOpen()) {
+        mLogFile.close();
+    }
+    mLogFile.setFileName(mArgs.logFile);
+    mLogFile.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text);
+}
+
+void SyncDaemon::log(QString msg)
+{
+    QString line = QString("%1 %2\n")
+            .arg(QDateTime::currentDateTime().toString(Qt::ISODate), msg);
+    if (mLogFile.isOpen()) {
+        mLogFile.write(line.toUtf8());
+        mLogFile.flush();
+    } else {
+        std::cout << line.toStdString() << std::flush;
+    }
+}
+
+bool SyncDaemon::setupSignalHandlers()
+{
+#ifdef Q_OS_UNIX
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, sSignalFds) != 0) {
+        return false;
+    }
+    mSignalNotifier = new QSocketNotifier(sSignalFds[1], QSocketNotifier::Read,
+                                          this);
+    connect(mSignalNotifier, &QSocketNotifier::activated,
+            this, &SyncDaemon::onSignalReadable);
+
+    struct sigaction action = {};
+    action.sa_handler = SyncDaemon::onSignal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    foreach (int sig, QList<int>({SIGTERM, SIGINT, SIGHUP})) {
+        if (sigaction(sig, &action, nullptr) != 0) {
+            return false;
+        }
+    }
+#endif
+    return true;
+}
+
+void SyncDaemon::onSignal(int signal)
+{
+#ifdef Q_OS_UNIX
+    char c = char(signal);
+    ssize_t ret = ::write(sSignalFds[0], &c, 1);
+    Q_UNUSED(ret);
+#else
+    Q_UNUSED(signal);
+#endif
+}
+
+void SyncDaemon::onSignalReadable()
+{
+#ifdef Q_OS_UNIX
+    char c = 0;
+    if (::read(sSignalFds[1], &c, 1) != 1) { return; }
+
+    if (c == SIGHUP) {
+        log("Reopening log file.");
+        openLogFile();
+    } else {
+        stop();
+    }
+#endif
+}
+
+void SyncDaemon::onSyncEvent(SyncEngine::Event event)
+{
+    QString name = event.repo->name;
+
+    switch (event.type) {
+    case SyncEngine::Event::Started:
+        log(name + ": Refresh started");
+        break;
+    case SyncEngine::Event::Log:
+        log(name + ": " + event.text);
+        break;
+    case SyncEngine::Event::Error:
+        log(name + ": " + event.text);
+        if (!event.detail.isEmpty()) {
+            log(name + ": " + event.detail);
+        }
+        break;
+    case SyncEngine::Event::Finished:
+        log(QString("%1: Refresh %2 in %3 ms")
+                .arg(name)
+                .arg(event.ok ? "done" : "failed")
+                .arg(event.durationMsecs));
+        if (mStopping) {
+            quitIfDone();
+        } else {
+            RepoController::RepoPtr repo = mController.repo(event.repo);
+            if (repo && repo->retrying) {
+                log(QString("%1: Network error. Retry %2 in %3 secs.")
+                        .arg(name).arg(repo->retryCount)
+                        .arg(mController.remainingTime(repo) / 1000));
+            }
+        }
+        break;
+    case SyncEngine::Event::BranchInfo:
+    case SyncEngine::Event::WakeUp:
+        break;
+    }
+}
+
+void SyncDaemon::quitIfDone()
+{
+    if (mController.isRefreshing()) { return; }
+
+    mController.saveCache();
+    log("Stopped.");
+    QCoreApplication::quit();
+}
@@ -0,0 +1,89 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* SyncDaemon
+ *
+ * Runs the auto-refresh of all repos in the settings without any GUI, for
+ * servers and containers without a display (gid-sync --daemon).
+ *
+ * Uses the same settings file, repo cache and refresh scheduling as the main
+ * window (see RepoController): timers, file watching, adaptive intervals and
+ * retries after network errors. Only needs a QCoreApplication. The settings
+ * are only read, never written.
+ *
+ * Log lines go to stdout, or to a log file if set. On SIGHUP the log file is
+ * reopened (e.g. after logrotate). On SIGTERM or SIGINT, no new refreshes are
+ * started and the daemon quits once the running ones are done, or once the
+ * grace period has passed, in which case they are cancelled. A second signal
+ * cancels them right away.
+ */
+
+#ifndef SYNCDAEMON_H
+#define SYNCDAEMON_H
+
+#include "repocontroller.h"
+#include "settings.h"
+
+#include <QFile>
+#include <QObject>
+#include <QSocketNotifier>
+
+class SyncDaemon : public QObject
+{
+    Q_OBJECT
+public:
+    struct Args {
+        // Empty for stdout
+        QString logFile;
+        int shutdownGraceSecs = 30;
+    };
+
+    explicit SyncDaemon(Args args, QObject *parent = nullptr);
+
+    // Load the settings and start refreshing. Returns false if the daemon
+    // can't run, after logging why.
+    bool start();
+
+    // Stop gracefully, see above. QCoreApplication quits when done.
+    void stop();
+
+private:
+    Args mArgs;
+    Settings mSettings;
+    RepoController mController;
+    bool mStopping = false;
+
+    QFile mLogFile;
+    void openLogFile();
+    void log(QString msg);
+
+    // Signals are passed from the handler to the event loop through a
+    // socket pair, as hardly anything may be done in a signal handler.
+    static int sSignalFds[2];
+    QSocketNotifier* mSignalNotifier = nullptr;
+    bool setupSignalHandlers();
+    static void onSignal(int signal);
+    void onSignalReadable();
+
+    void onSyncEvent(SyncEngine::Event event);
+    void quitIfDone();
+};
+
+#endif // SYNCDAEMON_H
@@ -0,0 +1,1183 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "syncengine.h"
+
+#include <QDateTime>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QRegularExpression>
+
+SyncEngine::SyncEngine()
+{
+    mClock.start();
+    // One extra thread for the slot reserved for manual refreshes
+    mPool.setMaxThreadCount(mMaxParallel + 1);
+}
+
+SyncEngine::~SyncEngine()
+{
+    {
+        QMutexLocker locker(&mMutex);
+        mPending.clear();
+        mQueue.clear();
+        mParked.clear();
+        foreach (JobPtr job, mRunning) {
+            job->cancelToken->cancel();
+        }
+    }
+    mPool.waitForDone();
+}
+
+void SyncEngine::setEventCallback(EventCallback callback)
+{
+    QMutexLocker locker(&mMutex);
+    mEventCallback = callback;
+}
+
+void SyncEngine::setMaxParallel(int count)
+{
+    {
+        QMutexLocker locker(&mMutex);
+        mMaxParallel = qMax(1, count);
+        mPool.setMaxThreadCount(mMaxParallel + 1);
+    }
+    // More slots may be available now
+    dispatch();
+}
+
+int SyncEngine::maxParallel()
+{
+    QMutexLocker locker(&mMutex);
+    return mMaxParallel;
+}
+
+void SyncEngine::setOurName(QString name)
+{
+    QMutexLocker locker(&mMutex);
+    mOurName = name;
+}
+
+void SyncEngine::setNetworkTimeout(int msecs)
+{
+    QMutexLocker locker(&mMutex);
+    mNetworkTimeoutMsecs = msecs;
+}
+
+void SyncEngine::setFsmonitorHook(QString command)
+{
+    QMutexLocker locker(&mMutex);
+    mFsmonitorHook = command;
+}
+
+void SyncEngine::setTracer(TracerPtr tracer)
+{
+    QMutexLocker locker(&mMutex);
+    mTracer = tracer;
+}
+
+void SyncEngine::setSshCommand(QString command)
+{
+    QMutexLocker locker(&mMutex);
+    mSshCommand = command;
+}
+
+void SyncEngine::setGitBackendFactory(GitBackendFactory factory)
+{
+    QMutexLocker locker(&mMutex);
+    mGitBackendFactory = factory;
+}
+
+bool SyncEngine::refresh(Settings::RepoPtr repo)
+{
+    Request request;
+    request.repo = repo;
+    return refresh(request);
+}
+
+bool SyncEngine::refresh(Request request)
+{
+    Settings::RepoPtr repo = request.repo;
+
+    {
+        QMutexLocker locker(&mMutex);
+
+        if (mRunning.contains(repo)) { return false; }
+
+        JobPtr queued = mPending.value(repo);
+        if (queued) {
+            // Already queued. Move it up if this request is more urgent.
+            if (!request.worktreeUnchanged) {
+                queued->worktreeUnchanged = false;
+            }
+            queued->priority = qMin(queued->priority, request.priority);
+            // A job set aside for its host is not in the queue. Put it back,
+            // so a manual refresh is not held back by the host limits.
+            if (mParked.contains(queued->host)
+                    && mParked[queued->host].removeAll(queued)) {
+                if (mParked[queued->host].isEmpty()) {
+                    mParked.remove(queued->host);
+                }
+            }
+            mQueue.enqueue(repo, queued->priority);
+            locker.unlock();
+            // May now be allowed to use the manual slot
+            dispatch();
+            return false;
+        }
+
+        // Host for the per host limits. The remote URL is only known for sure
+        // once the job runs, so use the last known one. Without one, the repo
+        // is not limited. Git is not asked here, as this is the caller's
+        // thread.
+        QString host = HostLimiter::hostOfUrl(request.cache.remoteUrl);
+
+        JobPtr job(new Job());
+        job->repo = repo;
+        // Copy what is needed so the worker thread does not have to touch
+        // the settings.
+        job->name = repo->name;
+        job->path = repo->path;
+        job->ourName = mOurName;
+        job->cache = request.cache;
+        job->worktreeUnchanged = request.worktreeUnchanged;
+        if (request.fsmonitor) {
+            job->fsmonitorHook = mFsmonitorHook;
+        }
+        job->cancelToken.reset(new Git::CancelToken());
+        job->host = host;
+        job->sshCommand = mSshCommand;
+        job->priority = request.priority;
+        job->tracer = mTracer;
+        if (mGitBackendFactory) {
+            job->gitBackend = mGitBackendFactory();
+        }
+        if (job->tracer) {
+            job->queuedUsecs = job->tracer->nowUsecs();
+        }
+        mPending.insert(repo, job);
+        mQueue.enqueue(repo, request.priority);
+    }
+
+    dispatch();
+    return true;
+}
+
+bool SyncEngine::isRefreshing(Settings::RepoPtr repo)
+{
+    QMutexLocker locker(&mMutex);
+
+    return mPending.contains(repo) || mRunning.contains(repo);
+}
+
+int SyncEngine::queuedCount()
+{
+    QMutexLocker locker(&mMutex);
+    return mPending.count();
+}
+
+int SyncEngine::runningCount()
+{
+    QMutexLocker locker(&mMutex);
+    return mRunning.count();
+}
+
+void SyncEngine::cancel(Settings::RepoPtr repo)
+{
+    QList<JobPtr> removed;
+    {
+        QMutexLocker locker(&mMutex);
+
+        JobPtr job = mPending.take(repo);
+        if (job) {
+            mQueue.remove(repo);
+            removed.append(job);
+        }
+        job = mRunning.value(repo);
+        if (job) {
+            job->cancelToken->cancel();
+        }
+    }
+
+    // Queued jobs never started, so finish them here
+    foreach (JobPtr job, removed) {
+        finishCancelled(job);
+    }
+}
+
+void SyncEngine::cancelAll()
+{
+    QList<JobPtr> removed;
+    {
+        QMutexLocker locker(&mMutex);
+
+        removed = mPending.values();
+        mPending.clear();
+        mQueue.clear();
+        mParked.clear();
+        foreach (JobPtr job, mRunning) {
+            job->cancelToken->cancel();
+        }
+    }
+
+    foreach (JobPtr job, removed) {
+        finishCancelled(job);
+    }
+}
+
+void SyncEngine::waitForDone()
+{
+    forever {
+        mPool.waitForDone();
+        QMutexLocker locker(&mMutex);
+        if (mPending.isEmpty() && mRunning.isEmpty()) { break; }
+    }
+}
+
+void SyncEngine::setHostLimits(int maxConcurrent, double perMinute, int burst)
+{
+    {
+        QMutexLocker locker(&mMutex);
+        mHosts.setMaxConcurrent(maxConcurrent);
+        mHosts.setRate(perMinute, burst);
+        unparkAll();
+    }
+    dispatch();
+}
+
+void SyncEngine::wakeUp()
+{
+    {
+        QMutexLocker locker(&mMutex);
+        mWakeUpAtMsecs = -1;
+        unparkAll();
+    }
+    dispatch();
+}
+
+void SyncEngine::dispatch()
+{
+    qint64 wakeUpMsecs = -1;
+    {
+        QMutexLocker locker(&mMutex);
+
+        // Start queued jobs in order of priority while there are free slots.
+        // Each job runs through all its states in its own worker thread. One
+        // extra slot is reserved for manual refreshes so they do not have to
+        // wait for long running jobs.
+        while (!mQueue.isEmpty()) {
+            bool manual = (mQueue.nextPriority() == RefreshScheduler::Manual);
+            int slots = mMaxParallel + (manual ? 1 : 0);
+            if (mRunning.count() >= slots) { break; }
+
+            Settings::RepoPtr repo = mQueue.takeNext();
+            JobPtr job = mPending.value(repo);
+
+            if (manual) {
+                // The user is waiting for this one, so it is not held back
+                // by the host limits.
+                mHosts.acquireUnlimited(job->host);
+            } else {
+                qint64 wait = mHosts.tryAcquire(job->host);
+                if (wait != 0) {
+                    // Set aside until the host has a free slot or a token.
+                    // Jobs of other hosts can go ahead.
+                    mParked[job->host].append(job);
+                    if ((wait > 0) && ((wakeUpMsecs < 0) || (wait < wakeUpMsecs))) {
+                        wakeUpMsecs = wait;
+                    }
+                    continue;
+                }
+            }
+
+            mPending.remove(repo);
+            mRunning.insert(repo, job);
+            mPool.start([=]()
+            {
+                runJob(job);
+                {
+                    QMutexLocker locker(&mMutex);
+                    mRunning.remove(repo);
+                    mHosts.release(job->host);
+                    unpark(job->host);
+                }
+                // A slot is now free
+                dispatch();
+            });
+        }
+
+        // Only ask for a wake-up if none is due before then already
+        if (wakeUpMsecs > 0) {
+            qint64 at = mClock.elapsed() + wakeUpMsecs;
+            if ((mWakeUpAtMsecs >= mClock.elapsed()) && (mWakeUpAtMsecs <= at)) {
+                wakeUpMsecs = -1;
+            } else {
+                mWakeUpAtMsecs = at;
+            }
+        }
+    }
+
+    if (wakeUpMsecs > 0) {
+        Event e;
+        e.type = Event::WakeUp;
+        e.durationMsecs = wakeUpMsecs;
+        sendEvent(JobPtr(), e);
+    }
+}
+
+void SyncEngine::unpark(QString host)
+{
+    // Back in the queue at their priority. Jobs that were cancelled or
+    // started in the meantime are dropped.
+    foreach (JobPtr job, mParked.take(host)) {
+        if (mPending.value(job->repo) == job) {
+            mQueue.enqueue(job->repo, job->priority);
+        }
+    }
+}
+
+void SyncEngine::unparkAll()
+{
+    foreach (QString host, mParked.keys()) {
+        unpark(host);
+    }
+}
+
+void SyncEngine::runJob(JobPtr job)
+{
+    job->elapsed.start();
+
+    // Created here so the Git process lives in this worker thread
+    job->git.reset(new Git(job->path));
+    job->git->setCancelToken(job->cancelToken);
+    job->git->setFsmonitorHook(job->fsmonitorHook);
+    job->git->setRecordCommandTimes(true);
+    job->git->setTracer(job->tracer);
+    job->git->setBackend(job->gitBackend);
+    if (!job->sshCommand.isEmpty() && !hasOwnSshCommand(job)) {
+        job->git->setSshCommand(job->sshCommand);
+    }
+
+    qint64 traceStart = 0;
+    if (job->tracer) {
+        traceStart = job->tracer->nowUsecs();
+        QJsonObject args;
+        args.insert("repo", job->name);
+        args.insert("priority", int(job->priority));
+        job->tracer->asyncSpan("queued " + job->name, "queue",
+                               quintptr(job.data()), job->queuedUsecs,
+                               traceStart, args);
+    }
+
+    Event e;
+    e.type = Event::Started;
+    sendEvent(job, e);
+
+    while (!job->finished) {
+        if (job->cancelToken->isCancelled()) {
+            logError(job, "Refresh cancelled.");
+            refresh_errorNext(job);
+            break;
+        }
+        QElapsedTimer stageTimer;
+        stageTimer.start();
+        int stateIndex = job->state;
+        qint64 stageTraceStart = job->tracer ? job->tracer->nowUsecs() : 0;
+        Event::Stage stage;
+        stage.state = stateName(job->state);
+        processJobState(job);
+        stage.msecs = stageTimer.elapsed();
+        job->stages.append(stage);
+        if (job->tracer) {
+            QJsonObject args;
+            args.insert("repo", job->name);
+            args.insert("state", stateIndex);
+            job->tracer->complete(stage.state, "state",
+                                  stageTraceStart, args);
+        }
+    }
+
+    qint64 msecs = job->elapsed.elapsed();
+    log(job, QString("Refresh took %1 ms.").arg(msecs));
+
+    e = Event();
+    e.type = Event::Finished;
+    e.ok = job->ok;
+    e.changed = job->changed;
+    e.transient = !job->ok && job->transient;
+    if (!job->ok) {
+        e.text = job->summary;
+        e.detail = job->errorDetail;
+    }
+    e.stages = job->stages;
+    e.bytesFetched = job->bytesFetched;
+    e.bytesPushed = job->bytesPushed;
+    foreach (Git::CommandTime t, job->git->takeCommandTimes()) {
+        Event::Stage command;
+        command.state = "git " + t.name;
+        command.msecs = t.msecs;
+        e.commands.append(command);
+    }
+    if (!job->stages.isEmpty()) {
+        e.state = job->stages.last().state;
+    }
+    e.durationMsecs = msecs;
+    e.cache = updatedCache(job, msecs);
+
+    if (job->tracer) {
+        QJsonObject args;
+        args.insert("repo", job->name);
+        args.insert("path", job->path);
+        args.insert("ok", job->ok);
+        args.insert("queueWaitMsecs",
+                    (traceStart - job->queuedUsecs) / 1000.0);
+        job->tracer->complete("refresh " + job->name, "refresh",
+                              traceStart, args);
+    }
+
+    sendEvent(job, e);
+
+    job->git.reset();
+}
+
+void SyncEngine::processJobState(JobPtr job)
+{
+    switch (job->state) {
+    case StateInit:
+        refresh_init(job);
+        break;
+    case StateOngoingOps:
+        refresh_ongoingOps(job);
+        break;
+    case StateBranchRemoteInfo:
+        refresh_branchRemoteInfo(job);
+        break;
+    case StateCommit:
+        refresh_commit(job);
+        break;
+    case StateProbe:
+        refresh_probe(job);
+        break;
+    case StateFetch:
+        refresh_fetch(job);
+        break;
+    case StateCompare:
+        refresh_compare(job);
+        break;
+    case StateCompareAfterRebase:
+        refresh_compareAfterRebase(job);
+        break;
+    case StatePushAfterRebase:
+        refresh_pushAfterRebase(job);
+        break;
+    default:
+        logError(job, QString("Invalid refresh state: %1").arg(job->state));
+        refresh_errorNext(job);
+        break;
+    }
+}
+
+QString SyncEngine::stateName(int state)
+{
+    switch (state) {
+    case StateInit: return "init";
+    case StateOngoingOps: return "ongoingOps";
+    case StateBranchRemoteInfo: return "branchRemoteInfo";
+    case StateCommit: return "commit";
+    case StateProbe: return "probe";
+    case StateFetch: return "fetch";
+    case StateCompare: return "compare";
+    case StateCompareAfterRebase: return "compareAfterRebase";
+    case StatePushAfterRebase: return "pushAfterRebase";
+    }
+    return QString("state%1").arg(state);
+}
+
+bool SyncEngine::hasOwnSshCommand(JobPtr job)
+{
+    // GIT_SSH_COMMAND overrides core.sshCommand, so a wrong answer breaks
+    // the user's setup. Git itself is asked, as the setting may come from a
+    // file the native reader doesn't know about. The answer is kept until
+    // one of the config files changes. If those are not known, Git is asked
+    // every time.
+    QStringList files = job->git->configFiles();
+    QString stamp;
+    foreach (QString file, files) {
+        QFileInfo info(file);
+        stamp += QString("%1:%2:%3;").arg(file)
+                     .arg(info.lastModified().toMSecsSinceEpoch())
+                     .arg(info.size());
+    }
+
+    if (!files.isEmpty()) {
+        QMutexLocker locker(&mMutex);
+        if (mSshConfigs.contains(job->path)
+                && (mSshConfigs.value(job->path).configStamp == stamp)) {
+            return mSshConfigs.value(job->path).hasSshCommand;
+        }
+    }
+
+    Git::Output out = job->git->runGit("config --get core.sshCommand");
+    // Exit code 1 means not set. On other errors, leave the repo alone and
+    // ask again next time.
+    if ((out.exitcode != 0) && (out.exitcode != 1)) { return true; }
+
+    SshConfig config;
+    config.configStamp = stamp;
+    config.hasSshCommand = (out.exitcode == 0);
+    if (!files.isEmpty()) {
+        QMutexLocker locker(&mMutex);
+        mSshConfigs.insert(job->path, config);
+    }
+    return config.hasSshCommand;
+}
+
+void SyncEngine::finishCancelled(JobPtr job)
+{
+    logError(job, "Refresh cancelled.");
+
+    Event e;
+    e.type = Event::Finished;
+    e.ok = false;
+    e.text = job->summary;
+    e.cache = job->cache;
+    e.cache.headSha.clear();
+    sendEvent(job, e);
+}
+
+int SyncEngine::networkTimeout()
+{
+    QMutexLocker locker(&mMutex);
+    return mNetworkTimeoutMsecs;
+}
+
+Git::Output SyncEngine::runNetworkGit(JobPtr job, QString arguments)
+{
+    Git& git = *job->git;
+    int lastTimeout = git.timeout();
+    git.setTimeout(networkTimeout());
+    Git::Output out = git.runGit(arguments);
+    git.setTimeout(lastTimeout);
+
+    // Fetch and push are run with --progress for the transfer size
+    if (arguments.startsWith("fetch")) {
+        job->bytesFetched += transferredBytes(out.erroroutput,
+                                              "Receiving objects:");
+    } else if (arguments.startsWith("push")) {
+        job->bytesPushed += transferredBytes(out.erroroutput,
+                                             "Writing objects:");
+    }
+    out.erroroutput = withoutProgress(out.erroroutput);
+
+    if (out.hasError) {
+        job->transient = isTransientError(out);
+    }
+
+    return out;
+}
+
+qint64 SyncEngine::transferredBytes(const QByteArray& progress, QString phase)
+{
+    // E.g. "Receiving objects: 100% (12/12), 1.50 MiB | 3.00 MiB/s, done."
+    // Small transfers may have no size at all.
+    QString s = QString::fromUtf8(progress);
+    int start = s.lastIndexOf(phase);
+    if (start < 0) { return 0; }
+    int end = s.indexOf(QRegularExpression("[\\r\\n]"), start);
+    QString line = s.mid(start, (end < 0) ? -1 : end - start);
+
+    static const QRegularExpression re(",\\s*([0-9.]+)\\s*(bytes?|KiB|MiB|GiB)");
+    QRegularExpressionMatch m = re.match(line);
+    if (!m.hasMatch()) { return 0; }
+
+    double value = m.captured(1).toDouble();
+    QString unit = m.captured(2);
+    if (unit == "KiB") { value *= 1024; }
+    else if (unit == "MiB") { value *= 1024 * 1024; }
+    else if (unit == "GiB") { value *= 1024 * 1024 * 1024; }
+    return qint64(value);
+}
+
+QByteArray SyncEngine::withoutProgress(const QByteArray& output)
+{
+    // Progress lines are updated in place with carriage returns. Only keep
+    // the final state of each line.
+    QList<QByteArray> lines = output.split('\n');
+    for (int i = 0; i < lines.count(); i++) {
+        QByteArray line = lines.at(i);
+        while (line.endsWith('\r')) {
+            line.chop(1);
+        }
+        lines[i] = line.mid(line.lastIndexOf('\r') + 1);
+    }
+    return lines.join('\n');
+}
+
+bool SyncEngine::isTransientError(const Git::Output& out)
+{
+    if (out.cancelled) { return false; }
+    if (out.timedOut) { return true; }
+
+    QString error = QString::fromUtf8(out.erroroutput).toLower();
+
+    // Needs the user to fix something. Checked first since e.g. an
+    // authentication failure also ends with a generic "could not read".
+    static const QStringList permanent {
+        "authentication failed",
+        "permission denied",
+        "could not read username",
+        "could not read password",
+        "host key verification failed",
+        "repository not found",
+        "does not appear to be a git repository",
+        "couldn't find remote ref",
+        "returned error: 401",
+        "returned error: 403",
+        "returned error: 404",
+        "conflict"
+    };
+    foreach (QString s, permanent) {
+        if (error.contains(s)) { return false; }
+    }
+
+    static const QStringList transient {
+        "could not resolve host",
+        "temporary failure in name resolution",
+        "name or service not known",
+        "connection refused",
+        "connection timed out",
+        "operation timed out",
+        "connection reset",
+        "network is unreachable",
+        "no route to host",
+        "the remote end hung up unexpectedly",
+        "early eof",
+        "returned error: 5",  // HTTP 5xx
+        "gnutls_handshake",
+        "ssl_connect",
+        // Push raced with another client. The next refresh fetches first.
+        "(fetch first)"
+    };
+    foreach (QString s, transient) {
+        if (error.contains(s)) { return true; }
+    }
+
+    return false;
+}
+
+QString SyncEngine::remoteTrackingRef(JobPtr job)
+{
+    return QString("refs/remotes/%1/%2").arg(job->remote, job->branch);
+}
+
+bool SyncEngine::canSkipStatus(JobPtr job)
+{
+    const RepoCache::Entry& cache = job->cache;
+    if (!job->worktreeUnchanged || !cache.lastOk || cache.headSha.isEmpty()) {
+        return false;
+    }
+
+    // Anything staged, committed or checked out since the last refresh
+    // changes the index or HEAD.
+    Git& git = *job->git;
+    QFileInfo index(git.gitDir() + "/index");
+    if (    (index.lastModified().toMSecsSinceEpoch() != cache.indexMtimeMsecs)
+         || (index.size() != cache.indexSize) )
+    {
+        return false;
+    }
+
+    return git.resolveRef("HEAD").result == cache.headSha;
+}
+
+QStringList SyncEngine::changedPaths(const Git::Status& status)
+{
+    QStringList paths;
+    foreach (const Git::StatusEntry& entry, status.entries) {
+        paths.append(entry.path);
+        // The old path of a rename must be staged as deleted
+        if (!entry.origPath.isEmpty()) {
+            paths.append(entry.origPath);
+        }
+    }
+    return paths;
+}
+
+RepoCache::Entry SyncEngine::updatedCache(JobPtr job, qint64 durationMsecs)
+{
+    RepoCache::Entry cache = job->cache;
+    cache.lastRefresh = QDateTime::currentDateTime();
+    cache.lastOk = job->ok;
+    cache.lastSummary = job->summary;
+    cache.lastDurationMsecs = durationMsecs;
+    if (!job->branch.isEmpty()) {
+        cache.branch = job->branch;
+        cache.remote = job->remote;
+        cache.remoteUrl = job->remoteUrl;
+    }
+
+    if (job->ok) {
+        Git& git = *job->git;
+        cache.headSha = git.resolveRef("HEAD").result;
+        QFileInfo index(git.gitDir() + "/index");
+        cache.indexMtimeMsecs = index.lastModified().toMSecsSinceEpoch();
+        cache.indexSize = index.size();
+    } else {
+        // Nothing may be skipped after a failed refresh
+        cache.headSha.clear();
+    }
+
+    return cache;
+}
+
+Git::Result<Git::Compare> SyncEngine::compareWithRemote(JobPtr job)
+{
+    QString remoteBranch = QString("%1/%2").arg(job->remote, job->branch);
+
+    // The status snapshot already has the ahead/behind counts if its upstream
+    // is the remote branch and fetching did not move it.
+    Git::Result<Git::Compare> ret;
+    if (!job->remoteTipChanged
+            && (job->status.upstream == remoteBranch)
+            && job->status.compareWithUpstream(&ret.result))
+    {
+        return ret;
+    }
+
+    return job->git->compareWithHead(remoteBranch);
+}
+
+void SyncEngine::sendEvent(JobPtr job, Event event)
+{
+    EventCallback callback;
+    {
+        QMutexLocker locker(&mMutex);
+        callback = mEventCallback;
+    }
+
+    if (job) {
+        event.repo = job->repo;
+    }
+    if (callback) {
+        callback(event);
+    }
+}
+
+void SyncEngine::log(JobPtr job, QString line)
+{
+    Event e;
+    e.type = Event::Log;
+    e.text = line;
+    sendEvent(job, e);
+}
+
+void SyncEngine::logError(JobPtr job, QString summary, QString errorString)
+{
+    job->summary = summary;
+    job->errorDetail = errorString;
+
+    Event e;
+    e.type = Event::Error;
+    e.text = summary;
+    e.detail = errorString;
+    sendEvent(job, e);
+}
+
+void SyncEngine::refresh_successNext(JobPtr job)
+{
+    job->ok = true;
+    job->finished = true;
+}
+
+void SyncEngine::refresh_errorNext(JobPtr job)
+{
+    job->ok = false;
+    job->finished = true;
+}
+
+void SyncEngine::refresh_nextState(JobPtr job)
+{
+    job->state++;
+}
+
+void SyncEngine::refresh_gotoState(JobPtr job, State state)
+{
+    job->state = state;
+}
+
+void SyncEngine::refresh_init(JobPtr job)
+{
+    log(job, QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss"));
+
+    if (job->path.isEmpty()) {
+        logError(job, "Path empty");
+        refresh_errorNext(job);
+        return;
+    }
+
+    Git& git = *job->git;
+    if (!git.pathIsRepo().result) {
+        logError(job, "Path is not a Git repo.");
+        refresh_errorNext(job);
+        return;
+    }
+
+    refresh_nextState(job);
+}
+
+void SyncEngine::refresh_ongoingOps(JobPtr job)
+{
+    Git& git = *job->git;
+    int ongoingOp = git.getOngoingOperationState();
+    if (ongoingOp != Git::OpNone) {
+        QStringList ops;
+        if (ongoingOp & Git::OpRebase) { ops.append("rebase"); }
+        if (ongoingOp & Git::OpMerge) { ops.append("merge"); }
+        if (ongoingOp & Git::OpCherryPick) { ops.append("cherry-pick"); }
+        if (ongoingOp & Git::OpBisect) { ops.append("bisect"); }
+        if (ops.isEmpty()) { ops.append("unknown"); }
+
+        logError(job, QString("Unsafe to sync, operation ongoing: %1.")
+                          .arg(ops.join(", ")));
+        refresh_errorNext(job);
+        return;
+    }
+
+    refresh_nextState(job);
+}
+
+void SyncEngine::refresh_branchRemoteInfo(JobPtr job)
+{
+    // Get current branch name
+    Git& git = *job->git;
+    Git::Result<QString> s = git.currentBranch();
+    if (!s.gitOutput.hasError) {
+        log(job, "Detected current branch: " + s.result);
+        job->branch = s.result;
+    } else {
+        logError(job, "Could not detect current branch. Possibly detached head.",
+                 s.gitOutput.toString());
+        refresh_errorNext(job);
+        return;
+    }
+
+    // TODO: Could detect remote to use here
+    job->remote = "origin";
+
+    // Get remote URL
+    Git::Result<QString> url = git.remoteUrl(job->remote);
+    if (url.gitOutput.hasError) {
+        logError(job, QString("Could not get URL for remote: %1. Check if remote exists.")
+                          .arg(job->remote));
+        refresh_errorNext(job);
+        return;
+    }
+
+    Event e;
+    e.type = Event::BranchInfo;
+    e.branch = job->branch;
+    e.remote = job->remote;
+    e.remoteUrl = url.result;
+    job->remoteUrl = url.result;
+    sendEvent(job, e);
+
+    refresh_nextState(job);
+}
+
+void SyncEngine::refresh_commit(JobPtr job)
+{
+    Git& git = *job->git;
+
+    if (canSkipStatus(job)) {
+        log(job, "Repo has not been modified locally since last refresh.");
+        job->status = Git::Status();
+        job->status.oid = job->cache.headSha;
+        job->status.branch = job->branch;
+        refresh_nextState(job);
+        return;
+    }
+
+    Git::Result<Git::Status> st = git.statusSnapshot();
+    if (st.gitOutput.hasError) {
+        logError(job, "Git error occurred while checking if repo is modified",
+                 st.gitOutput.toString());
+        refresh_errorNext(job);
+        return;
+    }
+    job->status = st.result;
+
+    if (!job->status.isModified()) {
+        log(job, "Repo has not been modified locally.");
+    } else {
+        log(job, "Repo has been modified locally.");
+
+        Git::Output out;
+
+        // Stage only the changed paths from the status snapshot so Git does
+        // not have to scan the whole work tree again. Fall back to adding
+        // everything if there are very many.
+        QStringList paths = changedPaths(job->status);
+        if (paths.count() <= maxAddPaths) {
+            out = git.addPaths(paths);
+            if (out.hasError) {
+                // E.g. Git older than 2.25 without --pathspec-from-file
+                log(job, "Adding changed paths failed, adding all instead.");
+            }
+        }
+        if ((paths.count() > maxAddPaths) || out.hasError) {
+            out = git.runGit("add -A");
+        }
+        if (out.hasError) {
+            logError(job, "Git error occurred while adding all",
+                     out.toString());
+            refresh_errorNext(job);
+            return;
+        }
+
+        // Commit
+        log(job, "Committing local changes...");
+        QString ourName = job->ourName;
+        ourName = ourName.replace("\"", "\\\"");
+        QString args = QString("commit -m \"Changes from %1\"").arg(ourName);
+        out = git.runGit(args);
+        if (out.hasError) {
+            logError(job, "Git error occurred while committing",
+                     out.toString());
+            refresh_errorNext(job);
+            return;
+        }
+
+        // Confirm that repo is now unmodified. The new snapshot also has the
+        // ahead count including the new commit.
+        st = git.statusSnapshot();
+        if (st.gitOutput.hasError) {
+            logError(job, "Git error occurred while checking if repo is modified:",
+                     st.gitOutput.toString());
+            refresh_errorNext(job);
+            return;
+        }
+        job->status = st.result;
+        if (job->status.isModified()) {
+            logError(job, "Repo is still unclean after commit.");
+            refresh_errorNext(job);
+            return;
+        } else {
+            log(job, "Repo clean after commit.");
+        }
+        job->changed = true;
+    }
+
+    refresh_nextState(job);
+}
+
+void SyncEngine::refresh_probe(JobPtr job)
+{
+    // Ask the remote for only the tip of the branch. If it matches our
+    // remote-tracking branch, there is nothing to fetch.
+
+    Git& git = *job->git;
+    QString trackingTip = git.resolveRef(remoteTrackingRef(job)).result;
+    if (trackingTip.isEmpty()) {
+        // Never fetched before
+        refresh_nextState(job);
+        return;
+    }
+
+    int lastTimeout = git.timeout();
+    git.setTimeout(networkTimeout());
+    Git::Result<QString> tip = git.remoteRefSha(job->remote,
+                                                "refs/heads/" + job->branch);
+    git.setTimeout(lastTimeout);
+
+    if (tip.gitOutput.hasError) {
+        job->transient = isTransientError(tip.gitOutput);
+        logError(job, "Git error occurred while checking remote.",
+                 tip.gitOutput.toString());
+        refresh_errorNext(job);
+        return;
+    }
+
+    if (tip.result != trackingTip) {
+        log(job, "Remote has changed.");
+        refresh_nextState(job);
+        return;
+    }
+
+    job->remoteTipChanged = false;
+
+    if (job->status.oid == trackingTip) {
+        log(job, "Local and remote unchanged. In sync! Done.");
+        refresh_successNext(job);
+        return;
+    }
+
+    log(job, "Remote unchanged, skipping fetch.");
+    refresh_gotoState(job, StateCompare);
+}
+
+void SyncEngine::refresh_fetch(JobPtr job)
+{
+    log(job, "Fetching...");
+
+    Git& git = *job->git;
+    QString tipBefore = git.resolveRef(remoteTrackingRef(job)).result;
+
+    QString args = QString("fetch --progress %1 %2").arg(job->remote, job->branch);
+    Git::Output out = runNetworkGit(job, args);
+    if (out.hasError) {
+        logError(job, "Git error occurred while fetching.",
+                 out.toString());
+        refresh_errorNext(job);
+        return;
+    }
+
+    QString tipAfter = git.resolveRef(remoteTrackingRef(job)).result;
+    job->remoteTipChanged = tipBefore.isEmpty() || (tipBefore != tipAfter);
+
+    refresh_nextState(job);
+}
+
+void SyncEngine::refresh_compare(JobPtr job)
+{
+    Git::Result<Git::Compare> c = compareWithRemote(job);
+    if (c.gitOutput.hasError) {
+        logError(job, "Git error while comparing:",
+                 c.gitOutput.toString());
+        refresh_errorNext(job);
+        return;
+    }
+
+    if (c.result == Git::Compare::NoUpstream) {
+
+        logError(job, "No relation between remote and HEAD. Aborting.");
+        refresh_errorNext(job);
+        return;
+
+    } else if (c.result == Git::Compare::Equal) {
+
+        log(job, "In sync! Done.");
+        refresh_successNext(job);
+        return;
+
+    } else if (c.result == Git::Compare::Ahead) {
+
+        refresh_ahead(job);
+
+    } else if (c.result == Git::Compare::Behind) {
+
+        refresh_behind(job);
+
+    } else if (c.result == Git::Compare::Diverged) {
+
+        refresh_diverged(job);
+
+    }
+}
+
+void SyncEngine::refresh_ahead(JobPtr job)
+{
+    log(job, "Ahead of remote. Pushing changes...");
+
+    Git::Output out = runNetworkGit(job, QString("push --progress %1 %2:%2")
+                                             .arg(job->remote, job->branch));
+    if (out.hasError) {
+        logError(job, "Git error while pushing:",
+                 out.toString());
+        refresh_errorNext(job);
+        return;
+    }
+    job->changed = true;
+    log(job, "Pushed successfully. In sync! Done.");
+    refresh_successNext(job);
+}
+
+void SyncEngine::refresh_behind(JobPtr job)
+{
+    log(job, "Behind remote. Fast-forwarding...");
+
+    Git& git = *job->git;
+    Git::Output out = git.runGit(QString("merge --ff --ff-only %1/%2")
+                                          .arg(job->remote, job->branch));
+    if (out.hasError) {
+        logError(job, "Git error while merging:",
+                 out.toString());
+        refresh_errorNext(job);
+        return;
+    }
+    job->changed = true;
+    log(job, "Merged successfully. In sync! Done.");
+    refresh_successNext(job);
+}
+
+void SyncEngine::refresh_diverged(JobPtr job)
+{
+    log(job, "Diverged from remote. Rebasing...");
+
+    Git& git = *job->git;
+    Git::Output out = git.runGit(QString("rebase %1/%2")
+                                          .arg(job->remote, job->branch));
+    if (out.hasError) {
+        logError(job, "Git error while rebasing.",
+                 out.toString());
+        log(job, "Rebasing failed. There are likely conflicting changes."
+                 " Resolve them and finish the rebase before trying again.");
+        refresh_errorNext(job);
+        return;
+    }
+    job->changed = true;
+    refresh_nextState(job);
+}
+
+void SyncEngine::refresh_compareAfterRebase(JobPtr job)
+{
+    // Compare again and confirm we are ahead
+    Git& git = *job->git;
+    Git::Result<Git::Compare> c = git.compareWithHead(QString("%1/%2")
+                                            .arg(job->remote, job->branch));
+    if (c.gitOutput.hasError) {
+        logError(job, "Git error while comparing:",
+                 c.gitOutput.toString());
+        refresh_errorNext(job);
+        return;
+    }
+    if (c.result != Git::Compare::Ahead) {
+        logError(job, "We are not ahead."
+                      " Something may have gone wrong with the rebase.");
+        refresh_errorNext(job);
+        return;
+    }
+    refresh_nextState(job);
+}
+
+void SyncEngine::refresh_pushAfterRebase(JobPtr job)
+{
+    log(job, "We are ahead. Rebase went fine. Pushing...");
+
+    Git::Output out = runNetworkGit(job, QString("push --progress %1 %2:%2")
+                                             .arg(job->remote, job->branch));
+    if (out.hasError) {
+        logError(job, "Git error while pushing:",
+                 out.toString());
+        refresh_errorNext(job);
+        return;
+    }
+    log(job, "Pushed successfully. In sync! Done.");
+    refresh_successNext(job);
+}
@@ -0,0 +1,309 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* SyncEngine
+ *
+ * Runs the repo refresh (sync) state machine without any GUI.
+ *
+ * Refresh jobs are queued with refresh() and run on a pool of worker threads,
+ * with at most maxParallel() jobs running at the same time and at most one job
+ * per repo. Queued jobs are started in order of priority (see
+ * RefreshScheduler), and one extra slot is kept free for manual refreshes.
+ * Jobs are also subject to per remote host limits (see HostLimiter). Jobs
+ * waiting for their host are set aside so jobs of other hosts can go ahead.
+ * A job runs through all of its states in the worker thread, so the
+ * Git commands never block the caller's thread.
+ *
+ * Progress is reported through the event callback. The callback is called
+ * from the worker threads, so the receiver is responsible for moving the
+ * events to the thread it wants to handle them in (e.g. with
+ * ThreadWorker::doInGuiThread).
+ * Events of a single job are always reported in order.
+ */
+
+#ifndef SYNCENGINE_H
+#define SYNCENGINE_H
+
+#include "git.h"
+#include "hostlimiter.h"
+#include "refreshscheduler.h"
+#include "repocache.h"
+#include "settings.h"
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QSharedPointer>
+#include <QThreadPool>
+
+#include <functional>
+
+class SyncEngine
+{
+public:
+    SyncEngine();
+    ~SyncEngine();
+
+    struct Event
+    {
+        enum Type {
+            Started,    // Job started running
+            Log,        // text: log line
+            Error,      // text: error summary, detail: error string
+            BranchInfo, // branch, remote and remoteUrl detected
+            WakeUp,     // No repo. Call wakeUp() after durationMsecs so jobs
+                        // waiting for the host rate limit can start.
+            Finished    // ok: success, changed: changes were synced,
+                        // transient: failed due to a network error that
+                        // may go away by itself,
+                        // text, detail: last error if failed,
+                        // state: name of the last state run,
+                        // stages: time spent per state,
+                        // commands: time of each Git command run,
+                        // bytesFetched, bytesPushed: transfer sizes,
+                        // durationMsecs: run duration,
+                        // cache: updated cache entry
+        };
+        struct Stage
+        {
+            QString state;
+            qint64 msecs = 0;
+        };
+        Type type = Log;
+        Settings::RepoPtr repo;
+        QString text;
+        QString detail;
+        QString branch;
+        QString remote;
+        QString remoteUrl;
+        bool ok = false;
+        bool changed = false;
+        bool transient = false;
+        QString state;
+        QList<Stage> stages;
+        QList<Stage> commands;
+        qint64 bytesFetched = 0;
+        qint64 bytesPushed = 0;
+        qint64 durationMsecs = 0;
+        RepoCache::Entry cache;
+    };
+    typedef std::function<void(Event)> EventCallback;
+
+    struct Request
+    {
+        Settings::RepoPtr repo;
+        // Cache entry from the previous refresh, if any. Its remote URL
+        // decides the host for the per host limits.
+        RepoCache::Entry cache;
+        // Set if the work tree is watched and has not changed since the
+        // previous refresh. Together with an unchanged index and HEAD this
+        // allows skipping git status.
+        bool worktreeUnchanged = false;
+        // Set if the fsmonitor hook can answer for this repo
+        bool fsmonitor = false;
+        RefreshScheduler::Priority priority = RefreshScheduler::Timer;
+    };
+
+    // Note: callback is called from the worker threads.
+    void setEventCallback(EventCallback callback);
+
+    void setMaxParallel(int count);
+    int maxParallel();
+
+    // Name used in commit messages
+    void setOurName(QString name);
+
+    // Per remote host: maximum refreshes at the same time (zero for no limit)
+    // and token bucket rate limit of refreshes started per minute (zero for
+    // no limit). Manual refreshes are not limited.
+    void setHostLimits(int maxConcurrent, double perMinute, int burst);
+    void wakeUp();
+
+    // Timeout for commands talking to the remote (fetch, push). Other commands
+    // use Git::defaultTimeoutMsecs.
+    void setNetworkTimeout(int msecs);
+
+    // Hook command passed to Git as core.fsmonitor for requests with
+    // fsmonitor set. See FsMonitor.
+    void setFsmonitorHook(QString command);
+
+    // Write jobs, their states and Git commands to the trace. Null to stop.
+    void setTracer(TracerPtr tracer);
+
+    // Command Git uses to run ssh, e.g. for connection sharing (see SshMux).
+    // Not used for repos with core.sshCommand configured, as reported by
+    // git config.
+    void setSshCommand(QString command);
+
+    // Called for each new job to get the backend for its Git commands (see
+    // GitBackend), e.g. to record or replay them. Empty or returning null to
+    // run the commands as usual. Called with the engine locked.
+    typedef std::function<GitBackendPtr()> GitBackendFactory;
+    void setGitBackendFactory(GitBackendFactory factory);
+
+    // Queue a refresh of the repo. Returns false if the repo is already queued
+    // or being refreshed. A queued repo is moved up if the new request has a
+    // higher priority.
+    bool refresh(Request request);
+    bool refresh(Settings::RepoPtr repo);
+    bool isRefreshing(Settings::RepoPtr repo);
+    // Jobs waiting to start and jobs running
+    int queuedCount();
+    int runningCount();
+
+    // Stop the refresh of the repo. A queued job is removed and a running job
+    // has its current Git command stopped. Both finish with an error.
+    void cancel(Settings::RepoPtr repo);
+    void cancelAll();
+
+    // Block until all queued and running jobs are done
+    void waitForDone();
+
+private:
+    enum State {
+        StateInit = 0,
+        StateOngoingOps,
+        StateBranchRemoteInfo,
+        StateCommit,
+        StateProbe,
+        StateFetch,
+        StateCompare,
+        StateCompareAfterRebase,
+        StatePushAfterRebase
+    };
+
+    struct Job
+    {
+        Settings::RepoPtr repo;
+        QString name;
+        QString path;
+        QString ourName;
+        int state = 0;
+        bool finished = false;
+        bool ok = false;
+        // Local changes were committed or commits were pushed or pulled
+        bool changed = false;
+        // Failed talking to the remote in a way that is worth retrying
+        bool transient = false;
+        QString summary;
+        QString errorDetail;
+        QList<Event::Stage> stages;
+        QString branch;
+        QString remote;
+        QString remoteUrl;
+        RepoCache::Entry cache;
+        bool worktreeUnchanged = false;
+        QString fsmonitorHook;
+        QString sshCommand;
+        TracerPtr tracer;
+        GitBackendPtr gitBackend;
+        qint64 queuedUsecs = 0;
+        QElapsedTimer elapsed;
+        // Latest status snapshot, taken in refresh_commit
+        Git::Status status;
+        // Whether fetching moved the remote-tracking branch
+        bool remoteTipChanged = true;
+        Git::CancelTokenPtr cancelToken;
+        QString host;
+        RefreshScheduler::Priority priority = RefreshScheduler::Timer;
+        qint64 bytesFetched = 0;
+        qint64 bytesPushed = 0;
+        // Only valid while the job is running, in the job's worker thread
+        QSharedPointer<Git> git;
+    };
+    typedef QSharedPointer<Job> JobPtr;
+
+    QMutex mMutex;
+    EventCallback mEventCallback;
+    int mMaxParallel = 1;
+    QString mOurName;
+    int mNetworkTimeoutMsecs = 2 * 60 * 1000;
+    QString mFsmonitorHook;
+    QString mSshCommand;
+    TracerPtr mTracer;
+    GitBackendFactory mGitBackendFactory;
+    // Whether repos configure core.sshCommand, by path. Asked once per
+    // change of the repo's or the user's config file.
+    struct SshConfig
+    {
+        QString configStamp;
+        bool hasSshCommand = false;
+    };
+    QHash<QString, SshConfig> mSshConfigs;
+    // Jobs waiting for a free slot, in the order given by mQueue
+    QHash<Settings::RepoPtr, JobPtr> mPending;
+    RefreshScheduler mQueue;
+    // Jobs currently running in the pool
+    QHash<Settings::RepoPtr, JobPtr> mRunning;
+    HostLimiter mHosts;
+    // Queued jobs waiting for their host, by host
+    QHash<QString, QList<JobPtr>> mParked;
+    QElapsedTimer mClock;
+    qint64 mWakeUpAtMsecs = -1;
+    QThreadPool mPool;
+
+    void dispatch();
+    void unpark(QString host);
+    void unparkAll();
+    void runJob(JobPtr job);
+    void processJobState(JobPtr job);
+
+    static QString stateName(int state);
+
+    bool hasOwnSshCommand(JobPtr job);
+    void finishCancelled(JobPtr job);
+    int networkTimeout();
+    Git::Output runNetworkGit(JobPtr job, QString arguments);
+    static bool isTransientError(const Git::Output& out);
+    // Size from the progress output of fetch or push for the phase, e.g.
+    // "Receiving objects:". Zero if not found.
+    static qint64 transferredBytes(const QByteArray& progress, QString phase);
+    static QByteArray withoutProgress(const QByteArray& output);
+    QString remoteTrackingRef(JobPtr job);
+    bool canSkipStatus(JobPtr job);
+    // Above this number of changed paths, all changes are added at once
+    static const int maxAddPaths = 10000;
+    static QStringList changedPaths(const Git::Status& status);
+    RepoCache::Entry updatedCache(JobPtr job, qint64 durationMsecs);
+    Git::Result<Git::Compare> compareWithRemote(JobPtr job);
+
+    void sendEvent(JobPtr job, Event event);
+    void log(JobPtr job, QString line);
+    void logError(JobPtr job, QString summary, QString errorString = "");
+
+    void refresh_successNext(JobPtr job);
+    void refresh_errorNext(JobPtr job);
+    void refresh_nextState(JobPtr job);
+    void refresh_gotoState(JobPtr job, State state);
+
+    void refresh_init(JobPtr job);
+    void refresh_ongoingOps(JobPtr job);
+    void refresh_branchRemoteInfo(JobPtr job);
+    void refresh_commit(JobPtr job);
+    void refresh_probe(JobPtr job);
+    void refresh_fetch(JobPtr job);
+    void refresh_compare(JobPtr job);
+    void refresh_ahead(JobPtr job);
+    void refresh_behind(JobPtr job);
+    void refresh_diverged(JobPtr job);
+    void refresh_compareAfterRebase(JobPtr job);
+    void refresh_pushAfterRebase(JobPtr job);
+};
+
+#endif // SYNCENGINE_H
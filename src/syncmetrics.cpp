@@ -0,0 +1,174 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "syncmetrics.h"
+
+#include <QTextStream>
+
+// Seconds. Refreshes range from well under a second to the network timeout.
+const QVector<double> SyncMetrics::durationBuckets =
+        {0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30, 60, 120, 300};
+
+void SyncMetrics::addRefresh(QString path, const SyncEngine::Event& event)
+{
+    double secs = event.durationMsecs / 1000.0;
+    Histogram& h = mDurations[path];
+    if (h.counts.isEmpty()) {
+        h.counts.resize(durationBuckets.count());
+    }
+    for (int i = 0; i < durationBuckets.count(); i++) {
+        if (secs <= durationBuckets.at(i)) {
+            h.counts[i]++;
+            break;
+        }
+    }
+    h.count++;
+    h.sum += secs;
+
+    if (event.ok) {
+        mRefreshesOk[path]++;
+    } else {
+        mRefreshesFailed[path]++;
+    }
+    foreach (SyncEngine::Event::Stage command, event.commands) {
+        mGitProcesses[command.state]++;
+    }
+    mFetchedBytes[path] += event.bytesFetched;
+    mPushedBytes[path] += event.bytesPushed;
+}
+
+void SyncMetrics::setLastSuccess(QString path, QDateTime time)
+{
+    mLastSuccess.insert(path, time);
+}
+
+void SyncMetrics::removeRepo(QString path)
+{
+    mDurations.remove(path);
+    mRefreshesOk.remove(path);
+    mRefreshesFailed.remove(path);
+    mFetchedBytes.remove(path);
+    mPushedBytes.remove(path);
+    mLastSuccess.remove(path);
+}
+
+QByteArray SyncMetrics::exposition(QMap<QString, QString> repoNames,
+                                   QMap<QString, int> reposByState,
+                                   int queued, int running)
+{
+    QString s;
+    QTextStream out(&s);
+
+    auto repoLabels = [&](QString path)
+    {
+        return label("repo", repoNames.value(path)) + ","
+               + label("path", path);
+    };
+
+    out << "# HELP gidsync_repos Number of repos per state.\n"
+        << "# TYPE gidsync_repos gauge\n";
+    foreach (QString state, reposByState.keys()) {
+        out << "gidsync_repos{" << label("state", state) << "} "
+            << reposByState.value(state) << "\n";
+    }
+
+    out << "# HELP gidsync_queued_refreshes Refreshes waiting to start.\n"
+        << "# TYPE gidsync_queued_refreshes gauge\n"
+        << "gidsync_queued_refreshes " << queued << "\n";
+    out << "# HELP gidsync_running_refreshes Refreshes running.\n"
+        << "# TYPE gidsync_running_refreshes gauge\n"
+        << "gidsync_running_refreshes " << running << "\n";
+
+    out << "# HELP gidsync_refreshes_total Finished refreshes.\n"
+        << "# TYPE gidsync_refreshes_total counter\n";
+    foreach (QString path, mRefreshesOk.keys()) {
+        out << "gidsync_refreshes_total{" << repoLabels(path) << ","
+            << label("result", "ok") << "} " << mRefreshesOk.value(path) << "\n";
+    }
+    foreach (QString path, mRefreshesFailed.keys()) {
+        out << "gidsync_refreshes_total{" << repoLabels(path) << ","
+            << label("result", "error") << "} "
+            << mRefreshesFailed.value(path) << "\n";
+    }
+
+    out << "# HELP gidsync_refresh_duration_seconds Duration of refreshes.\n"
+        << "# TYPE gidsync_refresh_duration_seconds histogram\n";
+    foreach (QString path, mDurations.keys()) {
+        const Histogram& h = mDurations[path];
+        QString repoLabel = repoLabels(path);
+        quint64 cumulative = 0;
+        for (int i = 0; i < durationBuckets.count(); i++) {
+            cumulative += h.counts.at(i);
+            out << "gidsync_refresh_duration_seconds_bucket{" << repoLabel
+                << "," << label("le", number(durationBuckets.at(i))) << "} "
+                << cumulative << "\n";
+        }
+        out << "gidsync_refresh_duration_seconds_bucket{" << repoLabel
+            << "," << label("le", "+Inf") << "} " << h.count << "\n";
+        out << "gidsync_refresh_duration_seconds_sum{" << repoLabel << "} "
+            << number(h.sum) << "\n";
+        out << "gidsync_refresh_duration_seconds_count{" << repoLabel << "} "
+            << h.count << "\n";
+    }
+
+    out << "# HELP gidsync_git_processes_total Git processes run by refreshes.\n"
+        << "# TYPE gidsync_git_processes_total counter\n";
+    foreach (QString command, mGitProcesses.keys()) {
+        out << "gidsync_git_processes_total{" << label("command", command)
+            << "} " << mGitProcesses.value(command) << "\n";
+    }
+
+    out << "# HELP gidsync_fetched_bytes_total Bytes received by fetch.\n"
+        << "# TYPE gidsync_fetched_bytes_total counter\n";
+    foreach (QString path, mFetchedBytes.keys()) {
+        out << "gidsync_fetched_bytes_total{" << repoLabels(path) << "} "
+            << mFetchedBytes.value(path) << "\n";
+    }
+    out << "# HELP gidsync_pushed_bytes_total Bytes sent by push.\n"
+        << "# TYPE gidsync_pushed_bytes_total counter\n";
+    foreach (QString path, mPushedBytes.keys()) {
+        out << "gidsync_pushed_bytes_total{" << repoLabels(path) << "} "
+            << mPushedBytes.value(path) << "\n";
+    }
+
+    out << "# HELP gidsync_last_success_timestamp_seconds Time of the last "
+           "successful refresh.\n"
+        << "# TYPE gidsync_last_success_timestamp_seconds gauge\n";
+    foreach (QString path, mLastSuccess.keys()) {
+        out << "gidsync_last_success_timestamp_seconds{" << repoLabels(path)
+            << "} " << mLastSuccess.value(path).toSecsSinceEpoch() << "\n";
+    }
+
+    out.flush();
+    return s.toUtf8();
+}
+
+QString SyncMetrics::label(QString name, QString value)
+{
+    value.replace("\\", "\\\\");
+    value.replace("\"", "\\\"");
+    value.replace("\n", "\\n");
+    return QString("%1=\"%2\"").arg(name, value);
+}
+
+QString SyncMetrics::number(double value)
+{
+    return QString::number(value, 'g', 10);
+}
@@ -0,0 +1,87 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* SyncMetrics
+ *
+ * Counters and histograms of refreshes, formatted in the Prometheus text
+ * exposition format (see MetricsServer). Metrics, with labels path being the
+ * repo path and repo the repo name:
+ *
+ *   gidsync_repos{state}                          Repos per state (gauge)
+ *   gidsync_queued_refreshes                      Refreshes waiting (gauge)
+ *   gidsync_running_refreshes                     Refreshes running (gauge)
+ *   gidsync_refreshes_total{repo,path,result}     Finished refreshes
+ *   gidsync_refresh_duration_seconds{repo,path}   Refresh duration histogram
+ *   gidsync_git_processes_total{command}          Git processes run
+ *   gidsync_fetched_bytes_total{repo,path}        Received by fetch
+ *   gidsync_pushed_bytes_total{repo,path}         Sent by push
+ *   gidsync_last_success_timestamp_seconds{repo,path}
+ *
+ * Series are kept per repo path, as names need not be unique. The names are
+ * passed in when formatting, together with the state gauges, as they belong
+ * to the front end (GUI or daemon). So renaming a repo just relabels its
+ * series.
+ */
+
+#ifndef SYNCMETRICS_H
+#define SYNCMETRICS_H
+
+#include "syncengine.h"
+
+#include <QDateTime>
+#include <QMap>
+#include <QVector>
+
+class SyncMetrics
+{
+public:
+    // From a Finished event
+    void addRefresh(QString path, const SyncEngine::Event& event);
+    void setLastSuccess(QString path, QDateTime time);
+    void removeRepo(QString path);
+
+    // repoNames maps repo paths to names
+    QByteArray exposition(QMap<QString, QString> repoNames,
+                          QMap<QString, int> reposByState, int queued,
+                          int running);
+
+private:
+    struct Histogram
+    {
+        // Cumulative counts are computed when formatting
+        QVector<quint64> counts;
+        quint64 count = 0;
+        double sum = 0;
+    };
+    static const QVector<double> durationBuckets;
+
+    QMap<QString, Histogram> mDurations;
+    QMap<QString, quint64> mRefreshesOk;
+    QMap<QString, quint64> mRefreshesFailed;
+    QMap<QString, quint64> mGitProcesses;
+    QMap<QString, quint64> mFetchedBytes;
+    QMap<QString, quint64> mPushedBytes;
+    QMap<QString, QDateTime> mLastSuccess;
+
+    static QString label(QString name, QString value);
+    static QString number(double value);
+};
+
+#endif // SYNCMETRICS_H
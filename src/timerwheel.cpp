@@ -0,0 +1,212 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "timerwheel.h"
+
+#include <limits>
+
+TimerWheel::TimerWheel(int resolutionMsecs, QObject *parent)
+    : QObject{parent}
+    , mResolutionMsecs(qMax(1, resolutionMsecs))
+{
+    mClock.start();
+    mWakeTimer.setSingleShot(true);
+    // Ticks are coarse anyway, so let the system group wakeups
+    mWakeTimer.setTimerType(Qt::CoarseTimer);
+    connect(&mWakeTimer, &QTimer::timeout, this, [=]()
+    {
+        advance();
+    });
+}
+
+void TimerWheel::start(Settings::RepoPtr repo, qint64 msecs)
+{
+    if (mTimers.contains(repo)) {
+        unplace(repo, mTimers.take(repo));
+    }
+
+    Timer timer;
+    timer.dueMsecs = mClock.elapsed() + qMax(qint64(0), msecs);
+    // Round up so a timer never expires early. Due ticks that have already
+    // been processed are handled in the next one. If the wheel is behind
+    // (wake timer not handled yet), it catches up when it is.
+    timer.dueTick = (timer.dueMsecs + mResolutionMsecs - 1) / mResolutionMsecs;
+    timer.dueTick = qMax(timer.dueTick, mTick + 1);
+    place(repo, timer);
+
+    arm();
+}
+
+void TimerWheel::stop(Settings::RepoPtr repo)
+{
+    if (!mTimers.contains(repo)) { return; }
+
+    unplace(repo, mTimers.take(repo));
+    arm();
+}
+
+bool TimerWheel::isActive(Settings::RepoPtr repo) const
+{
+    return mTimers.contains(repo);
+}
+
+qint64 TimerWheel::remainingTime(Settings::RepoPtr repo) const
+{
+    auto it = mTimers.constFind(repo);
+    if (it == mTimers.constEnd()) { return -1; }
+
+    return qMax(qint64(0), it->dueMsecs - mClock.elapsed());
+}
+
+int TimerWheel::count() const
+{
+    return mTimers.count();
+}
+
+qint64 TimerWheel::currentTick() const
+{
+    return mClock.elapsed() / mResolutionMsecs;
+}
+
+void TimerWheel::place(Settings::RepoPtr repo, Timer timer)
+{
+    // Find the lowest level whose range covers the due tick. Timers beyond
+    // the top level are parked in its furthest slot and placed again when
+    // that slot is cascaded.
+    qint64 delta = timer.dueTick - mTick;
+    int level = 0;
+    while ((level < levelCount - 1)
+           && (delta >= (qint64(1) << (slotBits * (level + 1))))) {
+        level++;
+    }
+    qint64 tick = timer.dueTick;
+    qint64 range = qint64(1) << (slotBits * levelCount);
+    if (delta >= range) {
+        tick = mTick + range - 1;
+    }
+
+    timer.level = level;
+    timer.slot = (tick >> (slotBits * level)) & slotMask;
+    mSlots[level][timer.slot].insert(repo);
+    mOccupied[level] |= (quint64(1) << timer.slot);
+    mTimers.insert(repo, timer);
+}
+
+void TimerWheel::unplace(Settings::RepoPtr repo, const Timer& timer)
+{
+    QSet<Settings::RepoPtr>& slot = mSlots[timer.level][timer.slot];
+    slot.remove(repo);
+    if (slot.isEmpty()) {
+        mOccupied[timer.level] &= ~(quint64(1) << timer.slot);
+    }
+}
+
+void TimerWheel::cascade(int level, int slot)
+{
+    QSet<Settings::RepoPtr> repos;
+    repos.swap(mSlots[level][slot]);
+    mOccupied[level] &= ~(quint64(1) << slot);
+
+    foreach (Settings::RepoPtr repo, repos) {
+        place(repo, mTimers.take(repo));
+    }
+}
+
+void TimerWheel::advance()
+{
+    QList<Settings::RepoPtr> due;
+    qint64 now = currentTick();
+
+    while (mTick < now) {
+        // Skip ahead over ticks where nothing happens
+        qint64 next = nextWakeTick();
+        if ((next < 0) || (next > now)) {
+            mTick = now;
+            break;
+        }
+        mTick = next;
+
+        // Move timers down from higher levels whose slot starts now, highest
+        // level first so they can cascade further down in the same tick.
+        for (int level = levelCount - 1; level > 0; level--) {
+            qint64 mask = (qint64(1) << (slotBits * level)) - 1;
+            if ((mTick & mask) == 0) {
+                cascade(level, (mTick >> (slotBits * level)) & slotMask);
+            }
+        }
+
+        int slot = mTick & slotMask;
+        QSet<Settings::RepoPtr> repos;
+        repos.swap(mSlots[0][slot]);
+        mOccupied[0] &= ~(quint64(1) << slot);
+        foreach (Settings::RepoPtr repo, repos) {
+            Timer timer = mTimers.take(repo);
+            if (timer.dueTick <= mTick) {
+                due.append(repo);
+            } else {
+                // Parked beyond the top level
+                place(repo, timer);
+            }
+        }
+    }
+
+    arm();
+
+    if (!due.isEmpty()) {
+        emit expired(due);
+    }
+}
+
+qint64 TimerWheel::nextWakeTick() const
+{
+    // Earliest tick after mTick at which a level 0 slot expires or a higher
+    // level slot has to be cascaded. -1 if there are no timers.
+    qint64 best = -1;
+    for (int level = 0; level < levelCount; level++) {
+        quint64 occupied = mOccupied[level];
+        if (!occupied) { continue; }
+
+        int shift = slotBits * level;
+        // Index of the next slot start of this level
+        qint64 base = (mTick >> shift) + 1;
+        for (int slot = 0; slot < slotCount; slot++) {
+            if (!(occupied & (quint64(1) << slot))) { continue; }
+            qint64 index = base + ((slot - base) & slotMask);
+            qint64 tick = index << shift;
+            if ((best < 0) || (tick < best)) {
+                best = tick;
+            }
+        }
+    }
+    return best;
+}
+
+void TimerWheel::arm()
+{
+    qint64 tick = nextWakeTick();
+    if (tick < 0) {
+        mWakeTimer.stop();
+        return;
+    }
+    qint64 msecs = tick * mResolutionMsecs - mClock.elapsed();
+    qint64 maxMsecs = std::numeric_limits<int>::max();
+    // Simply wakes up early if the next tick is very far away
+    mWakeTimer.start(int(qBound(qint64(0), msecs, maxMsecs)));
+}
@@ -0,0 +1,97 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* TimerWheel
+ *
+ * Single-shot timers for any number of repos, driven by a single QTimer.
+ *
+ * Due times are kept in a hierarchical timer wheel: levels of 64 slots each,
+ * where a slot of level 0 spans one tick (the resolution) and a slot of each
+ * next level spans 64 slots of the level below it. Starting and stopping a
+ * timer is O(1). When time reaches the start of a higher level slot, its
+ * timers are moved down to the level below.
+ *
+ * The QTimer is only armed for the earliest tick that has something to do, so
+ * the number of wakeups does not grow with the number of repos. All timers
+ * that fall due in the same tick are reported together in one expired()
+ * signal.
+ */
+
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include "settings.h"
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QTimer>
+
+class TimerWheel : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TimerWheel(int resolutionMsecs = 1000, QObject *parent = nullptr);
+
+    // (Re)start the timer of the repo to expire after msecs
+    void start(Settings::RepoPtr repo, qint64 msecs);
+    void stop(Settings::RepoPtr repo);
+    bool isActive(Settings::RepoPtr repo) const;
+    // Milliseconds until the timer of the repo expires, or -1 if not active
+    qint64 remainingTime(Settings::RepoPtr repo) const;
+    int count() const;
+
+signals:
+    void expired(QList<Settings::RepoPtr> repos);
+
+private:
+    static const int slotBits = 6;
+    static const int slotCount = 1 << slotBits;
+    static const int slotMask = slotCount - 1;
+    static const int levelCount = 4;
+
+    struct Timer {
+        qint64 dueMsecs = 0;
+        qint64 dueTick = 0;
+        int level = 0;
+        int slot = 0;
+    };
+
+    int mResolutionMsecs;
+    QElapsedTimer mClock;
+    // Last tick that was processed
+    qint64 mTick = 0;
+    QHash<Settings::RepoPtr, Timer> mTimers;
+    QSet<Settings::RepoPtr> mSlots[levelCount][slotCount];
+    // Bit n is set if slot n of the level is not empty
+    quint64 mOccupied[levelCount] = {};
+    QTimer mWakeTimer;
+
+    qint64 currentTick() const;
+    void place(Settings::RepoPtr repo, Timer timer);
+    void unplace(Settings::RepoPtr repo, const Timer& timer);
+    void cascade(int level, int slot);
+    void advance();
+    void arm();
+    qint64 nextWakeTick() const;
+};
+
+#endif // TIMERWHEEL_H
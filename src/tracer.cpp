@@ -0,0 +1,224 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "tracer.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QJsonDocument>
+#include <QMutexLocker>
+#include <QThread>
+
+Tracer::Tracer(QString dir)
+    : mDir(dir)
+{
+    mClock.start();
+    mPid = QCoreApplication::applicationPid();
+}
+
+Tracer::~Tracer()
+{
+    flush();
+}
+
+void Tracer::setMaxFileSize(qint64 bytes)
+{
+    QMutexLocker locker(&mMutex);
+    mMaxFileSize = qMax(qint64(maxBufferSize), bytes);
+}
+
+void Tracer::setMaxFiles(int count)
+{
+    QMutexLocker locker(&mMutex);
+    mMaxFiles = qMax(1, count);
+}
+
+bool Tracer::open()
+{
+    QMutexLocker locker(&mMutex);
+    return openLocked();
+}
+
+QString Tracer::filePath()
+{
+    return rotatedFilePath(0);
+}
+
+qint64 Tracer::nowUsecs() const
+{
+    return mClock.nsecsElapsed() / 1000;
+}
+
+void Tracer::complete(QString name, QString category, qint64 startUsecs,
+                      QJsonObject args)
+{
+    qint64 now = nowUsecs();
+
+    QMutexLocker locker(&mMutex);
+    QJsonObject e;
+    e.insert("name", name);
+    e.insert("cat", category);
+    e.insert("ph", "X");
+    e.insert("ts", startUsecs);
+    e.insert("dur", now - startUsecs);
+    e.insert("pid", mPid);
+    e.insert("tid", currentThreadId());
+    if (!args.isEmpty()) {
+        e.insert("args", args);
+    }
+    append(e);
+}
+
+void Tracer::asyncSpan(QString name, QString category, quint64 id,
+                       qint64 startUsecs, qint64 endUsecs, QJsonObject args)
+{
+    QMutexLocker locker(&mMutex);
+    QJsonObject e;
+    e.insert("name", name);
+    e.insert("cat", category);
+    e.insert("id", QString::number(id, 16));
+    e.insert("pid", mPid);
+    e.insert("tid", currentThreadId());
+
+    QJsonObject begin = e;
+    begin.insert("ph", "b");
+    begin.insert("ts", startUsecs);
+    if (!args.isEmpty()) {
+        begin.insert("args", args);
+    }
+    append(begin);
+
+    QJsonObject end = e;
+    end.insert("ph", "e");
+    end.insert("ts", endUsecs);
+    append(end);
+}
+
+void Tracer::flush()
+{
+    QMutexLocker locker(&mMutex);
+    flushLocked();
+}
+
+QString Tracer::rotatedFilePath(int index)
+{
+    if (index == 0) {
+        return QString("%1/gid-sync-trace.json").arg(mDir);
+    }
+    return QString("%1/gid-sync-trace.%2.json").arg(mDir).arg(index);
+}
+
+int Tracer::currentThreadId()
+{
+    Qt::HANDLE handle = QThread::currentThreadId();
+    if (mThreadIds.contains(handle)) {
+        return mThreadIds.value(handle);
+    }
+
+    int id = mThreadIds.count() + 1;
+    mThreadIds.insert(handle, id);
+
+    QCoreApplication* app = QCoreApplication::instance();
+    QString name;
+    if (app && (QThread::currentThread() == app->thread())) {
+        name = "GUI";
+    } else {
+        // Not the object name: Qt names all pool threads "Thread (pooled)"
+        name = QString("Worker %1").arg(id);
+    }
+    mThreadNames.insert(id, name);
+
+    QJsonObject args;
+    args.insert("name", name);
+    QJsonObject e;
+    e.insert("name", "thread_name");
+    e.insert("ph", "M");
+    e.insert("pid", mPid);
+    e.insert("tid", id);
+    e.insert("args", args);
+    append(e);
+
+    return id;
+}
+
+void Tracer::append(QJsonObject event)
+{
+    mBuffer.append(QJsonDocument(event).toJson(QJsonDocument::Compact));
+    mBuffer.append(",\n");
+    if (mBuffer.size() >= maxBufferSize) {
+        flushLocked();
+    }
+}
+
+void Tracer::writeThreadNames()
+{
+    // Each file has to name the threads again
+    foreach (int id, mThreadNames.keys()) {
+        QJsonObject args;
+        args.insert("name", mThreadNames.value(id));
+        QJsonObject e;
+        e.insert("name", "thread_name");
+        e.insert("ph", "M");
+        e.insert("pid", mPid);
+        e.insert("tid", id);
+        e.insert("args", args);
+        mFile.write(QJsonDocument(e).toJson(QJsonDocument::Compact) + ",\n");
+    }
+}
+
+void Tracer::flushLocked()
+{
+    if (!mFile.isOpen()) {
+        mBuffer.clear();
+        return;
+    }
+    if (mBuffer.isEmpty()) { return; }
+
+    if (mFile.size() + mBuffer.size() > mMaxFileSize) {
+        if (!openLocked()) {
+            mBuffer.clear();
+            return;
+        }
+        writeThreadNames();
+    }
+    mFile.write(mBuffer);
+    mFile.flush();
+    mBuffer.clear();
+}
+
+bool Tracer::openLocked()
+{
+    if (mFile.isOpen()) {
+        mFile.close();
+    }
+
+    QDir().mkpath(mDir);
+    QFile::remove(rotatedFilePath(mMaxFiles - 1));
+    for (int i = mMaxFiles - 2; i >= 0; i--) {
+        QFile::rename(rotatedFilePath(i), rotatedFilePath(i + 1));
+    }
+
+    mFile.setFileName(rotatedFilePath(0));
+    if (!mFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+    mFile.write("[\n");
+    return true;
+}
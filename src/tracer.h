@@ -0,0 +1,98 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+/* Tracer
+ *
+ * Writes spans of refresh jobs, their states and Git commands to a file in
+ * the Chrome Trace Event format, which can be loaded into Perfetto
+ * (ui.perfetto.dev) or chrome://tracing. This shows at a glance how refreshes
+ * overlap, how long they wait in the queue and what blocks the GUI thread.
+ *
+ * The file uses the JSON array format without the closing bracket, which the
+ * viewers accept, so events can simply be appended. Once the file reaches the
+ * max size it is rotated: gid-sync-trace.json becomes gid-sync-trace.1.json
+ * and so on, up to the max number of files.
+ *
+ * May be used from any thread. Events are buffered and written once the
+ * buffer is full, on flush() and when the tracer is destroyed.
+ */
+
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QJsonObject>
+#include <QMutex>
+#include <QSharedPointer>
+
+class Tracer
+{
+public:
+    explicit Tracer(QString dir);
+    ~Tracer();
+
+    void setMaxFileSize(qint64 bytes);
+    void setMaxFiles(int count);
+
+    // Rotates existing files and starts a new one
+    bool open();
+    QString filePath();
+
+    // Monotonic time used for all events
+    qint64 nowUsecs() const;
+
+    // Span on the current thread from startUsecs until now
+    void complete(QString name, QString category, qint64 startUsecs,
+                  QJsonObject args = QJsonObject());
+    // Span not tied to a thread, e.g. time spent in a queue. Spans with the
+    // same id are shown on the same track.
+    void asyncSpan(QString name, QString category, quint64 id,
+                   qint64 startUsecs, qint64 endUsecs,
+                   QJsonObject args = QJsonObject());
+
+    void flush();
+
+private:
+    QString mDir;
+    qint64 mMaxFileSize = 20 * 1024 * 1024;
+    int mMaxFiles = 3;
+    QElapsedTimer mClock;
+    qint64 mPid = 0;
+
+    QMutex mMutex;
+    QFile mFile;
+    QByteArray mBuffer;
+    static const int maxBufferSize = 64 * 1024;
+    // Small ids for the threads seen so far, with their names
+    QHash<Qt::HANDLE, int> mThreadIds;
+    QHash<int, QString> mThreadNames;
+
+    QString rotatedFilePath(int index);
+    int currentThreadId();
+    void append(QJsonObject event);
+    void writeThreadNames();
+    void flushLocked();
+    bool openLocked();
+};
+typedef QSharedPointer<Tracer> TracerPtr;
+
+#endif // TRACER_H
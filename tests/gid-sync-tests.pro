@@ -0,0 +1,8 @@
+# Unit tests. Build and run from a build directory:
+#   qmake ../tests/gid-sync-tests.pro && make && make check
+
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    git \
+    syncengine
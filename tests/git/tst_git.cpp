@@ -0,0 +1,321 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "git.h"
+#include "gitbackend.h"
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QTemporaryDir>
+#include <QtTest>
+
+class TestGit : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void parseConfigFile_sections();
+    void parseConfigFile_values();
+    void readPackedRef_sorted();
+    void readPackedRef_unsorted();
+    void matchesIncludePattern_data();
+    void matchesIncludePattern();
+    void remoteUrl_insteadOf();
+    void configValue_include();
+    void configValue_includeIfGitdir();
+    void replay_nativeReads();
+    void replay_timeoutAndCancel();
+
+private:
+    QTemporaryDir mDir;
+
+    QString writeFile(QString name, QByteArray data);
+    // Minimal repo that the native readers recognise
+    QString createRepo(QString name, QByteArray config);
+    static QString value(const QList<Git::ConfigEntry>& entries, QString key);
+};
+
+void TestGit::initTestCase()
+{
+    QVERIFY(mDir.isValid());
+    // Keep the user's and system config out of the tests
+    qputenv("GIT_CONFIG_NOSYSTEM", "1");
+    qputenv("GIT_CONFIG_GLOBAL", writeFile("global.config", "").toUtf8());
+}
+
+QString TestGit::writeFile(QString name, QByteArray data)
+{
+    QString filename = mDir.filePath(name);
+    QDir().mkpath(QFileInfo(filename).path());
+    QFile f(filename);
+    if (f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        f.write(data);
+    }
+    return filename;
+}
+
+QString TestGit::createRepo(QString name, QByteArray config)
+{
+    writeFile(name + "/.git/HEAD", "ref: refs/heads/main\n");
+    writeFile(name + "/.git/config", config);
+    QDir().mkpath(mDir.filePath(name + "/.git/objects"));
+    QDir().mkpath(mDir.filePath(name + "/.git/refs/heads"));
+    return mDir.filePath(name);
+}
+
+QString TestGit::value(const QList<Git::ConfigEntry>& entries, QString key)
+{
+    QString ret;
+    foreach (const Git::ConfigEntry& e, entries) {
+        if (e.key == key) { ret = e.value; }
+    }
+    return ret;
+}
+
+void TestGit::parseConfigFile_sections()
+{
+    QString filename = writeFile("sections.config",
+        "# comment\n"
+        "[Core]\n"
+        "\tBare = false\n"
+        "[remote \"Origin\"]\n"
+        "\turl = https://example.com/a.git\n"
+        "[branch.Main]\n"
+        "\tremote = origin\n"
+        "[section \"sub \\\"quoted\\\"\"]\n"
+        "\tkey = 1\n");
+
+    QList<Git::ConfigEntry> entries = Git::parseConfigFile(filename);
+    QCOMPARE(entries.count(), 4);
+    // Section and name lower case, subsection as is
+    QCOMPARE(value(entries, "core.bare"), QString("false"));
+    QCOMPARE(value(entries, "remote.Origin.url"),
+             QString("https://example.com/a.git"));
+    // Deprecated [section.subsection] is lower case as a whole
+    QCOMPARE(value(entries, "branch.main.remote"), QString("origin"));
+    QCOMPARE(value(entries, "section.sub \"quoted\".key"), QString("1"));
+}
+
+void TestGit::parseConfigFile_values()
+{
+    QString filename = writeFile("values.config",
+        "[test]\n"
+        "\tflag\n"
+        "\ttrailing = value   ; comment\n"
+        "\tquoted = \"  a ; b  \"\n"
+        "\tescapes = a\\tb\\\\c\\\"d\n"
+        "\tcontinued = one \\\n"
+        "two\n"
+        "\tcrlf = value\r\n");
+
+    QList<Git::ConfigEntry> entries = Git::parseConfigFile(filename);
+    QCOMPARE(value(entries, "test.flag"), QString("true"));
+    QCOMPARE(value(entries, "test.trailing"), QString("value"));
+    QCOMPARE(value(entries, "test.quoted"), QString("  a ; b  "));
+    QCOMPARE(value(entries, "test.escapes"), QString("a\tb\\c\"d"));
+    QCOMPARE(value(entries, "test.continued"), QString("one two"));
+    QCOMPARE(value(entries, "test.crlf"), QString("value"));
+}
+
+void TestGit::readPackedRef_sorted()
+{
+    QString filename = writeFile("sorted/packed-refs",
+        "# pack-refs with: peeled fully-peeled sorted \n"
+        "1111111111111111111111111111111111111111 refs/heads/a\n"
+        "2222222222222222222222222222222222222222 refs/heads/main\n"
+        "3333333333333333333333333333333333333333 refs/remotes/origin/main\n"
+        "4444444444444444444444444444444444444444 refs/tags/v1\n"
+        "^5555555555555555555555555555555555555555\n"
+        "6666666666666666666666666666666666666666 refs/tags/v2\n");
+
+    QCOMPARE(Git::readPackedRef(filename, "refs/heads/a"),
+             QString("1111111111111111111111111111111111111111"));
+    QCOMPARE(Git::readPackedRef(filename, "refs/remotes/origin/main"),
+             QString("3333333333333333333333333333333333333333"));
+    // The tag itself, not its peeled commit
+    QCOMPARE(Git::readPackedRef(filename, "refs/tags/v1"),
+             QString("4444444444444444444444444444444444444444"));
+    QCOMPARE(Git::readPackedRef(filename, "refs/tags/v2"),
+             QString("6666666666666666666666666666666666666666"));
+    QCOMPARE(Git::readPackedRef(filename, "refs/heads/b"), QString());
+    QCOMPARE(Git::readPackedRef(filename, "refs/heads/mai"), QString());
+}
+
+void TestGit::readPackedRef_unsorted()
+{
+    QString filename = writeFile("unsorted/packed-refs",
+        "2222222222222222222222222222222222222222 refs/heads/main\n"
+        "1111111111111111111111111111111111111111 refs/heads/a");
+
+    QCOMPARE(Git::readPackedRef(filename, "refs/heads/a"),
+             QString("1111111111111111111111111111111111111111"));
+    QCOMPARE(Git::readPackedRef(filename, "refs/heads/main"),
+             QString("2222222222222222222222222222222222222222"));
+    QCOMPARE(Git::readPackedRef(mDir.filePath("missing"), "refs/heads/a"),
+             QString());
+}
+
+void TestGit::matchesIncludePattern_data()
+{
+    QTest::addColumn<QString>("pattern");
+    QTest::addColumn<QString>("path");
+    QTest::addColumn<bool>("caseInsensitive");
+    QTest::addColumn<bool>("matches");
+
+    QTest::newRow("trailing slash") << "/home/u/work/" << "/home/u/work/a/.git"
+                                    << false << true;
+    QTest::newRow("other dir") << "/home/u/work/" << "/home/u/play/a/.git"
+                               << false << false;
+    QTest::newRow("star stays in dir") << "/home/*/.git" << "/home/u/a/.git"
+                                       << false << false;
+    QTest::newRow("star") << "/home/*/a/.git" << "/home/u/a/.git"
+                          << false << true;
+    QTest::newRow("double star") << "**/a/.git" << "/home/u/a/.git"
+                                 << false << true;
+    QTest::newRow("case") << "/Home/U/" << "/home/u/a/.git" << false << false;
+    QTest::newRow("case insensitive") << "/Home/U/" << "/home/u/a/.git"
+                                      << true << true;
+    QTest::newRow("branch") << "feature/" << "feature/x" << false << true;
+    QTest::newRow("branch exact") << "main" << "main" << false << true;
+}
+
+void TestGit::matchesIncludePattern()
+{
+    QFETCH(QString, pattern);
+    QFETCH(QString, path);
+    QFETCH(bool, caseInsensitive);
+    QFETCH(bool, matches);
+
+    QCOMPARE(Git::matchesIncludePattern(pattern, path, caseInsensitive),
+             matches);
+}
+
+void TestGit::remoteUrl_insteadOf()
+{
+    QString path = createRepo("insteadof",
+        "[remote \"origin\"]\n"
+        "\turl = gh:user/repo.git\n"
+        "[url \"https://github.com/\"]\n"
+        "\tinsteadOf = gh:\n"
+        "[url \"git@github.com:user/\"]\n"
+        "\tinsteadOf = gh:user/\n");
+
+    Git git(path);
+    // The longest matching prefix wins
+    QCOMPARE(git.remoteUrl("origin").result,
+             QString("git@github.com:user/repo.git"));
+    QVERIFY(git.remoteUrl("missing").gitOutput.hasError);
+}
+
+void TestGit::configValue_include()
+{
+    writeFile("include/extra.config",
+        "[core]\n"
+        "\tsshCommand = ssh -i extra\n");
+    QString path = createRepo("include",
+        "[core]\n"
+        "\tsshCommand = ssh -i before\n"
+        "[include]\n"
+        "\tpath = ../../include/extra.config\n");
+
+    // Relative to the including file
+    Git git(path);
+    QCOMPARE(git.configValue("core.sshCommand").result,
+             QString("ssh -i extra"));
+}
+
+void TestGit::configValue_includeIfGitdir()
+{
+    QString work = writeFile("includeif/work.config",
+        "[remote \"origin\"]\n"
+        "\turl = https://work.example.com/repo.git\n");
+    QByteArray config = QString(
+        "[remote \"origin\"]\n"
+        "\turl = https://example.com/repo.git\n"
+        "[includeIf \"gitdir:%1/work/\"]\n"
+        "\tpath = %2\n").arg(mDir.path(), work).toUtf8();
+
+    Git inside(createRepo("work/repo", config));
+    QCOMPARE(inside.remoteUrl("origin").result,
+             QString("https://work.example.com/repo.git"));
+
+    Git outside(createRepo("play/repo", config));
+    QCOMPARE(outside.remoteUrl("origin").result,
+             QString("https://example.com/repo.git"));
+}
+
+void TestGit::replay_nativeReads()
+{
+    QString path = createRepo("record", "");
+    QString first(40, '1');
+    QString second(40, '2');
+
+    GitRecordingPtr recording(new GitRecording());
+    Git recorder(path);
+    recorder.setBackend(GitBackendPtr(new RecordingGitBackend(recording)));
+    writeFile("record/.git/refs/heads/main", first.toUtf8() + "\n");
+    QCOMPARE(recorder.resolveRef("HEAD").result, first);
+    writeFile("record/.git/refs/heads/main", second.toUtf8() + "\n");
+    QCOMPARE(recorder.resolveRef("HEAD").result, second);
+    QCOMPARE(recording->paths(), QStringList({path}));
+
+    // Answered from the recording in order, without the repo on disk
+    Git replayer(mDir.filePath("missing"));
+    replayer.setBackend(GitBackendPtr(new ReplayGitBackend(recording, 0)));
+    QCOMPARE(replayer.resolveRef("HEAD").result, first);
+    QCOMPARE(replayer.resolveRef("HEAD").result, second);
+    QCOMPARE(replayer.resolveRef("HEAD").result, second);
+}
+
+void TestGit::replay_timeoutAndCancel()
+{
+    GitRecordingPtr recording(new GitRecording());
+    GitRecording::Entry e;
+    e.path = "/repo";
+    e.cmd = "git fetch";
+    e.output.exitcode = 0;
+    e.output.durationMsecs = 60 * 1000;
+    recording->append(e);
+
+    QElapsedTimer timer;
+    timer.start();
+    Git::Output out;
+    ReplayGitBackend timingOut(recording);
+    QVERIFY(timingOut.run("/replay", "git fetch", QByteArray(),
+                          Git::CancelTokenPtr(), 200, &out));
+    QVERIFY(out.timedOut);
+    QVERIFY(out.hasError);
+    QVERIFY(timer.elapsed() < 10 * 1000);
+
+    timer.restart();
+    Git::CancelTokenPtr token(new Git::CancelToken());
+    token->cancel();
+    ReplayGitBackend cancelled(recording);
+    QVERIFY(cancelled.run("/replay", "git fetch", QByteArray(), token, 0, &out));
+    QVERIFY(out.cancelled);
+    QVERIFY(out.hasError);
+    QVERIFY(timer.elapsed() < 10 * 1000);
+}
+
+QTEST_GUILESS_MAIN(TestGit)
+#include "tst_git.moc"
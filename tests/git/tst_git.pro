@@ -0,0 +1,25 @@
+# Tests of the native Git readers and the record/replay backends
+
+
+QT       -= gui
+QT       += testlib
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_git
+
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_git.cpp \
+    ../../src/git.cpp \
+    ../../src/gitbackend.cpp \
+    ../../src/gidfile.cpp \
+    ../../src/tracer.cpp
+
+HEADERS += \
+    ../../src/git.h \
+    ../../src/gitbackend.h \
+    ../../src/gidfile.h \
+    ../../src/tracer.h
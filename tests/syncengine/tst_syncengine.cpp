@@ -0,0 +1,373 @@
+/******************************************************************************
+ *
+ * This file is part of Gid-Sync.
+ * Copyright (C) 2024 Gideon van der Kolf
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *****************************************************************************/
+
+#include "gitbackend.h"
+#include "settings.h"
+#include "sshmux.h"
+#include "syncengine.h"
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QTemporaryDir>
+#include <QtTest>
+
+class TestSyncEngine : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+
+    void sshMultiplexing_wrapperUsed();
+    void sshMultiplexing_ownSshCommandKept();
+    void replay_sameDecisions();
+    void replay_networkTimeout();
+    void replay_cancel();
+
+private:
+    QTemporaryDir mDir;
+    QMutex mMutex;
+    QList<SyncEngine::Event> mFinished;
+
+    QString writeFile(QString name, QByteArray data);
+    QString readFile(QString name);
+    bool git(QString path, QString arguments);
+    static QString quoted(QString s);
+    // Clone of a bare remote with one commit, up to date
+    Settings::RepoPtr createRepo(QString name);
+    // Script to use as ssh that logs its arguments to <name>.log and runs the
+    // Git command locally
+    QString createSshWrapper(QString name);
+    void setUp(SyncEngine& engine);
+    // Refresh and wait for it to finish
+    SyncEngine::Event refresh(SyncEngine& engine, Settings::RepoPtr repo);
+    // Refresh of a repo behind its remote, recorded
+    GitRecordingPtr recordRefresh(QString name, SyncEngine::Event* finished);
+    // Copy of the recording with network commands taking a minute
+    static GitRecordingPtr slowNetwork(GitRecordingPtr recording);
+    static QStringList commandNames(const SyncEngine::Event& event);
+};
+
+void TestSyncEngine::initTestCase()
+{
+    QVERIFY(mDir.isValid());
+    // Keep the user's and system config out of the tests
+    qputenv("GIT_CONFIG_NOSYSTEM", "1");
+    qputenv("GIT_CONFIG_GLOBAL", writeFile("global.config", "").toUtf8());
+    qunsetenv("GIT_SSH_COMMAND");
+    qunsetenv("GIT_SSH");
+    // Only the host and command are passed to the ssh wrappers
+    qputenv("GIT_SSH_VARIANT", "simple");
+}
+
+QString TestSyncEngine::writeFile(QString name, QByteArray data)
+{
+    QString filename = mDir.filePath(name);
+    QDir().mkpath(QFileInfo(filename).path());
+    QFile f(filename);
+    if (f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        f.write(data);
+    }
+    return filename;
+}
+
+QString TestSyncEngine::readFile(QString name)
+{
+    QFile f(mDir.filePath(name));
+    if (!f.open(QIODevice::ReadOnly)) { return QString(); }
+    return QString::fromUtf8(f.readAll());
+}
+
+bool TestSyncEngine::git(QString path, QString arguments)
+{
+    Git::Output out = Git(path).runGit(arguments);
+    if (out.hasError) {
+        qWarning() << out.toString();
+        return false;
+    }
+    return true;
+}
+
+QString TestSyncEngine::quoted(QString s)
+{
+    return "\"" + s + "\"";
+}
+
+Settings::RepoPtr TestSyncEngine::createRepo(QString name)
+{
+    QString dir = mDir.path();
+    QString remote = mDir.filePath(name + ".git");
+    QString other = mDir.filePath(name + "-other");
+    QString path = mDir.filePath(name);
+    QString url = "file://" + remote;
+
+    bool ok =    git(dir, "init -q --bare " + quoted(remote))
+              && git(remote, "symbolic-ref HEAD refs/heads/main")
+              && git(dir, "init -q " + quoted(other))
+              && git(other, "symbolic-ref HEAD refs/heads/main")
+              && git(other, "config user.name test")
+              && git(other, "config user.email test@localhost");
+    writeFile(name + "-other/file.txt", "First\n");
+    ok = ok && git(other, "add -A")
+            && git(other, "commit -q -m First")
+            && git(other, "remote add origin " + quoted(url))
+            && git(other, "push -q -u origin main")
+            && git(dir, QString("clone -q %1 %2").arg(quoted(url), quoted(path)))
+            && git(path, "config user.name test")
+            && git(path, "config user.email test@localhost");
+    if (!ok) { return Settings::RepoPtr(); }
+
+    Settings::RepoPtr repo(new Settings::Repo());
+    repo->name = name;
+    repo->path = path;
+    return repo;
+}
+
+QString TestSyncEngine::createSshWrapper(QString name)
+{
+    QString log = mDir.filePath(name + ".log");
+    QString filename = writeFile(name, QString(
+        "#!/bin/sh\n"
+        "echo \"$@\" >> '%1'\n"
+        "for last; do :; done\n"
+        "exec sh -c \"git ${last#git-}\"\n").arg(log).toUtf8());
+    QFile::setPermissions(filename, QFile::ReadOwner | QFile::WriteOwner
+                                    | QFile::ExeOwner);
+    return filename;
+}
+
+void TestSyncEngine::setUp(SyncEngine& engine)
+{
+    engine.setOurName("test");
+    engine.setMaxParallel(1);
+    engine.setHostLimits(0, 0, 0);
+    engine.setEventCallback([=](SyncEngine::Event event)
+    {
+        if (event.type != SyncEngine::Event::Finished) { return; }
+        QMutexLocker locker(&mMutex);
+        mFinished.append(event);
+    });
+}
+
+SyncEngine::Event TestSyncEngine::refresh(SyncEngine& engine,
+                                          Settings::RepoPtr repo)
+{
+    {
+        QMutexLocker locker(&mMutex);
+        mFinished.clear();
+    }
+    engine.refresh(repo);
+    engine.waitForDone();
+
+    QMutexLocker locker(&mMutex);
+    return mFinished.value(0);
+}
+
+void TestSyncEngine::sshMultiplexing_wrapperUsed()
+{
+    Settings::RepoPtr repo = createRepo("mux");
+    QVERIFY(repo);
+    QVERIFY(git(repo->path, "remote set-url origin ssh://localhost"
+                            + mDir.filePath("mux.git")));
+
+    SshMux mux;
+    mux.setSshProgram(createSshWrapper("mux-ssh"));
+    QString command = mux.command();
+    if (command.isEmpty()) {
+        QSKIP("No runtime directory for the ssh sockets");
+    }
+
+    SyncEngine engine;
+    setUp(engine);
+    engine.setSshCommand(command);
+    SyncEngine::Event finished = refresh(engine, repo);
+    QVERIFY2(finished.ok, qPrintable(finished.text + " " + finished.detail));
+    QVERIFY(readFile("mux-ssh.log").contains("ControlMaster=auto"));
+}
+
+void TestSyncEngine::sshMultiplexing_ownSshCommandKept()
+{
+    Settings::RepoPtr repo = createRepo("own");
+    QVERIFY(repo);
+    QVERIFY(git(repo->path, "remote set-url origin ssh://localhost"
+                            + mDir.filePath("own.git")));
+    // Relative to .git/config
+    writeFile("own-ssh.config", "");
+    QVERIFY(git(repo->path, "config include.path ../../own-ssh.config"));
+
+    SshMux mux;
+    mux.setSshProgram(createSshWrapper("own-mux-ssh"));
+    QString command = mux.command();
+    if (command.isEmpty()) {
+        QSKIP("No runtime directory for the ssh sockets");
+    }
+    QString userSsh = createSshWrapper("own-user-ssh");
+
+    SyncEngine engine;
+    setUp(engine);
+    engine.setSshCommand(command);
+    SyncEngine::Event finished = refresh(engine, repo);
+    QVERIFY2(finished.ok, qPrintable(finished.text + " " + finished.detail));
+    QString muxLog = readFile("own-mux-ssh.log");
+    QVERIFY(!muxLog.isEmpty());
+
+    // Set in an included file after the answer was cached
+    writeFile("own-ssh.config", QString("[core]\n\tsshCommand = %1\n")
+                                    .arg(userSsh).toUtf8());
+    finished = refresh(engine, repo);
+    QVERIFY2(finished.ok, qPrintable(finished.text + " " + finished.detail));
+    QVERIFY(!readFile("own-user-ssh.log").isEmpty());
+    QCOMPARE(readFile("own-mux-ssh.log"), muxLog);
+}
+
+GitRecordingPtr TestSyncEngine::recordRefresh(QString name,
+                                              SyncEngine::Event* finished)
+{
+    Settings::RepoPtr repo = createRepo(name);
+    if (!repo) { return GitRecordingPtr(); }
+    // Another client pushes, so the refresh fetches and merges
+    writeFile(name + "-other/file.txt", "Second\n");
+    if (!git(mDir.filePath(name + "-other"), "commit -q -a -m Second")
+            || !git(mDir.filePath(name + "-other"), "push -q")) {
+        return GitRecordingPtr();
+    }
+
+    GitRecordingPtr recording(new GitRecording());
+    SyncEngine engine;
+    setUp(engine);
+    engine.setGitBackendFactory([=]()
+    {
+        return GitBackendPtr(new RecordingGitBackend(recording));
+    });
+    *finished = refresh(engine, repo);
+    return recording;
+}
+
+GitRecordingPtr TestSyncEngine::slowNetwork(GitRecordingPtr recording)
+{
+    GitRecordingPtr slow(new GitRecording());
+    foreach (GitRecording::Entry e, recording->entries()) {
+        if (e.cmd.contains("ls-remote") || e.cmd.contains("fetch")) {
+            e.output.durationMsecs = 60 * 1000;
+        }
+        slow->append(e);
+    }
+    return slow;
+}
+
+QStringList TestSyncEngine::commandNames(const SyncEngine::Event& event)
+{
+    QStringList names;
+    foreach (SyncEngine::Event::Stage command, event.commands) {
+        names.append(command.state);
+    }
+    return names;
+}
+
+void TestSyncEngine::replay_sameDecisions()
+{
+    SyncEngine::Event recorded;
+    GitRecordingPtr recording = recordRefresh("replay", &recorded);
+    QVERIFY(recording);
+    QVERIFY2(recorded.ok, qPrintable(recorded.text + " " + recorded.detail));
+    QVERIFY(recorded.changed);
+
+    // Nothing is read from disk, so the replayed repo need not exist
+    Settings::RepoPtr repo(new Settings::Repo());
+    repo->name = "replayed";
+    repo->path = mDir.filePath("missing");
+
+    SyncEngine engine;
+    setUp(engine);
+    engine.setGitBackendFactory([=]()
+    {
+        return GitBackendPtr(new ReplayGitBackend(recording, 0));
+    });
+    SyncEngine::Event replayed = refresh(engine, repo);
+    QVERIFY2(replayed.ok, qPrintable(replayed.text + " " + replayed.detail));
+    QCOMPARE(replayed.changed, recorded.changed);
+    QCOMPARE(replayed.state, recorded.state);
+    QCOMPARE(commandNames(replayed), commandNames(recorded));
+}
+
+void TestSyncEngine::replay_networkTimeout()
+{
+    SyncEngine::Event recorded;
+    GitRecordingPtr recording = recordRefresh("timeout", &recorded);
+    QVERIFY(recording);
+    GitRecordingPtr slow = slowNetwork(recording);
+
+    Settings::RepoPtr repo(new Settings::Repo());
+    repo->name = "timeout-replayed";
+    repo->path = mDir.filePath("missing");
+
+    SyncEngine engine;
+    setUp(engine);
+    engine.setNetworkTimeout(300);
+    engine.setGitBackendFactory([=]()
+    {
+        return GitBackendPtr(new ReplayGitBackend(slow, 1.0));
+    });
+    QElapsedTimer timer;
+    timer.start();
+    SyncEngine::Event replayed = refresh(engine, repo);
+    QVERIFY(!replayed.ok);
+    QVERIFY(timer.elapsed() < 30 * 1000);
+}
+
+void TestSyncEngine::replay_cancel()
+{
+    SyncEngine::Event recorded;
+    GitRecordingPtr recording = recordRefresh("cancel", &recorded);
+    QVERIFY(recording);
+    GitRecordingPtr slow = slowNetwork(recording);
+
+    Settings::RepoPtr repo(new Settings::Repo());
+    repo->name = "cancel-replayed";
+    repo->path = mDir.filePath("missing");
+
+    SyncEngine engine;
+    setUp(engine);
+    engine.setGitBackendFactory([=]()
+    {
+        return GitBackendPtr(new ReplayGitBackend(slow, 1.0));
+    });
+    {
+        QMutexLocker locker(&mMutex);
+        mFinished.clear();
+    }
+    QElapsedTimer timer;
+    timer.start();
+    engine.refresh(repo);
+    QTest::qWait(300);
+    engine.cancel(repo);
+    engine.waitForDone();
+    QVERIFY(timer.elapsed() < 30 * 1000);
+
+    QMutexLocker locker(&mMutex);
+    QCOMPARE(mFinished.count(), 1);
+    QVERIFY(!mFinished.first().ok);
+}
+
+QTEST_GUILESS_MAIN(TestSyncEngine)
+#include "tst_syncengine.moc"
@@ -0,0 +1,37 @@
+# Tests of refreshes through SyncEngine with local remotes. Linux only.
+
+QT       -= gui
+QT       += testlib
+QT       += network # For QHostInfo
+
+CONFIG += c++17 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_syncengine
+
+INCLUDEPATH += ../../src
+
+SOURCES += \
+    tst_syncengine.cpp \
+    ../../src/gidfile.cpp \
+    ../../src/git.cpp \
+    ../../src/gitbackend.cpp \
+    ../../src/hostlimiter.cpp \
+    ../../src/refreshscheduler.cpp \
+    ../../src/repocache.cpp \
+    ../../src/settings.cpp \
+    ../../src/sshmux.cpp \
+    ../../src/syncengine.cpp \
+    ../../src/tracer.cpp
+
+HEADERS += \
+    ../../src/gidfile.h \
+    ../../src/git.h \
+    ../../src/gitbackend.h \
+    ../../src/hostlimiter.h \
+    ../../src/refreshscheduler.h \
+    ../../src/repocache.h \
+    ../../src/settings.h \
+    ../../src/sshmux.h \
+    ../../src/syncengine.h \
+    ../../src/tracer.h